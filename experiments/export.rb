@@ -0,0 +1,48 @@
+#!/usr/bin/env ruby
+#
+# Compare full-collection export throughput: one yield per entry
+# (each_pair) against one yield per slice (each_slice_pairs).
+#
+
+require 'mdbx'
+require 'benchmark'
+require 'fileutils'
+
+include FileUtils
+
+at_exit do
+	rm_r 'tmpdb'
+end
+
+ROWS = 1_000_000
+
+db = MDBX::Database.open( 'tmpdb', max_size: 2 ** 31, no_metasync: true )
+db.put_many( ( 1..ROWS ).lazy.map {|i| [ "row-%08d" % [i], { id: i, name: "row #{i}" } ] } )
+
+puts "Exporting #{ROWS} rows:"
+
+Benchmark.bm( 28 ) do |x|
+	db.snapshot do
+		x.report( "each_pair:" ) do
+			db.each_pair {|key, val| }
+		end
+
+		[ 100, 1000 ].each do |size|
+			x.report( "each_slice_pairs(%4d):" % [ size ] ) do
+				db.each_slice_pairs( size ) {|keys, vals| }
+			end
+
+			x.report( "each_slice_pairs(%4d, raw):" % [ size ] ) do
+				db.each_slice_pairs( size, raw: true ) {|keys, vals| }
+			end
+		end
+
+		x.report( "cursor.read_batch(1000):" ) do
+			db.cursor do |cursor|
+				until cursor.read_batch( 1000 ).first.empty?; end
+			end
+		end
+	end
+end
+
+db.close
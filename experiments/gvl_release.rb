@@ -0,0 +1,54 @@
+#!/usr/bin/env ruby
+#
+# Measure how much work other Ruby threads can get done while a
+# thread is busy inside mdbx.  A ticker thread counts iterations
+# while the main thread writes, commits, and scans; the more ticks,
+# the less time was spent holding the GVL.
+#
+
+require 'mdbx'
+require 'benchmark'
+require 'fileutils'
+
+include FileUtils
+
+at_exit do
+	rm_r 'tmpdb'
+end
+
+PAIRS = 200_000
+VALUE = 'x' * 512
+
+db = MDBX::Database.open( 'tmpdb', max_size: 2 ** 31, serializer: :raw )
+
+def with_ticker
+	ticks   = 0
+	running = true
+	ticker  = Thread.new { ticks += 1 while running }
+
+	elapsed = Benchmark.realtime { yield }
+	running = false
+	ticker.join
+
+	return elapsed, ticks
+end
+
+def report( label, elapsed, ticks )
+	puts "%20s: %7.3fs, %10d ticker iterations" % [ label, elapsed, ticks ]
+end
+
+pairs = Array.new( PAIRS ) {|i| [ "key-%08d" % [i], VALUE ] }
+
+report( "put_many", *with_ticker { db.put_many(pairs) } )
+
+report( "single puts", *with_ticker {
+	db.transaction { pairs.first( 20_000 ).each {|k, v| db[k] = v } }
+})
+
+report( "snapshot scan", *with_ticker {
+	db.snapshot { db.each_pair {|k, v| } }
+})
+
+report( "get_many", *with_ticker { db.get_many(pairs.map(&:first)) } )
+
+db.close
@@ -0,0 +1,51 @@
+#!/usr/bin/env ruby
+#
+# Measure per-operation overhead of moving keys and values between
+# Ruby and mdbx.  Run against builds before and after a change to
+# rmdbx_key_for() / rmdbx_val_for() to compare.
+#
+
+require 'mdbx'
+require 'benchmark'
+require 'fileutils'
+
+include FileUtils
+
+at_exit do
+	rm_r 'tmpdb'
+end
+
+OPERATIONS = 200_000
+KEYS       = Array.new( 1000 ) {|i| "key-%06d" % [ i ] }
+
+# Measure marshalling only, without Marshal overhead.
+db = MDBX::Database.open( 'tmpdb', max_size: 2 ** 30, no_metasync: true, serializer: :raw )
+
+puts "#{OPERATIONS} operations, raw string values:"
+
+Benchmark.bm( 22 ) do |x|
+	[ 16, 1024, 16384 ].each do |size|
+		value = 'x' * size
+
+		x.report( "put (%5d byte vals):" % [ size ] ) do
+			db.transaction do
+				OPERATIONS.times {|i| db[ KEYS[i % KEYS.size] ] = value }
+			end
+		end
+
+		x.report( "get (%5d byte vals):" % [ size ] ) do
+			db.snapshot do
+				OPERATIONS.times {|i| db[ KEYS[i % KEYS.size] ] }
+			end
+		end
+	end
+
+	x.report( "    get (symbol keys):" ) do
+		keys = KEYS.map( &:to_sym )
+		db.snapshot do
+			OPERATIONS.times {|i| db[ keys[i % keys.size] ] }
+		end
+	end
+end
+
+db.close
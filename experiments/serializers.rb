@@ -0,0 +1,62 @@
+#!/usr/bin/env ruby
+#
+# Compare value serialization strategies: native modes selected at
+# open, against the equivalent Ruby procs, and the stored size of
+# each format.
+#
+
+require 'mdbx'
+require 'benchmark'
+require 'fileutils'
+
+include FileUtils
+
+at_exit do
+	rm_r 'tmpdb'
+end
+
+OPERATIONS = 200_000
+VALUE      = { id: 12345, name: 'A name', tags: %w[ one two three ], score: 1.5 }
+
+def bench( x, label, db, value )
+	x.report( "%22s put:" % [ label ] ) do
+		db.transaction do
+			OPERATIONS.times {|i| db[ i % 1000 ] = value }
+		end
+	end
+	x.report( "%22s get:" % [ label ] ) do
+		db.snapshot do
+			OPERATIONS.times {|i| db[ i % 1000 ] }
+		end
+	end
+	db.close
+	rm_r 'tmpdb'
+end
+
+puts "Encoded value sizes:"
+puts "  Marshal:     %4d bytes" % [ Marshal.dump(VALUE).bytesize ]
+puts "  MessagePack: %4d bytes" % [ MDBX::MessagePack.dump(VALUE).bytesize ]
+puts
+
+puts "#{OPERATIONS} operations per test:"
+
+Benchmark.bm( 28 ) do |x|
+	db = MDBX::Database.open( 'tmpdb', max_size: 2 ** 30, no_metasync: true )
+	bench( x, "native marshal", db, VALUE )
+
+	db = MDBX::Database.open( 'tmpdb', max_size: 2 ** 30, no_metasync: true )
+	db.serializer   = ->( v ) { Marshal.dump( v ) }
+	db.deserializer = ->( v ) { Marshal.load( v ) }
+	bench( x, "proc marshal", db, VALUE )
+
+	db = MDBX::Database.open( 'tmpdb', max_size: 2 ** 30, no_metasync: true, serializer: :msgpack )
+	bench( x, "native msgpack", db, VALUE )
+
+	db = MDBX::Database.open( 'tmpdb', max_size: 2 ** 30, no_metasync: true, serializer: :raw )
+	bench( x, "native raw", db, VALUE.to_s )
+
+	db = MDBX::Database.open( 'tmpdb', max_size: 2 ** 30, no_metasync: true )
+	db.serializer   = nil
+	db.deserializer = nil
+	bench( x, "custom raw", db, VALUE.to_s )
+end
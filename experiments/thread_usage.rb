@@ -13,42 +13,39 @@ end
 
 THREAD_COUNT = 10
 WRITES_PER   = 1000
+READS_PER    = 20_000
 
 puts "#{THREAD_COUNT} simultaneous threads, #{WRITES_PER} writes each:"
 
 def run_bench( db, msg )
-	mtx = Mutex.new
 	Benchmark.bm( 10 ) do |x|
 		puts msg
 		puts '-' * 60
 
+		# Each thread carries its own transaction state, so writers
+		# only serialize on the mdbx write lock.
+		#
 		x.report( " txn per write:" ) do
 			threads = []
 			THREAD_COUNT.times do |i|
 				threads << Thread.new do
-					mtx.synchronize do
-						WRITES_PER.times do
-							key = "%02d-%d" % [ i, rand(1000) ]
-							db[ key ] = rand(1000)
-						end
+					WRITES_PER.times do
+						key = "%02d-%d" % [ i, rand(1000) ]
+						db[ key ] = rand(1000)
 					end
 				end
 			end
 			threads.map( &:join )
 		end
 
-		# Long running transactions require a mutex across threads.
-		#
 		x.report( "txn per thread:" ) do
 			threads = []
 			THREAD_COUNT.times do |i|
 				threads << Thread.new do
-					mtx.synchronize do
-						db.transaction do
-							WRITES_PER.times do
-								key = "%02d-%d" % [ i, rand(1000) ]
-								db[ key ] = rand(1000)
-							end
+					db.transaction do
+						WRITES_PER.times do
+							key = "%02d-%d" % [ i, rand(1000) ]
+							db[ key ] = rand(1000)
 						end
 					end
 				end
@@ -71,9 +68,55 @@ def run_bench( db, msg )
 end
 
 
+# Readers each hold an independent snapshot, and don't block on
+# each other or on a concurrent writer.
+#
+def run_read_bench( db, msg )
+	db.transaction do
+		1000.times {|i| db[ "key-%d" % [i] ] = i }
+	end
+
+	Benchmark.bm( 10 ) do |x|
+		puts msg
+		puts '-' * 60
+
+		[ 1, 2, 4, THREAD_COUNT ].each do |count|
+			x.report( "%2d reader(s):" % [ count ] ) do
+				threads = Array.new( count ) do
+					Thread.new do
+						db.snapshot do
+							( READS_PER / count ).times { db[ "key-%d" % [rand(1000)] ] }
+						end
+					end
+				end
+				threads.map( &:join )
+			end
+		end
+
+		x.report( "readers+writer:" ) do
+			writer = Thread.new do
+				WRITES_PER.times {|i| db[ "key-%d" % [rand(1000)] ] = i }
+			end
+			threads = Array.new( THREAD_COUNT ) do
+				Thread.new do
+					( READS_PER / THREAD_COUNT ).times { db[ "key-%d" % [rand(1000)] ] }
+				end
+			end
+			( threads << writer ).map( &:join )
+		end
+	end
+
+	db.close
+	puts
+end
+
+
 db = MDBX::Database.open( 'tmpdb' )
 run_bench( db, "Default database flags:" )
 
 db = MDBX::Database.open( 'tmpdb', no_metasync: true )
 run_bench( db, "Disabled metasync:" )
 
+db = MDBX::Database.open( 'tmpdb', no_stickythreads: true )
+run_read_bench( db, "Concurrent readers, #{READS_PER} reads total:" )
+
@@ -0,0 +1,129 @@
+/* vim: set noet sta sw=4 ts=4 fdm=marker: */
+/*
+ * Online backups.
+ *
+ * libmdbx copies a consistent snapshot of the whole environment
+ * within a read transaction of its own, so writers (in this process
+ * or others) carry on while the copy is made.  A compacting copy
+ * writes only pages in use, renumbered in order: the result is a
+ * defragmented, often much smaller, data file.
+ *
+ */
+
+#include "mdbx_ext.h"
+
+
+/* Inline struct for copy arguments, passed as a void pointer. */
+struct copy_args_s {
+	MDBX_env *env;
+	const char *path;
+	mdbx_filehandle_t fd;
+	MDBX_copy_flags_t flags;
+	int rc;
+};
+
+
+/* Copy the environment to a path outside of the GVL. */
+static void *
+rmdbx_copy_path_without_gvl( void *ptr )
+{
+	struct copy_args_s *args = (struct copy_args_s *)ptr;
+	args->rc = mdbx_env_copy( args->env, args->path, args->flags );
+	return NULL;
+}
+
+
+/* Copy the environment to a file descriptor outside of the GVL. */
+static void *
+rmdbx_copy_fd_without_gvl( void *ptr )
+{
+	struct copy_args_s *args = (struct copy_args_s *)ptr;
+	args->rc = mdbx_env_copy2fd( args->env, args->fd, args->flags );
+	return NULL;
+}
+
+
+/*
+ * Prepare +args+ for a copy of +db+, raising if it can't be made
+ * from the calling thread.
+ */
+static void
+rmdbx_copy_args( rmdbx_db_t *db, struct copy_args_s *args, VALUE compact, VALUE dynamic )
+{
+	/* The copy's read transaction would clash with the caller's own. */
+	if ( rmdbx_current_txn(db) )
+		rb_raise( rmdbx_eDatabaseError, "Unable to copy database: transaction open" );
+
+	args->flags = MDBX_CP_DEFAULTS;
+	if ( RTEST(compact) ) args->flags |= MDBX_CP_COMPACT;
+	if ( RTEST(dynamic) ) args->flags |= MDBX_CP_FORCE_DYNAMIC_SIZE;
+}
+
+
+/*
+ * call-seq:
+ *    db.copy_to_path( path, compact, force_dynamic_size ) => true
+ *
+ * Copy the database to a new data file at +path+.
+ *
+ */
+VALUE
+rmdbx_copy_to_path( VALUE self, VALUE path, VALUE compact, VALUE dynamic )
+{
+	UNWRAP_DB( self, db );
+	struct copy_args_s args;
+
+	CHECK_HANDLE();
+	rmdbx_copy_args( db, &args, compact, dynamic );
+
+	path = rb_str_new_frozen( rb_get_path(path) );
+	args.path = StringValueCStr( path );
+
+	/* Converting the path may run Ruby, and let the handle be reopened. */
+	args.env = db->env;
+	rmdbx_db_without_gvl( db, rmdbx_copy_path_without_gvl, (void *)&args );
+
+	if ( args.rc != MDBX_SUCCESS )
+		rb_raise( rmdbx_eDatabaseError, "Unable to copy database to %"PRIsVALUE": (%d) %s",
+			path, args.rc, mdbx_strerror(args.rc) );
+	RB_GC_GUARD( path );
+
+	return Qtrue;
+}
+
+
+/*
+ * call-seq:
+ *    db.copy_to_fd( fd, compact, force_dynamic_size ) => true
+ *
+ * Write a copy of the database to the open file descriptor +fd+,
+ * which may be a pipe or socket.
+ *
+ */
+VALUE
+rmdbx_copy_to_fd( VALUE self, VALUE fd, VALUE compact, VALUE dynamic )
+{
+	UNWRAP_DB( self, db );
+	struct copy_args_s args;
+
+	CHECK_HANDLE();
+	rmdbx_copy_args( db, &args, compact, dynamic );
+	args.fd = (mdbx_filehandle_t)NUM2INT( fd );
+
+	args.env = db->env;
+	rmdbx_db_without_gvl( db, rmdbx_copy_fd_without_gvl, (void *)&args );
+
+	if ( args.rc != MDBX_SUCCESS )
+		rb_raise( rmdbx_eDatabaseError, "Unable to copy database: (%d) %s", args.rc, mdbx_strerror(args.rc) );
+
+	return Qtrue;
+}
+
+
+void
+rmdbx_init_backup( void )
+{
+	rb_define_protected_method( rmdbx_cDatabase, "copy_to_path", rmdbx_copy_to_path, 3 );
+	rb_define_protected_method( rmdbx_cDatabase, "copy_to_fd", rmdbx_copy_to_fd, 3 );
+}
+
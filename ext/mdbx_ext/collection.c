@@ -0,0 +1,353 @@
+/* vim: set noet sta sw=4 ts=4 fdm=marker: */
+/*
+ * Collection handles.
+ *
+ * An MDBX::Collection reads and writes a single named collection
+ * through its database handle, using the calling thread's
+ * transaction like the database itself does -- but with its own
+ * dbi, leaving the database's current collection alone.  Several of
+ * them can be written within one transaction, and committed at once.
+ *
+ */
+
+#include "mdbx_ext.h"
+
+VALUE rmdbx_cCollection;
+
+
+/*
+ * A collection name, and the database handle it belongs to.
+ */
+struct rmdbx_collection {
+	VALUE db;
+	VALUE name;
+};
+typedef struct rmdbx_collection rmdbx_collection_t;
+
+
+void rmdbx_collection_mark( void * );
+
+/*
+ * Ruby data allocation wrapper.
+ */
+static const rb_data_type_t rmdbx_collection_data = {
+	.wrap_struct_name = "MDBX::Collection::Data",
+	.function = { .dmark = rmdbx_collection_mark, .dfree = RUBY_TYPED_DEFAULT_FREE },
+	.flags = RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+/* Shortcut for fetching the wrapped collection. */
+#define UNWRAP_COLLECTION( self, coll ) \
+	rmdbx_collection_t *coll; \
+	TypedData_Get_Struct( self, rmdbx_collection_t, &rmdbx_collection_data, coll )
+
+
+/*
+ * Allocate a collection handle.
+ */
+VALUE
+rmdbx_collection_alloc( VALUE klass )
+{
+	rmdbx_collection_t *new;
+	VALUE obj = TypedData_Make_Struct( klass, rmdbx_collection_t, &rmdbx_collection_data, new );
+
+	new->db   = Qnil;
+	new->name = Qnil;
+
+	return obj;
+}
+
+
+/*
+ * Mark the database handle and name.
+ */
+void
+rmdbx_collection_mark( void *ptr )
+{
+	rmdbx_collection_t *coll = (rmdbx_collection_t *)ptr;
+
+	rb_gc_mark( coll->db );
+	rb_gc_mark( coll->name );
+}
+
+
+/*
+ * Return the handle for the collection within +txn+, opening it if
+ * this is the first use.  Returns 0 if a read-only +txn+ finds that
+ * the collection doesn't exist yet.
+ */
+MDBX_dbi
+rmdbx_collection_dbi( rmdbx_collection_t *coll, rmdbx_db_t *db, MDBX_txn *txn )
+{
+	const char *name = RSTRING_PTR( coll->name );
+	MDBX_dbi dbi     = rmdbx_cached_dbi( db, name );
+	if ( dbi ) return dbi;
+
+	unsigned int flags = db->settings.db_flags;
+	int readonly = mdbx_txn_flags( txn ) & MDBX_TXN_RDONLY;
+	if ( readonly ) flags &= ~MDBX_CREATE;
+
+	int rc = mdbx_dbi_open( txn, name, flags, &dbi );
+	if ( rc == MDBX_NOTFOUND && readonly ) return 0;
+
+	if ( rc != MDBX_SUCCESS ) {
+		rmdbx_close_txn( db, RMDBX_TXN_ROLLBACK );
+		rb_raise( rmdbx_eDatabaseError, "Unable to open collection %s: (%d) %s", name, rc, mdbx_strerror(rc) );
+	}
+	rmdbx_store_dbi( db, name, dbi );
+
+	return dbi;
+}
+
+
+/*
+ * call-seq:
+ *    MDBX::Collection.new( db, name ) => collection
+ *
+ * Create a handle for the collection +name+ within +db+.  The
+ * collection is created by the first write to it.
+ */
+VALUE
+rmdbx_collection_initialize( VALUE self, VALUE dbobj, VALUE name )
+{
+	UNWRAP_COLLECTION( self, coll );
+	UNWRAP_DB( dbobj, db );
+
+	CHECK_HANDLE();
+	if ( db->settings.max_collections == 0 )
+		rb_raise( rmdbx_eDatabaseError, "Unable to use collection: collections are not enabled." );
+
+	name = rb_funcall( name, rb_intern("to_s"), 0 );
+	StringValueCStr( name );
+
+	coll->db   = dbobj;
+	coll->name = rb_str_new_frozen( name );
+
+	return self;
+}
+
+
+/*
+ * Fetch +key+, running +func+ with the result while the transaction
+ * is still open.  Returns what +func+ does, or +missing+.
+ */
+static VALUE
+rmdbx_collection_fetch( VALUE self, VALUE key, VALUE (*func)( VALUE, rmdbx_db_t*, const MDBX_val* ), VALUE missing )
+{
+	UNWRAP_COLLECTION( self, coll );
+	UNWRAP_DB( coll->db, db );
+	struct op_args_s op;
+	VALUE rv = missing;
+
+	CHECK_HANDLE();
+	VALUE key_str = rmdbx_key_for( db, key, &op.key );
+
+	op.txn = rmdbx_open_txn( db, MDBX_TXN_RDONLY );
+	op.dbi = rmdbx_collection_dbi( coll, db, op.txn );
+	op.rc  = MDBX_NOTFOUND;
+	if ( op.dbi ) rmdbx_timed_without_gvl( db, RMDBX_OP_GET, rmdbx_get_without_gvl, (void *)&op );
+
+	if ( op.rc == MDBX_SUCCESS ) {
+		rmdbx_metrics_bytes( db, op.data.iov_len, 0 );
+		rv = func( coll->db, db, &op.data );
+	}
+
+	rmdbx_close_txn( db, RMDBX_TXN_ROLLBACK );
+	RB_GC_GUARD( key_str );
+
+	if ( op.rc != MDBX_SUCCESS && op.rc != MDBX_NOTFOUND )
+		rb_raise( rmdbx_eDatabaseError, "Unable to fetch value: (%d) %s", op.rc, mdbx_strerror(op.rc) );
+
+	return rv;
+}
+
+
+/* Value loader for #include? */
+static VALUE
+rmdbx_collection_found( VALUE dbobj, rmdbx_db_t *db, const MDBX_val *data )
+{
+	return Qtrue;
+}
+
+
+/*
+ * call-seq:
+ *    collection[ 'key' ] => value
+ *
+ * Return a single value for +key+, or nil.
+ */
+VALUE
+rmdbx_collection_get_val( VALUE self, VALUE key )
+{
+	return rmdbx_collection_fetch( self, key, rmdbx_load_val, Qnil );
+}
+
+
+/*
+ * call-seq:
+ *    collection.include?( 'key' ) => bool
+ *
+ * Returns true if the collection contains +key+.
+ */
+VALUE
+rmdbx_collection_include( VALUE self, VALUE key )
+{
+	return rmdbx_collection_fetch( self, key, rmdbx_collection_found, Qfalse );
+}
+
+
+/*
+ * call-seq:
+ *    collection[ 'key' ] = value
+ *
+ * Set a single value for +key+.  If the value is +nil+, the
+ * key is removed.
+ */
+VALUE
+rmdbx_collection_put_val( VALUE self, VALUE key, VALUE val )
+{
+	UNWRAP_COLLECTION( self, coll );
+	UNWRAP_DB( coll->db, db );
+	struct op_args_s op;
+	VALUE val_str = Qnil;
+
+	CHECK_HANDLE();
+	VALUE key_str = rmdbx_key_for( db, key, &op.key );
+	if ( ! NIL_P(val) ) val_str = rmdbx_collection_val_for( coll->db, RSTRING_PTR(coll->name), val, &op.data );
+
+	op.dbi   = rmdbx_cached_dbi( db, RSTRING_PTR(coll->name) );
+	op.flags = 0;
+
+	/* The first write to a collection opens it, within its own transaction. */
+	if ( op.dbi && rmdbx_group_writes(db) ) {
+		uint64_t start = rmdbx_metrics_start( db );
+		rmdbx_group_write( db, &op, NIL_P(val) );
+		rmdbx_metrics_finish( db, NIL_P(val) ? RMDBX_OP_DEL : RMDBX_OP_PUT, start, 1 );
+	}
+	else {
+		op.txn = rmdbx_open_txn( db, MDBX_TXN_READWRITE );
+		op.dbi = rmdbx_collection_dbi( coll, db, op.txn );
+
+		if ( NIL_P(val) ) {
+			rmdbx_timed_without_gvl( db, RMDBX_OP_DEL, rmdbx_del_without_gvl, (void *)&op );
+		}
+		else {
+			rmdbx_timed_without_gvl( db, RMDBX_OP_PUT, rmdbx_put_without_gvl, (void *)&op );
+		}
+		rmdbx_close_txn( db, RMDBX_TXN_COMMIT );
+	}
+
+	if ( op.rc == MDBX_SUCCESS && ! NIL_P(val) ) rmdbx_metrics_bytes( db, 0, op.key.iov_len + op.data.iov_len );
+
+	RB_GC_GUARD( key_str );
+	RB_GC_GUARD( val_str );
+
+	switch ( op.rc ) {
+		case MDBX_SUCCESS:
+		case MDBX_NOTFOUND:
+			return val;
+		default:
+			rb_raise( rmdbx_eDatabaseError, "Unable to update value: (%d) %s", op.rc, mdbx_strerror(op.rc) );
+	}
+}
+
+
+/*
+ * call-seq:
+ *    collection.delete( 'key' ) => value
+ *
+ * Remove +key+, returning its value (or nil if it wasn't set).
+ */
+VALUE
+rmdbx_collection_delete( VALUE self, VALUE key )
+{
+	VALUE val = rmdbx_collection_get_val( self, key );
+	if ( ! NIL_P(val) ) rmdbx_collection_put_val( self, key, Qnil );
+
+	return val;
+}
+
+
+/*
+ * call-seq:
+ *    collection.length => Integer
+ *
+ * Returns the count of keys in the collection.
+ */
+VALUE
+rmdbx_collection_length( VALUE self )
+{
+	UNWRAP_COLLECTION( self, coll );
+	UNWRAP_DB( coll->db, db );
+	MDBX_stat mstat;
+	int rc = MDBX_SUCCESS;
+
+	CHECK_HANDLE();
+	MDBX_txn *txn = rmdbx_open_txn( db, MDBX_TXN_RDONLY );
+	MDBX_dbi dbi  = rmdbx_collection_dbi( coll, db, txn );
+
+	mstat.ms_entries = 0;
+	if ( dbi ) rc = mdbx_dbi_stat( txn, dbi, &mstat, sizeof(mstat) );
+	rmdbx_close_txn( db, RMDBX_TXN_ROLLBACK );
+
+	if ( rc != MDBX_SUCCESS )
+		rb_raise( rmdbx_eDatabaseError, "mdbx_dbi_stat: (%d) %s", rc, mdbx_strerror(rc) );
+
+	return ULL2NUM( mstat.ms_entries );
+}
+
+
+/*
+ * call-seq:
+ *    collection.name => String
+ *
+ * The collection's name.
+ */
+VALUE
+rmdbx_collection_name( VALUE self )
+{
+	UNWRAP_COLLECTION( self, coll );
+	return coll->name;
+}
+
+
+/*
+ * call-seq:
+ *    collection.database => db
+ *
+ * The database handle the collection belongs to.
+ */
+VALUE
+rmdbx_collection_database( VALUE self )
+{
+	UNWRAP_COLLECTION( self, coll );
+	return coll->db;
+}
+
+
+void
+rmdbx_init_collection( void )
+{
+#ifdef FOR_RDOC
+	rmdbx_mMDBX = rb_define_module( "MDBX" );
+#endif
+
+	rmdbx_cCollection = rb_define_class_under( rmdbx_mMDBX, "Collection", rb_cObject );
+
+	rb_define_alloc_func( rmdbx_cCollection, rmdbx_collection_alloc );
+
+	rb_define_protected_method( rmdbx_cCollection, "initialize", rmdbx_collection_initialize, 2 );
+
+	rb_define_method( rmdbx_cCollection, "[]", rmdbx_collection_get_val, 1 );
+	rb_define_method( rmdbx_cCollection, "[]=", rmdbx_collection_put_val, 2 );
+	rb_define_method( rmdbx_cCollection, "include?", rmdbx_collection_include, 1 );
+	rb_define_method( rmdbx_cCollection, "delete", rmdbx_collection_delete, 1 );
+	rb_define_method( rmdbx_cCollection, "length", rmdbx_collection_length, 0 );
+	rb_define_method( rmdbx_cCollection, "name", rmdbx_collection_name, 0 );
+	rb_define_method( rmdbx_cCollection, "database", rmdbx_collection_database, 0 );
+
+	rb_define_alias( rmdbx_cCollection, "has_key?", "include?" );
+	rb_define_alias( rmdbx_cCollection, "key?", "include?" );
+	rb_define_alias( rmdbx_cCollection, "size", "length" );
+}
+
@@ -0,0 +1,627 @@
+/* vim: set noet sta sw=4 ts=4 fdm=marker: */
+/*
+ * Transparent value compression.
+ *
+ * With compression enabled, every stored value starts with a tag
+ * byte.  Values smaller than the threshold, or that don't shrink,
+ * are stored as-is after a RMDBX_TAG_PLAIN tag; compressed values
+ * carry their uncompressed length (a little endian uint32) after
+ * the tag, followed by the compressed payload.
+ *
+ * zstd can use a dictionary trained from a collection's values, so
+ * that small similar records compress well.  Dictionaries live in
+ * a reserved collection: each under its zstd dictionary id, with the
+ * id to compress new values with stored per collection.  Old
+ * dictionaries are kept, as values compressed with them remain.
+ *
+ */
+
+#include "mdbx_ext.h"
+#include <ruby/util.h>
+
+#ifdef HAVE_LZ4_H
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD_H
+#include <zstd.h>
+#include <zdict.h>
+#endif
+
+/* Stored value tags. */
+#define RMDBX_TAG_PLAIN     0
+#define RMDBX_TAG_LZ4       1
+#define RMDBX_TAG_ZSTD      2
+#define RMDBX_TAG_ZSTD_DICT 3
+
+/* Length of the header before compressed data. */
+#define RMDBX_COMPRESS_HEADER 5
+
+/* The collection holding trained zstd dictionaries. */
+#define RMDBX_DICT_COLLECTION "__rmdbx_dictionaries"
+
+
+/*
+ * zstd dictionaries loaded by a database handle.
+ */
+struct rmdbx_dicts {
+#ifdef HAVE_ZSTD_H
+	/* The dictionary new values are compressed with, by collection
+	   name (NULL if there's none.)  Training one discards them all,
+	   and bumps the generation. */
+	st_table *cdicts;
+	uint64_t generation;
+	ZSTD_CCtx *cctx;
+
+	/* Every dictionary seen while decompressing, by id. */
+	ZSTD_DCtx *dctx;
+	ZSTD_DDict **ddicts;
+	uint32_t *ddict_ids;
+	long ddict_count;
+#else
+	int unused;
+#endif
+};
+
+
+#ifdef HAVE_ZSTD_H
+/* Free a single compression dictionary and its collection name. */
+static int
+rmdbx_free_cdict_i( st_data_t name, st_data_t cdict, st_data_t arg )
+{
+	xfree( (char *)name );
+	ZSTD_freeCDict( (ZSTD_CDict *)cdict );
+	return ST_DELETE;
+}
+#endif
+
+
+/*
+ * Free all dictionaries loaded by +db+.
+ */
+void
+rmdbx_free_dictionaries( rmdbx_db_t *db )
+{
+	struct rmdbx_dicts *dicts = db->dicts;
+	if ( ! dicts ) return;
+
+#ifdef HAVE_ZSTD_H
+	if ( dicts->cdicts ) {
+		st_foreach( dicts->cdicts, rmdbx_free_cdict_i, 0 );
+		st_free_table( dicts->cdicts );
+	}
+	ZSTD_freeCCtx( dicts->cctx );
+	ZSTD_freeDCtx( dicts->dctx );
+	for ( long i = 0; i < dicts->ddict_count; i++ ) ZSTD_freeDDict( dicts->ddicts[i] );
+	xfree( dicts->ddicts );
+	xfree( dicts->ddict_ids );
+#endif
+
+	xfree( dicts );
+	db->dicts = NULL;
+}
+
+
+/*
+ * Set the compression +codec+ for +db+ from a Symbol (or nil, for
+ * no compression), raising if it wasn't compiled in.
+ */
+void
+rmdbx_set_compression( rmdbx_db_t *db, VALUE codec )
+{
+	ID id;
+
+	if ( NIL_P(codec) || codec == Qfalse ) {
+		db->settings.compress = RMDBX_COMPRESS_NONE;
+		return;
+	}
+
+	id = rb_sym2id( codec );
+	if ( id == rb_intern("lz4") ) {
+#ifdef HAVE_LZ4_H
+		db->settings.compress = RMDBX_COMPRESS_LZ4;
+#else
+		rb_raise( rb_eArgError, "lz4 compression isn't supported by this build" );
+#endif
+	}
+	else if ( id == rb_intern("zstd") ) {
+#ifdef HAVE_ZSTD_H
+		db->settings.compress = RMDBX_COMPRESS_ZSTD;
+#else
+		rb_raise( rb_eArgError, "zstd compression isn't supported by this build" );
+#endif
+	}
+	else {
+		rb_raise( rb_eArgError, "Unknown compression: %"PRIsVALUE, codec );
+	}
+}
+
+
+/*
+ * Return the name of the compression codec for +db+, or nil.
+ */
+VALUE
+rmdbx_compression_name( rmdbx_db_t *db )
+{
+	switch ( db->settings.compress ) {
+		case RMDBX_COMPRESS_LZ4:
+			return ID2SYM( rb_intern("lz4") );
+		case RMDBX_COMPRESS_ZSTD:
+			return ID2SYM( rb_intern("zstd") );
+		default:
+			return Qnil;
+	}
+}
+
+
+/*
+ * Return a String holding +tag+, then +len+ bytes at +ptr+.
+ */
+static VALUE
+rmdbx_tagged( char tag, const char *ptr, long len )
+{
+	VALUE rv = rb_str_buf_new( len + 1 );
+
+	rb_str_cat( rv, &tag, 1 );
+	rb_str_cat( rv, ptr, len );
+
+	return rv;
+}
+
+
+#ifdef HAVE_ZSTD_H
+/*
+ * Return the dictionary state for +db+, allocating it on first use.
+ */
+static struct rmdbx_dicts *
+rmdbx_dicts( rmdbx_db_t *db )
+{
+	if ( ! db->dicts ) {
+		db->dicts = ZALLOC( struct rmdbx_dicts );
+		db->dicts->cdicts = st_init_strtable();
+	}
+	return db->dicts;
+}
+
+
+/*
+ * Return a transaction to read dictionaries within: the calling
+ * thread's own, or else a new snapshot, which the caller must close
+ * once done (+opened+ is set.)  Values are usually compressed before
+ * their write transaction opens.
+ */
+static MDBX_txn *
+rmdbx_dict_txn( rmdbx_db_t *db, int *opened )
+{
+	MDBX_txn *txn = rmdbx_current_txn( db );
+
+	*opened = ! txn;
+	return txn ? txn : rmdbx_open_txn( db, MDBX_TXN_RDONLY );
+}
+
+
+/*
+ * Fetch +key+ from the dictionary collection within +txn+.  Returns
+ * MDBX_NOTFOUND if there's no such key (or no dictionaries at all.)
+ */
+static int
+rmdbx_dict_get( rmdbx_db_t *db, MDBX_txn *txn, const char *key, MDBX_val *data )
+{
+	MDBX_val ckey;
+	MDBX_dbi dbi;
+
+	if ( db->settings.max_collections == 0 ) return MDBX_NOTFOUND;
+
+	int rc = mdbx_dbi_open( txn, RMDBX_DICT_COLLECTION, MDBX_DB_DEFAULTS, &dbi );
+	if ( rc != MDBX_SUCCESS ) return rc;
+
+	ckey.iov_base = (void *)key;
+	ckey.iov_len  = strlen( key );
+	return mdbx_get( txn, dbi, &ckey, data );
+}
+
+
+/* Write the dictionary collection key for dictionary +id+ into +buf+. */
+#define RMDBX_DICT_KEY( buf, id ) snprintf( buf, sizeof(buf), "id:%08x", (unsigned int)(id) )
+
+
+/*
+ * Return the dictionary to compress values in +collection+ (NULL
+ * for the top level) with, or NULL if none has been trained.  Each
+ * collection's lookup is cached until a new dictionary is trained.
+ *
+ * Loading may release the GVL, so the dictionary is built privately
+ * and only published (with the GVL held) if no other thread did so,
+ * nor trained a new one, in the meantime.
+ */
+static ZSTD_CDict *
+rmdbx_current_cdict( rmdbx_db_t *db, const char *collection )
+{
+	struct rmdbx_dicts *dicts = rmdbx_dicts( db );
+	const char *name = collection ? collection : "";
+	uint64_t generation = dicts->generation;
+	ZSTD_CDict *cdict = NULL;
+	st_data_t cached = 0;
+	MDBX_val data;
+	char key[32];
+	int opened;
+
+	if ( st_lookup( dicts->cdicts, (st_data_t)name, &cached ) ) return (ZSTD_CDict *)cached;
+
+	VALUE current = rb_sprintf( "current:%s", name );
+	MDBX_txn *txn = rmdbx_dict_txn( db, &opened );
+
+	int rc = rmdbx_dict_get( db, txn, RSTRING_PTR(current), &data );
+	if ( rc == MDBX_SUCCESS && data.iov_len == 4 ) {
+		const unsigned char *id = data.iov_base;
+		RMDBX_DICT_KEY( key, (uint32_t)id[0] | (uint32_t)id[1] << 8 | (uint32_t)id[2] << 16 | (uint32_t)id[3] << 24 );
+
+		rc = rmdbx_dict_get( db, txn, key, &data );
+		if ( rc == MDBX_SUCCESS ) cdict = ZSTD_createCDict( data.iov_base, data.iov_len, ZSTD_CLEVEL_DEFAULT );
+	}
+
+	if ( opened ) rmdbx_close_txn( db, RMDBX_TXN_ROLLBACK );
+	RB_GC_GUARD( current );
+
+	/* Someone else got there first, or the dictionary just changed. */
+	if ( st_lookup( dicts->cdicts, (st_data_t)name, &cached ) || dicts->generation != generation ) {
+		ZSTD_freeCDict( cdict );
+		return dicts->generation == generation ? (ZSTD_CDict *)cached : NULL;
+	}
+
+	/* Only remember a miss if there really is no dictionary. */
+	if ( cdict || rc == MDBX_SUCCESS || rc == MDBX_NOTFOUND ) {
+		st_insert( dicts->cdicts, (st_data_t)ruby_strdup(name), (st_data_t)cdict );
+	}
+	if ( cdict && ! dicts->cctx ) dicts->cctx = ZSTD_createCCtx();
+
+	return cdict;
+}
+
+
+/*
+ * Return the dictionary with +id+ for decompression, loading it
+ * from the database if it hasn't been seen yet.  Returns NULL if it
+ * doesn't exist.
+ */
+static ZSTD_DDict *
+rmdbx_find_ddict( rmdbx_db_t *db, uint32_t id )
+{
+	struct rmdbx_dicts *dicts = rmdbx_dicts( db );
+	ZSTD_DDict *ddict = NULL;
+	MDBX_val data;
+	char key[32];
+	int opened;
+
+	for ( long i = 0; i < dicts->ddict_count; i++ )
+		if ( dicts->ddict_ids[i] == id ) return dicts->ddicts[i];
+
+	RMDBX_DICT_KEY( key, id );
+	MDBX_txn *txn = rmdbx_dict_txn( db, &opened );
+	if ( rmdbx_dict_get( db, txn, key, &data ) == MDBX_SUCCESS )
+		ddict = ZSTD_createDDict( data.iov_base, data.iov_len );
+	if ( opened ) rmdbx_close_txn( db, RMDBX_TXN_ROLLBACK );
+
+	if ( ! ddict ) return NULL;
+
+	/* Another thread may have loaded it while the GVL was released. */
+	for ( long i = 0; i < dicts->ddict_count; i++ ) {
+		if ( dicts->ddict_ids[i] != id ) continue;
+		ZSTD_freeDDict( ddict );
+		return dicts->ddicts[i];
+	}
+
+	REALLOC_N( dicts->ddicts, ZSTD_DDict *, dicts->ddict_count + 1 );
+	REALLOC_N( dicts->ddict_ids, uint32_t, dicts->ddict_count + 1 );
+	dicts->ddicts[ dicts->ddict_count ]    = ddict;
+	dicts->ddict_ids[ dicts->ddict_count ] = id;
+	dicts->ddict_count++;
+	if ( ! dicts->dctx ) dicts->dctx = ZSTD_createDCtx();
+
+	return ddict;
+}
+#endif
+
+
+/*
+ * Compress a serialized +str+ for storage in +collection+ (NULL for
+ * the top level), according to the database's settings.  Returns
+ * +str+ untouched if compression is disabled.
+ */
+VALUE
+rmdbx_compress( rmdbx_db_t *db, const char *collection, VALUE str )
+{
+	if ( db->settings.compress == RMDBX_COMPRESS_NONE ) return str;
+
+	const char *src = RSTRING_PTR( str );
+	long len        = RSTRING_LEN( str );
+	VALUE rv        = Qnil;
+	char tag        = RMDBX_TAG_PLAIN;
+#ifdef HAVE_ZSTD_H
+	ZSTD_CDict *cdict = NULL;
+#endif
+
+	db->counters.compress_values++;
+	db->counters.compress_raw_bytes += len;
+
+	if ( len >= db->settings.compress_min && len <= INT32_MAX ) {
+		size_t bound = 0;
+
+		switch ( db->settings.compress ) {
+#ifdef HAVE_LZ4_H
+			case RMDBX_COMPRESS_LZ4:
+				bound = LZ4_compressBound( (int)len );
+				tag   = RMDBX_TAG_LZ4;
+				break;
+#endif
+#ifdef HAVE_ZSTD_H
+			case RMDBX_COMPRESS_ZSTD:
+				bound = ZSTD_compressBound( len );
+				cdict = rmdbx_current_cdict( db, collection );
+				tag   = cdict ? RMDBX_TAG_ZSTD_DICT : RMDBX_TAG_ZSTD;
+				break;
+#endif
+		}
+
+		rv = rb_str_buf_new( bound + RMDBX_COMPRESS_HEADER );
+		char *dst = RSTRING_PTR( rv );
+		size_t out = 0;
+
+		dst[0] = tag;
+		for ( int i = 0; i < 4; i++ ) dst[ i + 1 ] = (char)( (uint32_t)len >> (i * 8) );
+
+		switch ( tag ) {
+#ifdef HAVE_LZ4_H
+			case RMDBX_TAG_LZ4: {
+				int rc = LZ4_compress_default( src, dst + RMDBX_COMPRESS_HEADER, (int)len, (int)bound );
+				out = rc > 0 ? (size_t)rc : 0;
+				break;
+			}
+#endif
+#ifdef HAVE_ZSTD_H
+			case RMDBX_TAG_ZSTD: {
+				size_t rc = ZSTD_compress( dst + RMDBX_COMPRESS_HEADER, bound, src, len, ZSTD_CLEVEL_DEFAULT );
+				out = ZSTD_isError( rc ) ? 0 : rc;
+				break;
+			}
+			case RMDBX_TAG_ZSTD_DICT: {
+				size_t rc = ZSTD_compress_usingCDict( db->dicts->cctx,
+					dst + RMDBX_COMPRESS_HEADER, bound, src, len, cdict );
+				out = ZSTD_isError( rc ) ? 0 : rc;
+				break;
+			}
+#endif
+		}
+
+		/* Only keep it if it's smaller. */
+		if ( out > 0 && out + RMDBX_COMPRESS_HEADER < (size_t)len + 1 ) {
+			rb_str_set_len( rv, out + RMDBX_COMPRESS_HEADER );
+			db->counters.compress_compressed++;
+			if ( tag == RMDBX_TAG_ZSTD_DICT ) db->counters.compress_dictionary++;
+		}
+		else {
+			rv = Qnil;
+		}
+	}
+
+	if ( NIL_P(rv) ) rv = rmdbx_tagged( RMDBX_TAG_PLAIN, src, len );
+	db->counters.compress_stored_bytes += RSTRING_LEN( rv );
+	RB_GC_GUARD( str );
+
+	return rv;
+}
+
+
+/*
+ * Raise for a value that can't be decompressed, closing any open
+ * transaction first as a deserialization error would.
+ */
+static void
+rmdbx_decompress_failed( VALUE self, const char *why )
+{
+	rmdbx_rb_closetxn( self, Qfalse );
+	rb_raise( rmdbx_eDatabaseError, "Unable to decompress value: %s", why );
+}
+
+
+/*
+ * Return the serialized value stored at +data+ as a String,
+ * decompressing it if necessary.
+ */
+VALUE
+rmdbx_stored_str( VALUE self, rmdbx_db_t *db, const MDBX_val *data )
+{
+	const char *src = data->iov_base;
+	size_t len      = data->iov_len;
+
+	if ( db->settings.compress == RMDBX_COMPRESS_NONE ) return rb_str_new( src, len );
+
+	if ( len < 1 ) rmdbx_decompress_failed( self, "missing tag" );
+	if ( src[0] == RMDBX_TAG_PLAIN ) return rb_str_new( src + 1, len - 1 );
+	if ( len < RMDBX_COMPRESS_HEADER ) rmdbx_decompress_failed( self, "truncated" );
+
+	char tag = src[0];
+	uint32_t raw_len = 0;
+	for ( int i = 0; i < 4; i++ ) raw_len |= (uint32_t)(unsigned char)src[ i + 1 ] << (i * 8);
+
+	VALUE rv = rb_str_buf_new( raw_len );
+	src += RMDBX_COMPRESS_HEADER;
+	len -= RMDBX_COMPRESS_HEADER;
+
+	switch ( tag ) {
+#ifdef HAVE_LZ4_H
+		case RMDBX_TAG_LZ4: {
+			int rc = LZ4_decompress_safe( src, RSTRING_PTR(rv), (int)len, (int)raw_len );
+			if ( rc < 0 || (uint32_t)rc != raw_len ) rmdbx_decompress_failed( self, "corrupt lz4 data" );
+			break;
+		}
+#endif
+#ifdef HAVE_ZSTD_H
+		case RMDBX_TAG_ZSTD: {
+			size_t rc = ZSTD_decompress( RSTRING_PTR(rv), raw_len, src, len );
+			if ( ZSTD_isError(rc) || rc != raw_len ) rmdbx_decompress_failed( self, "corrupt zstd data" );
+			break;
+		}
+		case RMDBX_TAG_ZSTD_DICT: {
+			ZSTD_DDict *ddict = rmdbx_find_ddict( db, ZSTD_getDictID_fromFrame( src, len ) );
+			if ( ! ddict ) rmdbx_decompress_failed( self, "missing zstd dictionary" );
+
+			size_t rc = ZSTD_decompress_usingDDict( db->dicts->dctx, RSTRING_PTR(rv), raw_len, src, len, ddict );
+			if ( ZSTD_isError(rc) || rc != raw_len ) rmdbx_decompress_failed( self, "corrupt zstd data" );
+			break;
+		}
+#endif
+		default:
+			rmdbx_decompress_failed( self, "unknown or unsupported codec" );
+	}
+
+	rb_str_set_len( rv, raw_len );
+	return rv;
+}
+
+
+#ifdef HAVE_ZSTD_H
+/* Inline struct for dictionary training, passed as a void pointer. */
+struct train_args_s {
+	void *dict;
+	size_t capacity;
+	const void *samples;
+	const size_t *sizes;
+	unsigned int count;
+	size_t rc;
+};
+
+
+/*
+ * Train a zstd dictionary, without the GVL.
+ */
+void *
+rmdbx_train_without_gvl( void *ptr )
+{
+	struct train_args_s *args = (struct train_args_s *)ptr;
+	args->rc = ZDICT_trainFromBuffer( args->dict, args->capacity,
+		args->samples, args->sizes, args->count );
+	return NULL;
+}
+
+
+/*
+ * Put +len+ bytes at +ptr+ under +key+ in the dictionary collection.
+ */
+static int
+rmdbx_dict_put( MDBX_txn *txn, MDBX_dbi dbi, const char *key, void *ptr, size_t len )
+{
+	MDBX_val ckey, data;
+
+	ckey.iov_base = (void *)key;
+	ckey.iov_len  = strlen( key );
+	data.iov_base = ptr;
+	data.iov_len  = len;
+
+	return mdbx_put( txn, dbi, &ckey, &data, 0 );
+}
+#endif
+
+
+/*
+ * call-seq:
+ *    db.store_dictionary( samples, size ) => id
+ *
+ * Train a zstd dictionary of up to +size+ bytes from an Array of
+ * serialized +samples+, and use it to compress new values in the
+ * current collection.  Returns the dictionary id.
+ */
+VALUE
+rmdbx_store_dictionary( VALUE self, VALUE samples, VALUE size )
+{
+	UNWRAP_DB( self, db );
+
+	CHECK_HANDLE();
+	Check_Type( samples, T_ARRAY );
+
+	if ( db->settings.compress != RMDBX_COMPRESS_ZSTD )
+		rb_raise( rmdbx_eDatabaseError, "Unable to train dictionary: zstd compression isn't enabled." );
+	if ( db->settings.max_collections == 0 )
+		rb_raise( rmdbx_eDatabaseError, "Unable to train dictionary: collections are not enabled." );
+	if ( rmdbx_current_txn(db) )
+		rb_raise( rmdbx_eDatabaseError, "Unable to train dictionary: transaction open" );
+
+#ifdef HAVE_ZSTD_H
+	VALUE tmp_sizes, tmp_buf, tmp_dict;
+	struct train_args_s args;
+	long count = RARRAY_LEN( samples );
+	size_t total = 0;
+
+	for ( long i = 0; i < count; i++ ) {
+		Check_Type( RARRAY_AREF(samples, i), T_STRING );
+		total += RSTRING_LEN( RARRAY_AREF(samples, i) );
+	}
+
+	/* Copy the samples into one buffer, as ZDICT expects. */
+	size_t *sizes = ALLOCV_N( size_t, tmp_sizes, count ? count : 1 );
+	char *buf     = ALLOCV( tmp_buf, total ? total : 1 );
+	char *pos     = buf;
+	for ( long i = 0; i < count; i++ ) {
+		VALUE sample = RARRAY_AREF( samples, i );
+		sizes[i] = RSTRING_LEN( sample );
+		memcpy( pos, RSTRING_PTR(sample), sizes[i] );
+		pos += sizes[i];
+	}
+
+	args.capacity = NUM2SIZET( size );
+	args.dict     = ALLOCV( tmp_dict, args.capacity ? args.capacity : 1 );
+	args.samples  = buf;
+	args.sizes    = sizes;
+	args.count    = (unsigned int)count;
+
+	rmdbx_db_without_gvl( db, rmdbx_train_without_gvl, (void *)&args );
+	ALLOCV_END( tmp_buf );
+	ALLOCV_END( tmp_sizes );
+
+	if ( ZDICT_isError(args.rc) ) {
+		ALLOCV_END( tmp_dict );
+		rb_raise( rmdbx_eDatabaseError, "Unable to train dictionary: %s", ZDICT_getErrorName(args.rc) );
+	}
+
+	uint32_t id = ZDICT_getDictID( args.dict, args.rc );
+	unsigned char cid[4] = { id, id >> 8, id >> 16, id >> 24 };
+	char key[32];
+	MDBX_dbi dbi;
+
+	MDBX_txn *txn = rmdbx_open_txn( db, MDBX_TXN_READWRITE );
+	int rc = mdbx_dbi_open( txn, RMDBX_DICT_COLLECTION, MDBX_DB_DEFAULTS | MDBX_CREATE, &dbi );
+
+	if ( rc == MDBX_SUCCESS ) {
+		RMDBX_DICT_KEY( key, id );
+		rc = rmdbx_dict_put( txn, dbi, key, args.dict, args.rc );
+	}
+	if ( rc == MDBX_SUCCESS ) {
+		VALUE current = rb_sprintf( "current:%s", db->subdb ? db->subdb : "" );
+		rc = rmdbx_dict_put( txn, dbi, RSTRING_PTR(current), cid, sizeof(cid) );
+		RB_GC_GUARD( current );
+	}
+	ALLOCV_END( tmp_dict );
+
+	if ( rc != MDBX_SUCCESS ) {
+		rmdbx_close_txn( db, RMDBX_TXN_ROLLBACK );
+		rb_raise( rmdbx_eDatabaseError, "Unable to store dictionary: (%d) %s", rc, mdbx_strerror(rc) );
+	}
+	rmdbx_close_txn( db, RMDBX_TXN_COMMIT );
+
+	/* Pick up the new dictionary on the next write. */
+	struct rmdbx_dicts *dicts = rmdbx_dicts( db );
+	st_foreach( dicts->cdicts, rmdbx_free_cdict_i, 0 );
+	dicts->generation++;
+
+	return UINT2NUM( id );
+#else
+	return Qnil;
+#endif
+}
+
+
+void
+rmdbx_init_compress( void )
+{
+	rb_define_protected_method( rmdbx_cDatabase, "store_dictionary", rmdbx_store_dictionary, 2 );
+}
+
@@ -0,0 +1,465 @@
+/* vim: set noet sta sw=4 ts=4 fdm=marker: */
+/*
+ * External cursor functions.
+ *
+ */
+
+#include "mdbx_ext.h"
+
+VALUE rmdbx_cCursor;
+
+
+/*
+ * A cursor over a database collection, bound to the transaction
+ * that was open in the calling thread when it was created.
+ *
+ * The underlying MDBX_cursor is owned by that thread's transaction
+ * state, and is closed when the transaction ends.  +generation+ is
+ * compared against the state's to detect that.
+ */
+struct rmdbx_cursor {
+	VALUE db;
+	VALUE thread;
+	MDBX_cursor *cursor;
+	uint64_t generation;
+};
+typedef struct rmdbx_cursor rmdbx_cursor_t;
+
+
+void rmdbx_cursor_mark( void * );
+
+/*
+ * Ruby data allocation wrapper.
+ *
+ * Freeing the Ruby object never touches the MDBX_cursor, which
+ * may belong to a transaction still in use by another thread.
+ */
+static const rb_data_type_t rmdbx_cursor_data = {
+	.wrap_struct_name = "MDBX::Cursor::Data",
+	.function = { .dmark = rmdbx_cursor_mark, .dfree = RUBY_TYPED_DEFAULT_FREE },
+	.flags = RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+/* Shortcut for fetching the wrapped cursor. */
+#define UNWRAP_CURSOR( self, cur ) \
+	rmdbx_cursor_t *cur; \
+	TypedData_Get_Struct( self, rmdbx_cursor_t, &rmdbx_cursor_data, cur )
+
+
+/*
+ * Allocate a cursor.
+ */
+VALUE
+rmdbx_cursor_alloc( VALUE klass )
+{
+	rmdbx_cursor_t *new;
+	VALUE obj = TypedData_Make_Struct( klass, rmdbx_cursor_t, &rmdbx_cursor_data, new );
+
+	new->db     = Qnil;
+	new->thread = Qnil;
+
+	return obj;
+}
+
+
+/*
+ * Mark the database handle and owning thread.
+ */
+void
+rmdbx_cursor_mark( void *ptr )
+{
+	rmdbx_cursor_t *cur = (rmdbx_cursor_t *)ptr;
+
+	rb_gc_mark( cur->db );
+	rb_gc_mark( cur->thread );
+}
+
+
+/*
+ * Return the transaction state the cursor belongs to, or NULL
+ * (forgetting the MDBX_cursor) if it has closed.
+ */
+rmdbx_txn_state_t *
+rmdbx_cursor_state( rmdbx_cursor_t *cur )
+{
+	st_data_t ptr;
+
+	if ( ! cur->cursor ) return NULL;
+
+	UNWRAP_DB( cur->db, db );
+	if ( db->state.open &&
+		 db->txns &&
+		 st_lookup( db->txns, (st_data_t)cur->thread, &ptr ) ) {
+		rmdbx_txn_state_t *state = (rmdbx_txn_state_t *)ptr;
+		if ( state->txn && state->generation == cur->generation ) return state;
+	}
+
+	cur->cursor = NULL;
+	return NULL;
+}
+
+
+/*
+ * Return the cursor's transaction state, raising if the cursor
+ * can't be used from the calling thread.
+ */
+rmdbx_txn_state_t *
+rmdbx_cursor_check( rmdbx_cursor_t *cur )
+{
+	if ( cur->thread != Qnil && cur->thread != rb_thread_current() )
+		rb_raise( rmdbx_eDatabaseError, "Cursor used outside of the thread that opened it." );
+
+	rmdbx_txn_state_t *state = rmdbx_cursor_state( cur );
+	if ( ! state ) rb_raise( rmdbx_eDatabaseError, "Closed cursor." );
+
+	return state;
+}
+
+
+/*
+ * call-seq:
+ *    MDBX::Cursor.new( db ) => cursor
+ *
+ * Open a cursor over the current collection of +db+, within the
+ * calling thread's open snapshot or transaction.  The cursor is
+ * closed automatically when the transaction ends.
+ */
+VALUE
+rmdbx_cursor_initialize( VALUE self, VALUE dbobj )
+{
+	UNWRAP_CURSOR( self, cur );
+	UNWRAP_DB( dbobj, db );
+
+	CHECK_HANDLE();
+	CHECK_TXN();
+
+	rmdbx_txn_state_t *state = rmdbx_txn_state( db );
+	MDBX_cursor *cursor;
+	int rc = mdbx_cursor_open( state->txn, db->dbi, &cursor );
+	if ( rc != MDBX_SUCCESS )
+		rb_raise( rmdbx_eDatabaseError, "Unable to open cursor: (%d) %s", rc, mdbx_strerror(rc) );
+
+	rmdbx_register_cursor( state, cursor );
+
+	cur->db         = dbobj;
+	cur->thread     = rb_thread_current();
+	cur->cursor     = cursor;
+	cur->generation = state->generation;
+
+	return self;
+}
+
+
+/*
+ * Step the cursor with +scan+, appending the raw keys and values
+ * of up to scan->limit entries to +keys+ and +vals+.
+ *
+ * Within a snapshot the cursor steps without the GVL.
+ */
+void
+rmdbx_cursor_fetch( rmdbx_cursor_t *cur, struct scan_args_s *scan, VALUE keys, VALUE vals )
+{
+	UNWRAP_DB( cur->db, db );
+	rmdbx_txn_state_t *state = rmdbx_cursor_check( cur );
+
+	scan->cursor = cur->cursor;
+	scan->from.iov_base = scan->to.iov_base = scan->prefix.iov_base = NULL;
+
+	rmdbx_scan( db, scan, mdbx_txn_flags(state->txn) & MDBX_TXN_RDONLY );
+
+	if ( scan->rc != MDBX_SUCCESS && scan->rc != MDBX_NOTFOUND && scan->rc != MDBX_ENODATA )
+		rb_raise( rmdbx_eDatabaseError, "Unable to move cursor: (%d) %s", scan->rc, mdbx_strerror(scan->rc) );
+
+	for ( int i = 0; i < scan->count; i++ ) {
+		rb_ary_push( keys, rmdbx_key_str( db, &scan->keys[i] ) );
+		rb_ary_push( vals, rmdbx_stored_str( cur->db, db, &scan->vals[i] ) );
+	}
+}
+
+
+/*
+ * Move forward up to +count+ entries, appending their raw keys
+ * and values to +keys+ and +vals+.
+ */
+void
+rmdbx_cursor_read( rmdbx_cursor_t *cur, VALUE count, VALUE keys, VALUE vals )
+{
+	struct scan_args_s scan;
+	long remaining = NUM2LONG( count );
+
+	if ( remaining < 0 ) rb_raise( rb_eArgError, "count must not be negative" );
+
+	scan.op      = MDBX_NEXT;
+	scan.reverse = 0;
+
+	while ( remaining > 0 ) {
+		scan.limit = remaining < RMDBX_SCAN_BATCH ? (int)remaining : RMDBX_SCAN_BATCH;
+		rmdbx_cursor_fetch( cur, &scan, keys, vals );
+
+		remaining -= scan.count;
+		if ( scan.rc != MDBX_SUCCESS ) break;
+	}
+}
+
+
+/*
+ * Pair up fetched +keys+ and +vals+, deserializing the values.
+ * Everything is copied out before anything is deserialized, as
+ * deserializing may close the transaction.
+ */
+VALUE
+rmdbx_cursor_pairs( rmdbx_cursor_t *cur, VALUE keys, VALUE vals )
+{
+	UNWRAP_DB( cur->db, db );
+	long len = RARRAY_LEN( keys );
+	VALUE rv = rb_ary_new_capa( len );
+
+	for ( long i = 0; i < len; i++ ) {
+		VALUE val = rmdbx_deserialize( cur->db, db, RARRAY_AREF(vals, i) );
+		rb_ary_push( rv, rb_assoc_new( RARRAY_AREF(keys, i), val ) );
+	}
+
+	return rv;
+}
+
+
+/*
+ * Move the cursor with +op+, returning the [ key, value ] pair it
+ * lands on, or nil.
+ */
+VALUE
+rmdbx_cursor_move( VALUE self, MDBX_cursor_op op, int reverse )
+{
+	UNWRAP_CURSOR( self, cur );
+	struct scan_args_s scan;
+	VALUE keys = rb_ary_new(), vals = rb_ary_new();
+
+	scan.op      = op;
+	scan.reverse = reverse;
+	scan.limit   = 1;
+
+	rmdbx_cursor_fetch( cur, &scan, keys, vals );
+	if ( scan.count == 0 ) return Qnil;
+
+	return RARRAY_AREF( rmdbx_cursor_pairs( cur, keys, vals ), 0 );
+}
+
+
+/*
+ * call-seq:
+ *    cursor.first => [ key, value ] or nil
+ *
+ * Move to the first entry in the collection.
+ */
+VALUE
+rmdbx_cursor_first( VALUE self )
+{
+	return rmdbx_cursor_move( self, MDBX_FIRST, 0 );
+}
+
+
+/*
+ * call-seq:
+ *    cursor.last => [ key, value ] or nil
+ *
+ * Move to the last entry in the collection.
+ */
+VALUE
+rmdbx_cursor_last( VALUE self )
+{
+	return rmdbx_cursor_move( self, MDBX_LAST, 1 );
+}
+
+
+/*
+ * call-seq:
+ *    cursor.next => [ key, value ] or nil
+ *
+ * Move to the next entry, returning nil at the end of the
+ * collection.  A new cursor starts at the first entry.
+ */
+VALUE
+rmdbx_cursor_next( VALUE self )
+{
+	return rmdbx_cursor_move( self, MDBX_NEXT, 0 );
+}
+
+
+/*
+ * call-seq:
+ *    cursor.prev => [ key, value ] or nil
+ *
+ * Move to the previous entry, returning nil at the start of the
+ * collection.  A new cursor starts at the last entry.
+ */
+VALUE
+rmdbx_cursor_prev( VALUE self )
+{
+	return rmdbx_cursor_move( self, MDBX_PREV, 1 );
+}
+
+
+/*
+ * call-seq:
+ *    cursor.current => [ key, value ] or nil
+ *
+ * Return the entry at the cursor's position without moving it.
+ */
+VALUE
+rmdbx_cursor_current( VALUE self )
+{
+	return rmdbx_cursor_move( self, MDBX_GET_CURRENT, 0 );
+}
+
+
+/*
+ * call-seq:
+ *    cursor.seek( key ) => [ key, value ] or nil
+ *
+ * Move to the first entry with a key greater than or equal to
+ * +key+, returning nil if there is none.
+ */
+VALUE
+rmdbx_cursor_seek( VALUE self, VALUE key )
+{
+	UNWRAP_CURSOR( self, cur );
+	UNWRAP_DB( cur->db, db );
+	struct scan_args_s scan;
+	VALUE keys = rb_ary_new(), vals = rb_ary_new();
+
+	VALUE key_str = rmdbx_key_for( db, key, &scan.seek );
+	scan.op      = MDBX_SET_RANGE;
+	scan.reverse = 0;
+	scan.limit   = 1;
+
+	rmdbx_cursor_fetch( cur, &scan, keys, vals );
+	RB_GC_GUARD( key_str );
+	if ( scan.count == 0 ) return Qnil;
+
+	return RARRAY_AREF( rmdbx_cursor_pairs( cur, keys, vals ), 0 );
+}
+
+
+/*
+ * call-seq:
+ *    cursor.batch( count ) => [ [ key, value ], ... ]
+ *
+ * Move forward up to +count+ entries, returning them.  An empty
+ * Array means the end of the collection was reached.  Paired with
+ * #seek, this allows keyset pagination:
+ *
+ *    cursor.seek( last_key_seen )
+ *    page = cursor.batch( 100 )
+ */
+VALUE
+rmdbx_cursor_batch( VALUE self, VALUE count )
+{
+	UNWRAP_CURSOR( self, cur );
+	VALUE keys = rb_ary_new(), vals = rb_ary_new();
+
+	rmdbx_cursor_read( cur, count, keys, vals );
+
+	return rmdbx_cursor_pairs( cur, keys, vals );
+}
+
+
+/*
+ * call-seq:
+ *    cursor.read_batch( count ) => [ [ key, ... ], [ raw_value, ... ] ]
+ *
+ * Move forward up to +count+ entries, returning their keys and
+ * their serialized values, without deserializing them.  Suited to
+ * exports that handle values in bulk, or not at all.
+ */
+VALUE
+rmdbx_cursor_read_batch( VALUE self, VALUE count )
+{
+	UNWRAP_CURSOR( self, cur );
+	VALUE keys = rb_ary_new(), vals = rb_ary_new();
+
+	rmdbx_cursor_read( cur, count, keys, vals );
+
+	return rb_assoc_new( keys, vals );
+}
+
+
+/*
+ * call-seq:
+ *    cursor.close => nil
+ *
+ * Close the cursor.  Cursors are closed automatically when their
+ * transaction ends.
+ */
+VALUE
+rmdbx_cursor_close( VALUE self )
+{
+	UNWRAP_CURSOR( self, cur );
+
+	if ( cur->thread != Qnil && cur->thread != rb_thread_current() )
+		rb_raise( rmdbx_eDatabaseError, "Cursor used outside of the thread that opened it." );
+
+	rmdbx_txn_state_t *state = rmdbx_cursor_state( cur );
+	if ( state ) rmdbx_unregister_cursor( state, cur->cursor );
+	cur->cursor = NULL;
+
+	return Qnil;
+}
+
+
+/*
+ * call-seq:
+ *    cursor.closed? => bool
+ *
+ * Returns true if the cursor was closed, or its transaction ended.
+ */
+VALUE
+rmdbx_cursor_closed_p( VALUE self )
+{
+	UNWRAP_CURSOR( self, cur );
+	return rmdbx_cursor_state( cur ) ? Qfalse : Qtrue;
+}
+
+
+/*
+ * call-seq:
+ *    cursor.database => db
+ *
+ * Return the database handle the cursor was opened from.
+ */
+VALUE
+rmdbx_cursor_database( VALUE self )
+{
+	UNWRAP_CURSOR( self, cur );
+	return cur->db;
+}
+
+
+/*
+ * MDBX::Cursor initialization
+ */
+void
+rmdbx_init_cursor( void )
+{
+#ifdef FOR_RDOC
+	rmdbx_mMDBX = rb_define_module( "MDBX" );
+#endif
+
+	rmdbx_cCursor = rb_define_class_under( rmdbx_mMDBX, "Cursor", rb_cObject );
+
+	rb_define_alloc_func( rmdbx_cCursor, rmdbx_cursor_alloc );
+
+	rb_define_protected_method( rmdbx_cCursor, "initialize", rmdbx_cursor_initialize, 1 );
+
+	rb_define_method( rmdbx_cCursor, "first", rmdbx_cursor_first, 0 );
+	rb_define_method( rmdbx_cCursor, "last", rmdbx_cursor_last, 0 );
+	rb_define_method( rmdbx_cCursor, "next", rmdbx_cursor_next, 0 );
+	rb_define_method( rmdbx_cCursor, "prev", rmdbx_cursor_prev, 0 );
+	rb_define_method( rmdbx_cCursor, "current", rmdbx_cursor_current, 0 );
+	rb_define_method( rmdbx_cCursor, "seek", rmdbx_cursor_seek, 1 );
+	rb_define_method( rmdbx_cCursor, "batch", rmdbx_cursor_batch, 1 );
+	rb_define_method( rmdbx_cCursor, "read_batch", rmdbx_cursor_read_batch, 1 );
+	rb_define_method( rmdbx_cCursor, "close", rmdbx_cursor_close, 0 );
+	rb_define_method( rmdbx_cCursor, "closed?", rmdbx_cursor_closed_p, 0 );
+	rb_define_method( rmdbx_cCursor, "database", rmdbx_cursor_database, 0 );
+}
+
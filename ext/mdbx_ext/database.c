@@ -5,16 +5,24 @@
  */
 
 #include "mdbx_ext.h"
+#include <ruby/util.h>
+
+#ifdef HAVE_PTHREAD_H
+#include <signal.h>
+#endif
 
 VALUE rmdbx_cDatabase;
 
+static ID id_serialize;
+static ID id_deserialize;
+
 
 /*
  * Ruby data allocation wrapper.
  */
-static const rb_data_type_t rmdbx_db_data = {
+const rb_data_type_t rmdbx_db_data = {
 	.wrap_struct_name = "MDBX::Database::Data",
-	.function = { .dfree = rmdbx_free },
+	.function = { .dmark = rmdbx_mark, .dfree = rmdbx_free },
 	.flags = RUBY_TYPED_FREE_IMMEDIATELY
 };
 
@@ -30,731 +38,2485 @@ rmdbx_alloc( VALUE klass )
 }
 
 
+/* Mark a thread that owns transaction state. */
+int
+rmdbx_mark_txn_state_i( st_data_t thread, st_data_t state, st_data_t arg )
+{
+	rb_gc_mark( (VALUE)thread );
+	return ST_CONTINUE;
+}
+
+
+/*
+ * Keep threads with transaction state alive, so their
+ * object ids can't be reused while their state exists.
+ */
+void
+rmdbx_mark( void *ptr )
+{
+	rmdbx_db_t *db = (rmdbx_db_t *)ptr;
+	if ( db->txns ) st_foreach( db->txns, rmdbx_mark_txn_state_i, 0 );
+}
+
+
 /*
  * Cleanup a previously allocated DB environment.
  */
 void
-rmdbx_free( void *db )
+rmdbx_free( void *ptr )
 {
+	rmdbx_db_t *db = (rmdbx_db_t *)ptr;
+
 	if ( db ) {
+		/* Stopped first, as closing would wait for them without the GVL. */
+		rmdbx_free_group( db );
+		rmdbx_free_syncer( db );
 		rmdbx_close_all( db );
+		rmdbx_free_dictionaries( db );
+		rmdbx_free_metrics( db );
+		if ( db->txns ) st_free_table( db->txns );
+		if ( db->dbis ) st_free_table( db->dbis );
+		xfree( db->subdb );
 		xfree( db );
 	}
 }
 
 
 /*
- * Ensure all database file descriptors are collected and
- * removed.
+ * Track a cursor opened by an MDBX::Cursor within the state's
+ * transaction.  Registered cursors are owned by the transaction
+ * state rather than the Ruby object, so they're always closed on
+ * the thread that opened them, when the transaction ends.
  */
 void
-rmdbx_close_all( rmdbx_db_t *db )
+rmdbx_register_cursor( rmdbx_txn_state_t *state, MDBX_cursor *cursor )
 {
-	if ( db->cursor ) mdbx_cursor_close( db->cursor );
-	if ( db->txn )    mdbx_txn_abort( db->txn );
-	if ( db->dbi )    mdbx_dbi_close( db->env, db->dbi );
-	if ( db->env )    mdbx_env_close( db->env );
-	db->state.open = 0;
+	if ( state->cursor_count == state->cursor_capa ) {
+		state->cursor_capa = state->cursor_capa ? state->cursor_capa * 2 : 4;
+		REALLOC_N( state->cursors, MDBX_cursor *, state->cursor_capa );
+	}
+	state->cursors[ state->cursor_count++ ] = cursor;
 }
 
 
 /*
- * Close any open database handle.  Will be automatically
- * re-opened on next transaction.  This is primarily useful for
- * switching between subdatabases.
+ * Close a registered +cursor+ before its transaction ends.
  */
 void
-rmdbx_close_dbi( rmdbx_db_t *db )
+rmdbx_unregister_cursor( rmdbx_txn_state_t *state, MDBX_cursor *cursor )
 {
-	if ( ! db->dbi ) return;
-	mdbx_dbi_close( db->env, db->dbi );
-	db->dbi = 0;
+	for ( long i = 0; i < state->cursor_count; i++ ) {
+		if ( state->cursors[i] != cursor ) continue;
+
+		mdbx_cursor_close( cursor );
+		state->cursors[i] = state->cursors[ --state->cursor_count ];
+		return;
+	}
 }
 
 
 /*
- * call-seq:
- *    db.close => true
- *
- * Cleanly close an opened database.
+ * Close every registered cursor, and invalidate any MDBX::Cursor
+ * objects still referring to them.  Called whenever the state's
+ * transaction ends.
  */
-VALUE
-rmdbx_close( VALUE self )
+void
+rmdbx_close_cursors( rmdbx_txn_state_t *state )
 {
-	UNWRAP_DB( self, db );
-	rmdbx_close_all( db );
-	return Qtrue;
+	for ( long i = 0; i < state->cursor_count; i++ ) mdbx_cursor_close( state->cursors[i] );
+	state->cursor_count = 0;
+	state->generation++;
 }
 
 
 /*
- * call-seq:
- *    db.closed? => false
- *
- * Predicate: return true if the database environment is closed.
+ * Close and free a single thread's transaction state.
  */
-VALUE
-rmdbx_closed_p( VALUE self )
+void
+rmdbx_free_txn_state( rmdbx_txn_state_t *state )
 {
-	UNWRAP_DB( self, db );
-	return db->state.open == 1 ? Qfalse : Qtrue;
+	rmdbx_close_cursors( state );
+	xfree( state->cursors );
+	if ( state->cursor ) mdbx_cursor_close( state->cursor );
+	if ( state->depth )  state->txn = state->parents[0];
+	if ( state->txn )    mdbx_txn_abort( state->txn );
+	xfree( state->parents );
+	if ( state->rtxn )   mdbx_txn_abort( state->rtxn );
+	xfree( state );
 }
 
 
 /*
- * Given a ruby string +key+ and a pointer to an MDBX_val, prepare the
- * key for usage within mdbx.  All keys are explicitly converted to
- * strings.
- *
+ * Free a single thread's transaction state without ending its
+ * transactions or closing its cursors: only the thread that began a
+ * transaction may end it, in a sticky-thread environment.  libmdbx
+ * releases an exited thread's reader slot itself.
  */
 void
-rmdbx_key_for( VALUE key, MDBX_val *ckey )
+rmdbx_forget_txn_state( rmdbx_txn_state_t *state )
 {
-	VALUE key_str  = rb_funcall( key, rb_intern("to_s"), 0 );
-	ckey->iov_len  = RSTRING_LEN( key_str );
-	ckey->iov_base = malloc( ckey->iov_len );
-	memcpy( ckey->iov_base, StringValuePtr(key_str), ckey->iov_len );
+	xfree( state->cursors );
+	xfree( state->parents );
+	xfree( state );
 }
 
 
 /*
- * Given a ruby +value+ and a pointer to an MDBX_val, prepare
- * the value for usage within mdbx.  Values are potentially serialized.
- *
+ * Returns true if transactions may be ended by a thread other than
+ * the one that began them (with +no_stickythreads+).
  */
-void
-rmdbx_val_for( VALUE self, VALUE val, MDBX_val *data )
+static int
+rmdbx_unbound_txns( rmdbx_db_t *db )
 {
-	val = rb_funcall( self, rb_intern("serialize"), 1, val );
-	Check_Type( val, T_STRING );
-
-	data->iov_len  = RSTRING_LEN( val );
-	data->iov_base = malloc( data->iov_len );
-	memcpy( data->iov_base, StringValuePtr(val), data->iov_len );
+#if defined(HAVE_CONST_MDBX_NOSTICKYTHREADS)
+	return ( db->settings.env_flags & MDBX_NOSTICKYTHREADS ) != 0;
+#else
+	return 0;
+#endif
 }
 
 
 /*
- * Open the DB environment handle.
- *
+ * Free every thread's transaction state.  Only the calling thread's
+ * transactions are ended, unless +unbound+; the rest are forgotten.
  */
-VALUE
-rmdbx_open_env( VALUE self )
+int
+rmdbx_free_txn_state_i( st_data_t thread, st_data_t state, st_data_t unbound )
 {
-	int rc;
-	UNWRAP_DB( self, db );
-	rmdbx_close_all( db );
+	if ( unbound || (VALUE)thread == rb_thread_current() ) {
+		rmdbx_free_txn_state( (rmdbx_txn_state_t *)state );
+	}
+	else {
+		rmdbx_forget_txn_state( (rmdbx_txn_state_t *)state );
+	}
+	return ST_DELETE;
+}
 
-	/* Allocate an mdbx environment.
-	 */
-	rc = mdbx_env_create( &db->env );
-	if ( rc != MDBX_SUCCESS )
-		rb_raise( rmdbx_eDatabaseError, "mdbx_env_create: (%d) %s", rc, mdbx_strerror(rc) );
 
-	/* Set the maximum number of named databases for the environment. */
-	mdbx_env_set_maxdbs( db->env, db->settings.max_collections );
+/*
+ * Ensure all database file descriptors are collected and
+ * removed.
+ */
+void
+rmdbx_close_all( rmdbx_db_t *db )
+{
+	/* Other threads may run while helper threads stop: refuse them the handle. */
+	db->state.open = 0;
+	rmdbx_group_stop( db );
+	rmdbx_stop_syncer( db );
+	if ( db->txns ) st_foreach( db->txns, rmdbx_free_txn_state_i, (st_data_t)rmdbx_unbound_txns(db) );
+	rmdbx_clear_dbis( db );
+	if ( db->env )    mdbx_env_close( db->env );
+	db->env = NULL;
+}
 
-	/* Customize the maximum number of simultaneous readers. */
-	if ( db->settings.max_readers )
-		mdbx_env_set_maxreaders( db->env, db->settings.max_readers );
 
-	/* Set an upper boundary (in bytes) for the database map size. */
-	if ( db->settings.max_size )
-		mdbx_env_set_geometry( db->env, -1, -1, db->settings.max_size, -1, -1, -1 );
+/*
+ * The collection cache key for the current collection: its name,
+ * or an empty string for the top level.
+ */
+static const char *
+rmdbx_dbi_name( rmdbx_db_t *db )
+{
+	return db->subdb ? db->subdb : "";
+}
 
-	rc = mdbx_env_open( db->env, db->path, db->settings.env_flags, db->settings.mode );
-	if ( rc != MDBX_SUCCESS ) {
-		rmdbx_close_all( db );
-		rb_raise( rmdbx_eDatabaseError, "mdbx_env_open: (%d) %s", rc, mdbx_strerror(rc) );
-	}
 
-	/* Force populate the db->dbi handle.  Under 0.12.x, getting a
-	 * 'permission denied' doing this for the first access with a RDONLY
-	 * for some reason. */
-	rmdbx_open_txn( db, MDBX_TXN_READWRITE );
-	rmdbx_close_txn( db, RMDBX_TXN_ROLLBACK );
+/*
+ * Return the cached handle for the collection +name+ ("" for the
+ * top level), or 0 if it hasn't been opened.
+ */
+MDBX_dbi
+rmdbx_cached_dbi( rmdbx_db_t *db, const char *name )
+{
+	st_data_t dbi = 0;
 
-	db->state.open = 1;
-	return Qtrue;
+	if ( db->dbis ) st_lookup( db->dbis, (st_data_t)name, &dbi );
+	return (MDBX_dbi)dbi;
 }
 
 
 /*
- * call-seq:
- *    db.clear
- *
- * Empty the current collection on disk.  If collections are not enabled
- * or the database handle is set to the top-level (main) db - this
- * deletes *all records* from the database.
+ * Remember +dbi+ as the handle for the collection +name+.
  */
-VALUE
-rmdbx_clear( VALUE self )
+void
+rmdbx_store_dbi( rmdbx_db_t *db, const char *name, MDBX_dbi dbi )
 {
-	UNWRAP_DB( self, db );
+	if ( ! db->dbis || st_lookup( db->dbis, (st_data_t)name, NULL ) ) return;
+	st_insert( db->dbis, (st_data_t)ruby_strdup( name ), (st_data_t)dbi );
+}
 
-	rmdbx_open_txn( db, MDBX_TXN_READWRITE );
-	int rc = mdbx_drop( db->txn, db->dbi, false );
 
-	if ( rc != MDBX_SUCCESS ) {
-		rmdbx_close_txn( db, RMDBX_TXN_ROLLBACK );
-		rb_raise( rmdbx_eDatabaseError, "mdbx_drop: (%d) %s", rc, mdbx_strerror(rc) );
-	}
+/*
+ * Point db->dbi at the cached handle for the current collection,
+ * returning false (and zeroing db->dbi) if it hasn't been opened.
+ */
+int
+rmdbx_use_cached_dbi( rmdbx_db_t *db )
+{
+	db->dbi = rmdbx_cached_dbi( db, rmdbx_dbi_name(db) );
+	return db->dbi != 0;
+}
 
-	rmdbx_close_txn( db, RMDBX_TXN_COMMIT );
 
-	return Qnil;
+/*
+ * Remember db->dbi as the handle for the current collection.
+ */
+void
+rmdbx_cache_dbi( rmdbx_db_t *db )
+{
+	rmdbx_store_dbi( db, rmdbx_dbi_name(db), db->dbi );
 }
 
 
 /*
- * call-seq:
- *    db.drop( collection ) -> db
- *
- * Destroy a collection.  You must be in the top level database to call
- * this method.
+ * Forget the cached handle for the current collection, after it's
+ * been dropped.
  */
-VALUE
-rmdbx_drop( VALUE self, VALUE name )
+void
+rmdbx_uncache_dbi( rmdbx_db_t *db )
 {
-	UNWRAP_DB( self, db );
+	st_data_t key = (st_data_t)rmdbx_dbi_name( db );
 
-	/* Provide a friendlier error message if max_collections is 0. */
-	if ( db->settings.max_collections == 0 )
-		rb_raise( rmdbx_eDatabaseError, "Unable to drop collection: collections are not enabled." );
+	if ( db->dbis && st_delete( db->dbis, &key, NULL ) ) xfree( (void *)key );
+	db->dbi = 0;
+}
 
-	/* All transactions must be closed when dropping a database. */
-	if ( db->txn )
-		rb_raise( rmdbx_eDatabaseError, "Unable to drop collection: transaction open" );
 
-	/* A drop can only be performed from the top-level database. */
-	if ( db->subdb != NULL )
-		rb_raise( rmdbx_eDatabaseError, "Unable to drop collection: switch to top-level db first" );
+/* Free a single collection cache key. */
+static int
+rmdbx_free_dbi_i( st_data_t name, st_data_t dbi, st_data_t arg )
+{
+	xfree( (void *)name );
+	return ST_DELETE;
+}
 
-	name = rb_funcall( name, rb_intern("to_s"), 0 );
-	db->subdb = StringValueCStr( name );
 
-	rmdbx_close_dbi( db ); /* ensure we're reopening within the new subdb */
-	rmdbx_open_txn( db, MDBX_TXN_READWRITE );
-	int rc = mdbx_drop( db->txn, db->dbi, true );
+/*
+ * Forget every cached collection handle.  mdbx closes the handles
+ * themselves along with the environment.
+ */
+void
+rmdbx_clear_dbis( rmdbx_db_t *db )
+{
+	if ( db->dbis ) st_foreach( db->dbis, rmdbx_free_dbi_i, 0 );
+	db->dbi = 0;
+}
 
-	if ( rc != MDBX_SUCCESS ) {
-		rmdbx_close_txn( db, RMDBX_TXN_ROLLBACK );
-		rb_raise( rmdbx_eDatabaseError, "mdbx_drop: (%d) %s", rc, mdbx_strerror(rc) );
-	}
 
-	rmdbx_close_txn( db, RMDBX_TXN_COMMIT );
+/*
+ * Close the environment while other threads may be using the handle,
+ * on behalf of +action+.  Raises a DatabaseError if another thread
+ * has a transaction open, and otherwise waits for calls still
+ * running without the GVL to finish first.
+ */
+static void
+rmdbx_close_shared( rmdbx_db_t *db, const char *action )
+{
+	struct timeval delay = { 0, 1000 };
 
-	/* Reset the current collection to the top level. */
-	db->subdb = NULL;
-	rmdbx_close_dbi( db ); /* ensure next access is not in the defunct subdb */
+	if ( rmdbx_other_txn_open(db) )
+		rb_raise( rmdbx_eDatabaseError, "Unable to %s: transaction open in another thread", action );
 
-	/* Force populate the new db->dbi handle.  Under 0.12.x, getting a
-	 * 'permission denied' doing this for the first access with a RDONLY
-	 * for some reason. */
-	rmdbx_open_txn( db, MDBX_TXN_READWRITE );
-	rmdbx_close_txn( db, RMDBX_TXN_ROLLBACK );
+	/* Refuse the handle to new calls before waiting. */
+	db->state.open = 0;
+	while ( db->state.inflight ) rb_thread_wait_for( delay );
 
-	return self;
+	rmdbx_close_all( db );
 }
 
 
-/* call-seq:
- *    db.length -> Integer
+/*
+ * call-seq:
+ *    db.close => true
  *
- * Returns the count of keys in the currently selected collection.
+ * Cleanly close an opened database.  Raises a DatabaseError if
+ * another thread has a transaction open; any transaction open in
+ * the calling thread is rolled back.
  */
 VALUE
-rmdbx_length( VALUE self )
+rmdbx_close( VALUE self )
 {
 	UNWRAP_DB( self, db );
-	MDBX_stat mstat;
-
-	CHECK_HANDLE();
-	rmdbx_open_txn( db, MDBX_TXN_RDONLY );
-
-	int rc = mdbx_dbi_stat( db->txn, db->dbi, &mstat, sizeof(mstat) );
-	if ( rc != MDBX_SUCCESS )
-		rb_raise( rmdbx_eDatabaseError, "mdbx_dbi_stat: (%d) %s", rc, mdbx_strerror(rc) );
+	rmdbx_close_shared( db, "close" );
+	return Qtrue;
+}
 
-	VALUE rv = LONG2FIX( mstat.ms_entries );
-	rmdbx_close_txn( db, RMDBX_TXN_ROLLBACK );
 
-	return rv;
+/*
+ * call-seq:
+ *    db.closed? => false
+ *
+ * Predicate: return true if the database environment is closed.
+ */
+VALUE
+rmdbx_closed_p( VALUE self )
+{
+	UNWRAP_DB( self, db );
+	return db->state.open == 1 ? Qfalse : Qtrue;
 }
 
 
-/* call-seq:
- *    db.include?( 'key' ) => bool
+/*
+ * Given a ruby +key+ and a pointer to an MDBX_val, prepare the
+ * key for usage within mdbx.  Keys are explicitly converted to
+ * strings, or packed as native unsigned 64 bit integers for a
+ * database with integer keys.
  *
- * Returns true if the current collection contains +key+.
+ * No copy is made: +ckey+ points directly at the returned frozen
+ * String's buffer, so the caller must keep that String alive
+ * (RB_GC_GUARD) for as long as +ckey+ is in use.  Freezing means
+ * no other thread can modify the buffer while the GVL is released.
  */
 VALUE
-rmdbx_include( VALUE self, VALUE key )
+rmdbx_key_for( rmdbx_db_t *db, VALUE key, MDBX_val *ckey )
 {
-	UNWRAP_DB( self, db );
+	VALUE key_str;
 
-	CHECK_HANDLE();
-	rmdbx_open_txn( db, MDBX_TXN_RDONLY );
+	if ( db->settings.db_flags & MDBX_INTEGERKEY ) {
+		VALUE num = rb_to_int( key );
+		if ( RTEST( rb_funcall(num, '<', 1, INT2FIX(0)) ) )
+			rb_raise( rb_eArgError, "Integer keys must not be negative: %"PRIsVALUE, num );
 
-	MDBX_val ckey;
-	MDBX_val data;
-	rmdbx_key_for( key, &ckey );
+		uint64_t packed = NUM2ULL( num );
+		key_str = rb_str_new( (const char *)&packed, sizeof(packed) );
+	}
+	else {
+		key_str = RB_TYPE_P( key, T_STRING ) ? key : rb_funcall( key, rb_intern("to_s"), 0 );
+		StringValue( key_str );
+	}
+	key_str = rb_str_new_frozen( key_str );
 
-	int rc = mdbx_get( db->txn, db->dbi, &ckey, &data );
-	rmdbx_close_txn( db, RMDBX_TXN_ROLLBACK );
-	xfree( ckey.iov_base );
+	ckey->iov_len  = RSTRING_LEN( key_str );
+	ckey->iov_base = RSTRING_PTR( key_str );
 
-	switch ( rc ) {
-		case MDBX_SUCCESS:
-			return Qtrue;
+	return key_str;
+}
 
-		case MDBX_NOTFOUND:
-			return Qfalse;
 
-		default:
-			rmdbx_close( self );
-			rb_raise( rmdbx_eDatabaseError, "Unable to fetch key: (%d) %s", rc, mdbx_strerror(rc) );
+/*
+ * Return the Ruby key for a stored +key+: an Integer for a database
+ * with integer keys, otherwise a String.
+ */
+VALUE
+rmdbx_key_str( rmdbx_db_t *db, const MDBX_val *key )
+{
+	if ( db->settings.db_flags & MDBX_INTEGERKEY ) {
+		if ( key->iov_len == sizeof(uint64_t) ) {
+			uint64_t packed;
+			memcpy( &packed, key->iov_base, sizeof(packed) );
+			return ULL2NUM( packed );
+		}
+		if ( key->iov_len == sizeof(uint32_t) ) {
+			uint32_t packed;
+			memcpy( &packed, key->iov_base, sizeof(packed) );
+			return UINT2NUM( packed );
+		}
 	}
+
+	return rb_str_new( key->iov_base, key->iov_len );
 }
 
 
-/* call-seq:
- *    db[ 'key' ] => value
+/*
+ * Given a ruby +value+ and a pointer to an MDBX_val, prepare
+ * the value for usage within mdbx.  Values are potentially serialized
+ * and compressed.
  *
- * Return a single value for +key+ immediately.
+ * As with rmdbx_key_for(), +data+ points directly at the returned
+ * (serialized, frozen) String, which must be kept alive while +data+
+ * is in use.
  */
 VALUE
-rmdbx_get_val( VALUE self, VALUE key )
+rmdbx_val_for( VALUE self, VALUE val, MDBX_val *data )
 {
 	UNWRAP_DB( self, db );
+	return rmdbx_collection_val_for( self, db->subdb, val, data );
+}
 
-	CHECK_HANDLE();
-	rmdbx_open_txn( db, MDBX_TXN_RDONLY );
 
-	MDBX_val ckey;
-	MDBX_val data;
+/*
+ * As rmdbx_val_for(), for a value to be stored in +collection+
+ * (NULL for the top level) rather than the current collection.
+ */
+VALUE
+rmdbx_collection_val_for( VALUE self, const char *collection, VALUE val, MDBX_val *data )
+{
+	UNWRAP_DB( self, db );
 
-	rmdbx_key_for( key, &ckey );
-	int rc = mdbx_get( db->txn, db->dbi, &ckey, &data );
-	rmdbx_close_txn( db, RMDBX_TXN_ROLLBACK );
-	xfree( ckey.iov_base );
+	val = rmdbx_serialize( self, db, val );
+	Check_Type( val, T_STRING );
+	val = rb_str_new_frozen( rmdbx_compress( db, collection, val ) );
 
-	VALUE rv;
-	switch ( rc ) {
-		case MDBX_SUCCESS:
-			rv = rb_str_new( data.iov_base, data.iov_len );
-			return rb_funcall( self, rb_intern("deserialize"), 1, rv );
+	data->iov_len  = RSTRING_LEN( val );
+	data->iov_base = RSTRING_PTR( val );
 
-		case MDBX_NOTFOUND:
-			return Qnil;
+	return val;
+}
 
-		default:
-			rmdbx_close( self );
-			rb_raise( rmdbx_eDatabaseError, "Unable to fetch value: (%d) %s", rc, mdbx_strerror(rc) );
+
+/* Marshal wrappers for rb_protect(). */
+VALUE
+rmdbx_marshal_dump_i( VALUE val )
+{
+	return rb_marshal_dump( val, Qnil );
+}
+
+VALUE
+rmdbx_marshal_load_i( VALUE val )
+{
+	return rb_marshal_load( val );
+}
+
+/* MessagePack wrappers for rb_protect(). */
+VALUE
+rmdbx_msgpack_encode_i( VALUE val )
+{
+	return rmdbx_msgpack_encode( val );
+}
+
+VALUE
+rmdbx_msgpack_decode_i( VALUE ptr )
+{
+	const MDBX_val *data = (const MDBX_val *)ptr;
+	return rmdbx_msgpack_decode( data->iov_base, data->iov_len );
+}
+
+
+/*
+ * Call a native serializer +func+ with +val+.  As with the Ruby
+ * #serialize and #deserialize methods, any open transaction is
+ * closed if it raises.
+ */
+VALUE
+rmdbx_serialize_call( VALUE self, VALUE (*func)( VALUE ), VALUE val )
+{
+	int state;
+	VALUE rv = rb_protect( func, val, &state );
+
+	if ( state ) {
+		rmdbx_rb_closetxn( self, Qfalse );
+		rb_jump_tag( state );
 	}
+
+	return rv;
 }
 
 
-/* call-seq:
- *    db[ 'key' ] = value
+/*
+ * Serialize +val+ for storage, according to the database's
+ * serializer mode.  Native modes are dispatched directly, only
+ * custom serializers go through Ruby.
+ */
+VALUE
+rmdbx_serialize( VALUE self, rmdbx_db_t *db, VALUE val )
+{
+	if ( db->settings.serializer == RMDBX_SERIALIZE_RAW ) return val;
+
+	uint64_t start = rmdbx_metrics_start( db );
+	switch ( db->settings.serializer ) {
+		case RMDBX_SERIALIZE_STRING:
+			val = rb_obj_as_string( val );
+			break;
+		case RMDBX_SERIALIZE_MARSHAL:
+			val = rmdbx_serialize_call( self, rmdbx_marshal_dump_i, val );
+			break;
+		case RMDBX_SERIALIZE_MSGPACK:
+			val = rmdbx_serialize_call( self, rmdbx_msgpack_encode_i, val );
+			break;
+		default:
+			val = rb_funcall( self, id_serialize, 1, val );
+	}
+	rmdbx_metrics_finish( db, RMDBX_OP_SERIALIZE, start, 1 );
+
+	return val;
+}
+
+
+/*
+ * Deserialize a stored +val+, according to the database's
+ * serializer mode.
+ */
+VALUE
+rmdbx_deserialize( VALUE self, rmdbx_db_t *db, VALUE val )
+{
+	VALUE rv;
+
+	if ( db->settings.serializer == RMDBX_SERIALIZE_RAW ||
+		 db->settings.serializer == RMDBX_SERIALIZE_STRING ) return val;
+
+	uint64_t start = rmdbx_metrics_start( db );
+	switch ( db->settings.serializer ) {
+		case RMDBX_SERIALIZE_MARSHAL:
+			rv = rmdbx_serialize_call( self, rmdbx_marshal_load_i, val );
+			break;
+		case RMDBX_SERIALIZE_MSGPACK: {
+			MDBX_val data = { RSTRING_PTR(val), RSTRING_LEN(val) };
+			rv = rmdbx_serialize_call( self, rmdbx_msgpack_decode_i, (VALUE)&data );
+			RB_GC_GUARD( val );
+			break;
+		}
+		default:
+			rv = rb_funcall( self, id_deserialize, 1, val );
+	}
+	rmdbx_metrics_finish( db, RMDBX_OP_DESERIALIZE, start, 1 );
+
+	return rv;
+}
+
+
+/*
+ * Load the stored value at +data+ into a Ruby object.
  *
- * Set a single value for +key+.  If the value is +nil+, the
- * key is removed.
+ * Uncompressed MessagePack is decoded straight from +data+ (usually
+ * an mdbx page), copying only the bytes of any Strings within.
+ * Otherwise the value is copied (or decompressed) into a String to
+ * deserialize.  The transaction +data+ belongs to must still be open.
  */
 VALUE
-rmdbx_put_val( VALUE self, VALUE key, VALUE val )
+rmdbx_load_val( VALUE self, rmdbx_db_t *db, const MDBX_val *data )
+{
+	if ( db->settings.serializer == RMDBX_SERIALIZE_MSGPACK && db->settings.compress == RMDBX_COMPRESS_NONE ) {
+		uint64_t start = rmdbx_metrics_start( db );
+		VALUE rv = rmdbx_serialize_call( self, rmdbx_msgpack_decode_i, (VALUE)data );
+		rmdbx_metrics_finish( db, RMDBX_OP_DESERIALIZE, start, 1 );
+		return rv;
+	}
+
+	return rmdbx_deserialize( self, db, rmdbx_stored_str( self, db, data ) );
+}
+
+
+/*
+ * call-seq:
+ *    db.serializer_mode => Symbol
+ *
+ * Return how values are serialized: one of +:raw+, +:marshal+,
+ * +:msgpack+, or +:string+, or +:custom+ if #serializer or
+ * #deserializer have been replaced.
+ */
+VALUE
+rmdbx_get_serializer_mode( VALUE self )
+{
+	UNWRAP_DB( self, db );
+
+	switch ( db->settings.serializer ) {
+		case RMDBX_SERIALIZE_RAW:
+			return ID2SYM( rb_intern("raw") );
+		case RMDBX_SERIALIZE_MARSHAL:
+			return ID2SYM( rb_intern("marshal") );
+		case RMDBX_SERIALIZE_MSGPACK:
+			return ID2SYM( rb_intern("msgpack") );
+		case RMDBX_SERIALIZE_STRING:
+			return ID2SYM( rb_intern("string") );
+		default:
+			return ID2SYM( rb_intern("custom") );
+	}
+}
+
+
+/*
+ * Set the serializer +mode+ from a Symbol, along with the
+ * equivalent @serializer and @deserializer, so replacing only one
+ * of them later leaves the other in place.
+ */
+VALUE
+rmdbx_set_serializer_mode( VALUE self, VALUE mode )
 {
-	int rc;
 	UNWRAP_DB( self, db );
+	ID id = rb_sym2id( mode );
+	VALUE marshal = rb_const_get( rb_cObject, rb_intern("Marshal") );
+
+	if ( id == rb_intern("custom") ) {
+		db->settings.serializer = RMDBX_SERIALIZE_CUSTOM;
+		return mode;
+	}
+	else if ( id == rb_intern("raw") ) {
+		db->settings.serializer = RMDBX_SERIALIZE_RAW;
+		rb_iv_set( self, "@serializer", Qnil );
+		rb_iv_set( self, "@deserializer", Qnil );
+	}
+	else if ( id == rb_intern("marshal") ) {
+		db->settings.serializer = RMDBX_SERIALIZE_MARSHAL;
+		rb_iv_set( self, "@serializer", rb_obj_method( marshal, ID2SYM(rb_intern("dump")) ) );
+		rb_iv_set( self, "@deserializer", rb_obj_method( marshal, ID2SYM(rb_intern("load")) ) );
+	}
+	else if ( id == rb_intern("msgpack") ) {
+		db->settings.serializer = RMDBX_SERIALIZE_MSGPACK;
+		rb_iv_set( self, "@serializer", rb_obj_method( rmdbx_mMessagePack, ID2SYM(rb_intern("dump")) ) );
+		rb_iv_set( self, "@deserializer", rb_obj_method( rmdbx_mMessagePack, ID2SYM(rb_intern("load")) ) );
+	}
+	else if ( id == rb_intern("string") ) {
+		db->settings.serializer = RMDBX_SERIALIZE_STRING;
+		rb_iv_set( self, "@serializer", rb_funcall( ID2SYM(rb_intern("to_s")), rb_intern("to_proc"), 0 ) );
+		rb_iv_set( self, "@deserializer", Qnil );
+	}
+	else {
+		rb_raise( rb_eArgError, "Unknown serializer: %"PRIsVALUE, mode );
+	}
+
+	return mode;
+}
+
+
+/* Inline struct for deferred calls, passed as a void pointer. */
+struct nogvl_call_s {
+	void *(*func)( void * );
+	void *arg;
+	void *result;
+	int done;
+};
+
+
+/* Runs a deferred call outside of the GVL. */
+void *
+rmdbx_nogvl_call_i( void *ptr )
+{
+	struct nogvl_call_s *call = (struct nogvl_call_s *)ptr;
+
+	call->result = call->func( call->arg );
+	call->done   = 1;
+
+	return NULL;
+}
+
+
+/*
+ * Call +func+ with +arg+, releasing the GVL while it runs.
+ *
+ * +func+ must not touch any Ruby objects: everything it needs is
+ * staged into +arg+ beforehand.  Pending interrupts are deferred
+ * rather than raised, so +func+ is always run exactly once and its
+ * result is never lost -- if Ruby declines to release the GVL, it
+ * runs with the GVL held instead.
+ */
+void *
+rmdbx_without_gvl( void *(*func)( void * ), void *arg )
+{
+	struct nogvl_call_s call = { func, arg, NULL, 0 };
+
+	rb_nogvl( rmdbx_nogvl_call_i, (void *)&call, RUBY_UBF_IO, NULL, RB_NOGVL_INTR_FAIL );
+	if ( ! call.done ) call.result = func( arg );
 
+	return call.result;
+}
+
+
+/*
+ * Run +func+ with +arg+ against the environment of +db+, as
+ * rmdbx_without_gvl().  The call is counted as in flight until it
+ * returns, so db.close can wait for it before closing the
+ * environment.
+ */
+void *
+rmdbx_db_without_gvl( rmdbx_db_t *db, void *(*func)( void * ), void *arg )
+{
+	/* Another thread may have closed the handle while this one ran Ruby. */
 	CHECK_HANDLE();
-	rmdbx_open_txn( db, MDBX_TXN_READWRITE );
 
-	MDBX_val ckey;
-	rmdbx_key_for( key, &ckey );
+	db->state.inflight++;
+	void *rv = rmdbx_without_gvl( func, arg );
+	db->state.inflight--;
+
+	return rv;
+}
+
+
+#ifdef HAVE_PTHREAD_H
+/*
+ * Start a native helper thread running +func+ with +arg+.  The
+ * thread never touches Ruby, and leaves signal handling to Ruby's
+ * own threads.  Returns 0, or an errno value on failure.
+ */
+int
+rmdbx_start_thread( pthread_t *thread, void *(*func)( void * ), void *arg )
+{
+	sigset_t all, prev;
+
+	sigfillset( &all );
+	pthread_sigmask( SIG_SETMASK, &all, &prev );
+	int rc = pthread_create( thread, NULL, func, arg );
+	pthread_sigmask( SIG_SETMASK, &prev, NULL );
+
+	return rc;
+}
+
 
-	if ( NIL_P(val) ) { /* remove if set to nil */
-		rc = mdbx_del( db->txn, db->dbi, &ckey, NULL );
+/* Waits for a helper thread to exit, outside of the GVL. */
+static void *
+rmdbx_join_thread_without_gvl( void *ptr )
+{
+	pthread_join( *(pthread_t *)ptr, NULL );
+	return NULL;
+}
+
+
+/*
+ * Wait for a helper +thread+ to exit.  A helper may be waiting on a
+ * transaction held by another Ruby thread, so the GVL is released
+ * while waiting -- unless +nogvl+ is false, as while freeing a handle
+ * during GC, when no other thread can be using it.
+ */
+void
+rmdbx_join_thread( pthread_t thread, int nogvl )
+{
+	if ( nogvl ) {
+		rmdbx_without_gvl( rmdbx_join_thread_without_gvl, (void *)&thread );
 	}
 	else {
-		MDBX_val data;
-		rmdbx_val_for( self, val, &data );
-		rc = mdbx_put( db->txn, db->dbi, &ckey, &data, 0 );
-		xfree( data.iov_base );
+		pthread_join( thread, NULL );
 	}
+}
+#endif
 
-	rmdbx_close_txn( db, RMDBX_TXN_COMMIT );
-	xfree( ckey.iov_base );
 
-	switch ( rc ) {
-		case MDBX_SUCCESS:
-			return val;
-		case MDBX_NOTFOUND:
-			return Qnil;
-		default:
-			rb_raise( rmdbx_eDatabaseError, "Unable to update value: (%d) %s", rc, mdbx_strerror(rc) );
+/* Fetches a staged key outside of the GVL. */
+void *
+rmdbx_get_without_gvl( void *ptr )
+{
+	struct op_args_s *args = (struct op_args_s *)ptr;
+	args->rc = mdbx_get( args->txn, args->dbi, &args->key, &args->data );
+	return NULL;
+}
+
+
+/* Stores a staged key and value outside of the GVL. */
+void *
+rmdbx_put_without_gvl( void *ptr )
+{
+	struct op_args_s *args = (struct op_args_s *)ptr;
+	args->rc = mdbx_put( args->txn, args->dbi, &args->key, &args->data, args->flags );
+	return NULL;
+}
+
+
+/* Removes a staged key outside of the GVL. */
+void *
+rmdbx_del_without_gvl( void *ptr )
+{
+	struct op_args_s *args = (struct op_args_s *)ptr;
+	args->rc = mdbx_del( args->txn, args->dbi, &args->key, NULL );
+	return NULL;
+}
+
+
+/* Commits a transaction outside of the GVL. */
+void *
+rmdbx_commit_without_gvl( void *ptr )
+{
+	return (void *)(intptr_t)mdbx_txn_commit( (MDBX_txn *)ptr );
+}
+
+
+/*
+ * Convert a map geometry option to bytes, with nil meaning
+ * "unchanged" (-1).
+ */
+static intptr_t
+rmdbx_geometry_opt( VALUE opt )
+{
+	if ( NIL_P(opt) ) return -1;
+
+	LONG_LONG bytes = NUM2LL( opt );
+	if ( bytes < 0 ) rb_raise( rb_eArgError, "Map sizes can't be negative: %lld", bytes );
+
+	return (intptr_t)bytes;
+}
+
+
+/*
+ * Returns true if any part of the map geometry for +db+ was set.
+ */
+static int
+rmdbx_geometry_set_p( rmdbx_db_t *db )
+{
+	return db->settings.max_size ||
+		db->settings.size_lower > -1 ||
+		db->settings.size_now > -1 ||
+		db->settings.growth_step > -1 ||
+		db->settings.shrink_threshold > -1 ||
+		db->settings.page_size > -1;
+}
+
+
+/*
+ * Open the DB environment handle.
+ *
+ */
+VALUE
+rmdbx_open_env( VALUE self )
+{
+	int rc;
+	UNWRAP_DB( self, db );
+	rmdbx_close_shared( db, "reopen" );
+
+	/* Allocate an mdbx environment.
+	 */
+	rc = mdbx_env_create( &db->env );
+	if ( rc != MDBX_SUCCESS )
+		rb_raise( rmdbx_eDatabaseError, "mdbx_env_create: (%d) %s", rc, mdbx_strerror(rc) );
+
+	/* Set the maximum number of named databases for the environment. */
+	mdbx_env_set_maxdbs( db->env, db->settings.max_collections );
+
+	/* Customize the maximum number of simultaneous readers. */
+	if ( db->settings.max_readers )
+		mdbx_env_set_maxreaders( db->env, db->settings.max_readers );
+
+	/* Set the map geometry: its bounds, current size, growth and shrink
+	 * steps, and page size.  Anything unset is left to libmdbx. */
+	if ( rmdbx_geometry_set_p(db) ) {
+		rc = mdbx_env_set_geometry( db->env,
+			db->settings.size_lower,
+			db->settings.size_now,
+			db->settings.max_size ? (intptr_t)db->settings.max_size : -1,
+			db->settings.growth_step,
+			db->settings.shrink_threshold,
+			db->settings.page_size );
+
+		if ( rc != MDBX_SUCCESS ) {
+			rmdbx_close_all( db );
+			rb_raise( rmdbx_eDatabaseError, "mdbx_env_set_geometry: (%d) %s", rc, mdbx_strerror(rc) );
+		}
+	}
+
+	/* Automatic sync thresholds, for periodic syncs. */
+	rmdbx_set_sync_thresholds( db );
+
+	rc = mdbx_env_open( db->env, db->path, db->settings.env_flags, db->settings.mode );
+	if ( rc != MDBX_SUCCESS ) {
+		rmdbx_close_all( db );
+		rb_raise( rmdbx_eDatabaseError, "mdbx_env_open: (%d) %s", rc, mdbx_strerror(rc) );
 	}
+
+	/* Force populate the db->dbi handle.  Under 0.12.x, getting a
+	 * 'permission denied' doing this for the first access with a RDONLY
+	 * for some reason. */
+	rmdbx_open_txn( db, MDBX_TXN_READWRITE );
+	rmdbx_close_txn( db, RMDBX_TXN_ROLLBACK );
+
+	db->state.open = 1;
+	rmdbx_start_syncer( db );
+	return Qtrue;
 }
 
 
 /*
- * Return the currently selected collection, or +nil+ if at the
- * top-level.
+ * call-seq:
+ *    db.clear
+ *
+ * Empty the current collection on disk.  If collections are not enabled
+ * or the database handle is set to the top-level (main) db - this
+ * deletes *all records* from the database.
+ */
+VALUE
+rmdbx_clear( VALUE self )
+{
+	UNWRAP_DB( self, db );
+
+	MDBX_txn *txn = rmdbx_open_txn( db, MDBX_TXN_READWRITE );
+	int rc = mdbx_drop( txn, db->dbi, false );
+
+	if ( rc != MDBX_SUCCESS ) {
+		rmdbx_close_txn( db, RMDBX_TXN_ROLLBACK );
+		rb_raise( rmdbx_eDatabaseError, "mdbx_drop: (%d) %s", rc, mdbx_strerror(rc) );
+	}
+
+	rmdbx_close_txn( db, RMDBX_TXN_COMMIT );
+
+	return Qnil;
+}
+
+
+/*
+ * call-seq:
+ *    db.drop( collection ) -> db
+ *
+ * Destroy a collection.  You must be in the top level database to call
+ * this method.
+ */
+VALUE
+rmdbx_drop( VALUE self, VALUE name )
+{
+	UNWRAP_DB( self, db );
+
+	/* Provide a friendlier error message if max_collections is 0. */
+	if ( db->settings.max_collections == 0 )
+		rb_raise( rmdbx_eDatabaseError, "Unable to drop collection: collections are not enabled." );
+
+	/* All transactions must be closed when dropping a database. */
+	if ( rmdbx_any_txn_open(db) )
+		rb_raise( rmdbx_eDatabaseError, "Unable to drop collection: transaction open" );
+
+	/* A drop can only be performed from the top-level database. */
+	if ( db->subdb != NULL )
+		rb_raise( rmdbx_eDatabaseError, "Unable to drop collection: switch to top-level db first" );
+
+	name = rb_funcall( name, rb_intern("to_s"), 0 );
+	db->subdb = ruby_strdup( StringValueCStr(name) );
+
+	rmdbx_use_cached_dbi( db ); /* ensure we're reopening within the new subdb */
+	MDBX_txn *txn = rmdbx_open_txn( db, MDBX_TXN_READWRITE );
+	int rc = mdbx_drop( txn, db->dbi, true );
+
+	if ( rc != MDBX_SUCCESS ) {
+		rmdbx_close_txn( db, RMDBX_TXN_ROLLBACK );
+		xfree( db->subdb );
+		db->subdb = NULL;
+		rmdbx_use_cached_dbi( db );
+		rb_raise( rmdbx_eDatabaseError, "mdbx_drop: (%d) %s", rc, mdbx_strerror(rc) );
+	}
+
+	rmdbx_close_txn( db, RMDBX_TXN_COMMIT );
+	rmdbx_uncache_dbi( db ); /* the drop closed its handle */
+
+	/* Reset the current collection to the top level. */
+	xfree( db->subdb );
+	db->subdb = NULL;
+	rmdbx_use_cached_dbi( db );
+
+	/* Force populate the new db->dbi handle.  Under 0.12.x, getting a
+	 * 'permission denied' doing this for the first access with a RDONLY
+	 * for some reason. */
+	rmdbx_open_txn( db, MDBX_TXN_READWRITE );
+	rmdbx_close_txn( db, RMDBX_TXN_ROLLBACK );
+
+	return self;
+}
+
+
+/* call-seq:
+ *    db.length -> Integer
+ *
+ * Returns the count of keys in the currently selected collection.
+ */
+VALUE
+rmdbx_length( VALUE self )
+{
+	UNWRAP_DB( self, db );
+	MDBX_stat mstat;
+
+	CHECK_HANDLE();
+	MDBX_txn *txn = rmdbx_open_txn( db, MDBX_TXN_RDONLY );
+
+	int rc = mdbx_dbi_stat( txn, db->dbi, &mstat, sizeof(mstat) );
+	if ( rc != MDBX_SUCCESS ) {
+		rmdbx_close_txn( db, RMDBX_TXN_ROLLBACK );
+		rb_raise( rmdbx_eDatabaseError, "mdbx_dbi_stat: (%d) %s", rc, mdbx_strerror(rc) );
+	}
+
+	VALUE rv = LONG2FIX( mstat.ms_entries );
+	rmdbx_close_txn( db, RMDBX_TXN_ROLLBACK );
+
+	return rv;
+}
+
+
+/* call-seq:
+ *    db.include?( 'key' ) => bool
+ *
+ * Returns true if the current collection contains +key+.
+ */
+VALUE
+rmdbx_include( VALUE self, VALUE key )
+{
+	UNWRAP_DB( self, db );
+	struct op_args_s op;
+
+	CHECK_HANDLE();
+	VALUE key_str = rmdbx_key_for( db, key, &op.key );
+
+	op.txn = rmdbx_open_txn( db, MDBX_TXN_RDONLY );
+	op.dbi = db->dbi;
+	rmdbx_timed_without_gvl( db, RMDBX_OP_GET, rmdbx_get_without_gvl, (void *)&op );
+
+	rmdbx_close_txn( db, RMDBX_TXN_ROLLBACK );
+	RB_GC_GUARD( key_str );
+
+	switch ( op.rc ) {
+		case MDBX_SUCCESS:
+			return Qtrue;
+
+		case MDBX_NOTFOUND:
+			return Qfalse;
+
+		default:
+			rmdbx_close( self );
+			rb_raise( rmdbx_eDatabaseError, "Unable to fetch key: (%d) %s", op.rc, mdbx_strerror(op.rc) );
+	}
+}
+
+
+/* call-seq:
+ *    db[ 'key' ] => value
+ *
+ * Return a single value for +key+ immediately.
+ */
+VALUE
+rmdbx_get_val( VALUE self, VALUE key )
+{
+	UNWRAP_DB( self, db );
+	struct op_args_s op;
+	VALUE rv = Qnil;
+
+	CHECK_HANDLE();
+	VALUE key_str = rmdbx_key_for( db, key, &op.key );
+
+	/* The lookup may fault in cold pages, so it runs without the GVL. */
+	op.txn = rmdbx_open_txn( db, MDBX_TXN_RDONLY );
+	op.dbi = db->dbi;
+	rmdbx_timed_without_gvl( db, RMDBX_OP_GET, rmdbx_get_without_gvl, (void *)&op );
+
+	/* Load the value out of the map before the snapshot closes. */
+	if ( op.rc == MDBX_SUCCESS ) {
+		rmdbx_metrics_bytes( db, op.data.iov_len, 0 );
+		rv = rmdbx_load_val( self, db, &op.data );
+	}
+
+	rmdbx_close_txn( db, RMDBX_TXN_ROLLBACK );
+	RB_GC_GUARD( key_str );
+
+	switch ( op.rc ) {
+		case MDBX_SUCCESS:
+			return rv;
+
+		case MDBX_NOTFOUND:
+			return Qnil;
+
+		default:
+			rmdbx_close( self );
+			rb_raise( rmdbx_eDatabaseError, "Unable to fetch value: (%d) %s", op.rc, mdbx_strerror(op.rc) );
+	}
+}
+
+
+/* Inline struct for staged multi-get arguments, passed as a void pointer. */
+struct get_many_args_s {
+	MDBX_txn *txn;
+	MDBX_dbi dbi;
+	long count;
+	MDBX_val *keys;
+	MDBX_val *vals;
+	int *rcs;
+};
+
+
+/* Fetches every staged key outside of the GVL. */
+void *
+rmdbx_get_many_without_gvl( void *ptr )
+{
+	struct get_many_args_s *args = (struct get_many_args_s *)ptr;
+
+	for ( long i = 0; i < args->count; i++ )
+		args->rcs[i] = mdbx_get( args->txn, args->dbi, &args->keys[i], &args->vals[i] );
+
+	return NULL;
+}
+
+
+/* call-seq:
+ *    db.get_many( keys ) => [ value, value, ... ]
+ *
+ * Return an Array of values for the given Array of +keys+, fetched
+ * from a single snapshot.  Missing keys return +nil+.
+ *
+ * All keys are converted and staged up front, then every lookup
+ * happens without holding the GVL.  MessagePack values are decoded
+ * while the snapshot is still open (in place, unless compressed);
+ * anything else is copied out, and deserialized after the snapshot
+ * is closed.
+ */
+VALUE
+rmdbx_get_many( VALUE self, VALUE keys )
+{
+	UNWRAP_DB( self, db );
+	VALUE tmp_vals, tmp_rcs, tmp_strs;
+
+	CHECK_HANDLE();
+	Check_Type( keys, T_ARRAY );
+
+	long count = RARRAY_LEN( keys );
+	VALUE rv   = rb_ary_new_capa( count );
+	if ( count == 0 ) return rv;
+
+	MDBX_val *vals = ALLOCV_N( MDBX_val, tmp_vals, count * 2 );
+	int *rcs       = ALLOCV_N( int, tmp_rcs, count );
+	VALUE *strs    = ALLOCV_N( VALUE, tmp_strs, count );
+
+	struct get_many_args_s args;
+	args.count = count;
+	args.keys  = vals;
+	args.vals  = vals + count;
+	args.rcs   = rcs;
+
+	/* Convert every key before touching the database.  Each points
+	   straight at its frozen String, kept alive (and pinned, as the
+	   buffer is scanned conservatively) in +strs+. */
+	for ( long i = 0; i < count; i++ ) strs[i] = Qnil;
+	for ( long i = 0; i < count; i++ )
+		strs[i] = rmdbx_key_for( db, RARRAY_AREF(keys, i), &args.keys[i] );
+
+	args.txn = rmdbx_open_txn( db, MDBX_TXN_RDONLY );
+	args.dbi = db->dbi;
+
+	uint64_t start = rmdbx_metrics_start( db );
+	rmdbx_db_without_gvl( db, rmdbx_get_many_without_gvl, (void *)&args );
+	rmdbx_metrics_finish( db, RMDBX_OP_GET, start, count );
+
+	/*
+	 * Copy values out of the map while the snapshot is still valid.
+	 * MessagePack is decoded in place; everything else is deserialized
+	 * once the snapshot is closed.
+	 */
+	int decoded = db->settings.serializer == RMDBX_SERIALIZE_MSGPACK;
+	for ( long i = 0; i < count; i++ ) {
+		switch ( rcs[i] ) {
+			case MDBX_SUCCESS:
+				rmdbx_metrics_bytes( db, args.vals[i].iov_len, 0 );
+				rb_ary_push( rv, decoded ?
+					rmdbx_load_val( self, db, &args.vals[i] ) :
+					rmdbx_stored_str( self, db, &args.vals[i] ) );
+				break;
+
+			case MDBX_NOTFOUND:
+				rb_ary_push( rv, Qnil );
+				break;
+
+			default:
+				rmdbx_close_txn( db, RMDBX_TXN_ROLLBACK );
+				rb_raise( rmdbx_eDatabaseError, "Unable to fetch value: (%d) %s", rcs[i], mdbx_strerror(rcs[i]) );
+		}
+	}
+	rmdbx_close_txn( db, RMDBX_TXN_ROLLBACK );
+
+	ALLOCV_END( tmp_strs );
+	ALLOCV_END( tmp_rcs );
+	ALLOCV_END( tmp_vals );
+
+	for ( long i = 0; i < count && ! decoded; i++ ) {
+		VALUE val = RARRAY_AREF( rv, i );
+		if ( ! NIL_P(val) )
+			rb_ary_store( rv, i, rmdbx_deserialize( self, db, val ) );
+	}
+
+	return rv;
+}
+
+
+/* call-seq:
+ *    db[ 'key' ] = value
+ *
+ * Set a single value for +key+.  If the value is +nil+, the
+ * key is removed.
+ */
+VALUE
+rmdbx_put_val( VALUE self, VALUE key, VALUE val )
+{
+	UNWRAP_DB( self, db );
+	struct op_args_s op;
+	VALUE val_str = Qnil;
+
+	CHECK_HANDLE();
+	VALUE key_str = rmdbx_key_for( db, key, &op.key );
+	if ( ! NIL_P(val) ) val_str = rmdbx_val_for( self, val, &op.data );
+
+	op.dbi   = db->dbi;
+	op.flags = 0;
+
+	if ( rmdbx_group_writes(db) ) {
+		/* Timed until committed, as that's when the write returns. */
+		uint64_t start = rmdbx_metrics_start( db );
+		rmdbx_group_write( db, &op, NIL_P(val) );
+		rmdbx_metrics_finish( db, NIL_P(val) ? RMDBX_OP_DEL : RMDBX_OP_PUT, start, 1 );
+	}
+	else {
+		op.txn = rmdbx_open_txn( db, MDBX_TXN_READWRITE );
+		op.dbi = db->dbi;
+
+		/* remove if set to nil */
+		if ( NIL_P(val) ) {
+			rmdbx_timed_without_gvl( db, RMDBX_OP_DEL, rmdbx_del_without_gvl, (void *)&op );
+		}
+		else {
+			rmdbx_timed_without_gvl( db, RMDBX_OP_PUT, rmdbx_put_without_gvl, (void *)&op );
+		}
+		rmdbx_close_txn( db, RMDBX_TXN_COMMIT );
+	}
+
+	if ( op.rc == MDBX_SUCCESS && ! NIL_P(val) ) rmdbx_metrics_bytes( db, 0, op.key.iov_len + op.data.iov_len );
+
+	RB_GC_GUARD( key_str );
+	RB_GC_GUARD( val_str );
+
+	switch ( op.rc ) {
+		case MDBX_SUCCESS:
+			return val;
+		case MDBX_NOTFOUND:
+			return Qnil;
+		default:
+			rb_raise( rmdbx_eDatabaseError, "Unable to update value: (%d) %s", op.rc, mdbx_strerror(op.rc) );
+	}
+}
+
+
+/* The maximum number of pairs staged before writing them. */
+#define RMDBX_PUT_BATCH 256
+
+/* Inline struct for batched put arguments, passed as a void pointer. */
+struct put_many_args_s {
+	VALUE self;
+	VALUE pairs;
+	VALUE staged;
+	rmdbx_db_t *db;
+	rmdbx_txn_state_t *state;
+	long commit_every;
+	long count;
+	int pending;
+	int failed;
+	int rc;
+	MDBX_put_flags_t flags;
+	MDBX_txn *txn;
+	MDBX_dbi dbi;
+	MDBX_val keys[ RMDBX_PUT_BATCH ];
+	MDBX_val vals[ RMDBX_PUT_BATCH ];
+	char dels[ RMDBX_PUT_BATCH ];
+};
+
+
+/*
+ * Write all staged pairs outside of the GVL, stopping at the
+ * first failure.
+ */
+void *
+rmdbx_put_many_without_gvl( void *ptr )
+{
+	struct put_many_args_s *args = (struct put_many_args_s *)ptr;
+
+	args->rc = MDBX_SUCCESS;
+	for ( args->failed = 0; args->failed < args->pending; args->failed++ ) {
+		int i = args->failed;
+
+		if ( args->dels[i] ) { /* remove if set to nil */
+			args->rc = mdbx_del( args->txn, args->dbi, &args->keys[i], NULL );
+			if ( args->rc == MDBX_NOTFOUND ) args->rc = MDBX_SUCCESS;
+		}
+		else {
+			args->rc = mdbx_put( args->txn, args->dbi, &args->keys[i], &args->vals[i], args->flags );
+		}
+
+		if ( args->rc != MDBX_SUCCESS ) break;
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Write any staged pairs into the currently open transaction,
+ * and release their Strings.
+ */
+void
+rmdbx_put_many_flush( struct put_many_args_s *args )
+{
+	if ( args->pending == 0 ) return;
+
+	args->txn = args->state->txn;
+	args->dbi = args->db->dbi;
+
+	uint64_t start = rmdbx_metrics_start( args->db );
+	rmdbx_db_without_gvl( args->db, rmdbx_put_many_without_gvl, (void *)args );
+	rmdbx_metrics_finish( args->db, RMDBX_OP_PUT, start, args->failed );
+
+	for ( int i = 0; i < args->failed; i++ )
+		if ( ! args->dels[i] ) rmdbx_metrics_bytes( args->db, 0, args->keys[i].iov_len + args->vals[i].iov_len );
+
+	if ( args->rc == MDBX_EKEYMISMATCH ) {
+		VALUE key = rmdbx_key_str( args->db, &args->keys[ args->failed ] );
+		rb_raise( rmdbx_eDatabaseError, "Unable to append value: key %"PRIsVALUE" is out of order", rb_inspect(key) );
+	}
+
+	args->count  += args->failed;
+	args->pending = 0;
+	rb_ary_clear( args->staged );
+
+	if ( args->rc != MDBX_SUCCESS )
+		rb_raise( rmdbx_eDatabaseError, "Unable to update value: (%d) %s", args->rc, mdbx_strerror(args->rc) );
+
+	return;
+}
+
+
+/*
+ * Stage a single +key+ and +val+ for writing into the currently
+ * open transaction.  Staged pairs are written in batches, and the
+ * transaction is committed and reopened every +commit_every+
+ * entries if requested.
+ */
+void
+rmdbx_put_many_pair( struct put_many_args_s *args, VALUE key, VALUE val )
+{
+	int i = args->pending;
+
+	/* The staged Strings are frozen, and kept alive until flushed. */
+	if ( args->flags && NIL_P(val) )
+		rb_raise( rb_eArgError, "Unable to append a nil value for %"PRIsVALUE, rb_inspect(key) );
+
+	rb_ary_push( args->staged, rmdbx_key_for( args->db, key, &args->keys[i] ) );
+	args->dels[i] = NIL_P( val );
+	if ( ! args->dels[i] ) rb_ary_push( args->staged, rmdbx_val_for( args->self, val, &args->vals[i] ) );
+
+	args->pending++;
+
+	/* Periodically commit, if this is a transaction we own. */
+	if ( args->commit_every > 0 &&
+		 args->state->retain_txn == -1 &&
+		 ( args->count + args->pending ) % args->commit_every == 0 ) {
+		rmdbx_put_many_flush( args );
+		rmdbx_close_txn( args->db, RMDBX_TXN_COMMIT );
+		rmdbx_open_txn( args->db, MDBX_TXN_READWRITE );
+	}
+	else if ( args->pending == RMDBX_PUT_BATCH ) {
+		rmdbx_put_many_flush( args );
+	}
+
+	return;
+}
+
+
+/* Hash iterator for batched puts. */
+int
+rmdbx_put_many_hash_i( VALUE key, VALUE val, VALUE argp )
+{
+	rmdbx_put_many_pair( (struct put_many_args_s *)argp, key, val );
+	return ST_CONTINUE;
+}
+
+
+/* Enumerable iterator for batched puts. */
+VALUE
+rmdbx_put_many_each_i( RB_BLOCK_CALL_FUNC_ARGLIST(yielded, argp) )
+{
+	VALUE pair = ( argc == 2 ) ? rb_ary_new_from_values( 2, argv ) : rb_Array( yielded );
+
+	if ( RARRAY_LEN(pair) != 2 )
+		rb_raise( rb_eArgError, "expected a key/value pair, got %"PRIsVALUE, yielded );
+
+	rmdbx_put_many_pair( (struct put_many_args_s *)argp,
+		RARRAY_AREF(pair, 0), RARRAY_AREF(pair, 1) );
+
+	return Qnil;
+}
+
+
+/* Walk +pairs+, writing each of them. */
+VALUE
+rmdbx_put_many_i( VALUE argp )
+{
+	struct put_many_args_s *args = (struct put_many_args_s *)argp;
+
+	if ( RB_TYPE_P(args->pairs, T_HASH) ) {
+		rb_hash_foreach( args->pairs, rmdbx_put_many_hash_i, argp );
+	}
+	else {
+		rb_block_call( args->pairs, rb_intern("each"), 0, NULL, rmdbx_put_many_each_i, argp );
+	}
+	rmdbx_put_many_flush( args );
+
+	return Qnil;
+}
+
+
+/* call-seq:
+ *    db.put_pairs( pairs, commit_every, append ) => Integer
+ *
+ * Write every key/value pair from +pairs+ (a Hash, or any object
+ * that yields pairs from #each) within a single transaction,
+ * returning the number of pairs written.  If +commit_every+ is
+ * a positive Integer, the transaction is committed every
+ * +commit_every+ pairs.
+ *
+ * If +append+ is true, pairs must be in key order (and follow any
+ * existing keys), and are written with MDBX_APPEND: no tree descent
+ * per key, and filled pages instead of half empty ones after
+ * splits.  The first out of order key raises.
+ *
+ * If a long-running transaction is already open, pairs are
+ * written into it and +commit_every+ is ignored.
+ */
+VALUE
+rmdbx_put_many( VALUE self, VALUE pairs, VALUE commit_every, VALUE append )
+{
+	int state;
+	UNWRAP_DB( self, db );
+
+	CHECK_HANDLE();
+
+	struct put_many_args_s args;
+	args.self         = self;
+	args.pairs        = pairs;
+	args.db           = db;
+	args.staged       = rb_ary_tmp_new( RMDBX_PUT_BATCH * 2 );
+	args.commit_every = NIL_P(commit_every) ? 0 : NUM2LONG( commit_every );
+	args.count        = 0;
+	args.pending      = 0;
+	args.flags        = 0;
+
+	if ( RTEST(append) ) {
+		args.flags = MDBX_APPEND;
+		if ( db->settings.db_flags & MDBX_DUPSORT ) args.flags |= MDBX_APPENDDUP;
+	}
+
+	rmdbx_open_txn( db, MDBX_TXN_READWRITE );
+	args.state = rmdbx_txn_state( db );
+	rb_protect( rmdbx_put_many_i, (VALUE)&args, &state );
+
+	if ( state ) {
+		rmdbx_close_txn( db, RMDBX_TXN_ROLLBACK );
+		rb_jump_tag( state );
+	}
+
+	rmdbx_close_txn( db, RMDBX_TXN_COMMIT );
+	RB_GC_GUARD( args.staged );
+
+	return LONG2NUM( args.count );
+}
+
+
+/*
+ * Return the currently selected collection, or +nil+ if at the
+ * top-level.
+ */
+VALUE
+rmdbx_get_subdb( VALUE self )
+{
+	UNWRAP_DB( self, db );
+	return ( db->subdb == NULL ) ? Qnil : rb_str_new_cstr( db->subdb );
+}
+
+
+/*
+ * Sets the current collection name for read/write operations.
+ *
+ * Collection handles are cached by name, so switching to one that's
+ * been used before is a hash lookup.  A new collection is opened
+ * within the calling thread's transaction if one is open, and by a
+ * short write transaction (creating it if needed) otherwise.
+ */
+VALUE
+rmdbx_set_subdb( VALUE self, VALUE name )
+{
+	UNWRAP_DB( self, db );
+
+	/* Provide a friendlier error message if max_collections is 0. */
+	if ( db->settings.max_collections == 0 )
+		rb_raise( rmdbx_eDatabaseError, "Unable to change collection: collections are not enabled." );
+
+	/* The handle is shared, so no other thread may be mid-transaction. */
+	if ( rmdbx_other_txn_open(db) )
+		rb_raise( rmdbx_eDatabaseError, "Unable to change collection: transaction open in another thread" );
+
+	xfree( db->subdb );
+	db->subdb = NULL;
+
+	if ( ! NIL_P(name) ) {
+		db->subdb = ruby_strdup( StringValueCStr(name) );
+		rmdbx_log_obj( self, "debug", "setting subdb: %s", db->subdb );
+	}
+	else {
+		rmdbx_log_obj( self, "debug", "clearing subdb" );
+	}
+
+	if ( rmdbx_use_cached_dbi(db) ) return self;
+
+	MDBX_txn *txn = rmdbx_current_txn( db );
+	if ( txn ) {
+		unsigned int flags = db->settings.db_flags;
+		if ( mdbx_txn_flags(txn) & MDBX_TXN_RDONLY ) flags &= ~MDBX_CREATE;
+
+		int rc = mdbx_dbi_open( txn, db->subdb, flags, &db->dbi );
+		if ( rc != MDBX_SUCCESS ) {
+			db->dbi = 0;
+			rb_raise( rmdbx_eDatabaseError, "Unable to change collection: (%d) %s", rc, mdbx_strerror(rc) );
+		}
+		rmdbx_cache_dbi( db );
+	}
+	else {
+		/* Issue a single transaction to reify the collection. */
+		rmdbx_open_txn( db, MDBX_TXN_READWRITE );
+		rmdbx_close_txn( db, RMDBX_TXN_COMMIT );
+	}
+
+	return self;
+}
+
+
+/*
+ * call-seq:
+ *    db.in_transaction? => false
+ *
+ * Predicate: return true if a transaction (or snapshot)
+ * is currently open in the calling thread.
+ */
+VALUE
+rmdbx_in_transaction_p( VALUE self )
+{
+	UNWRAP_DB( self, db );
+	return rmdbx_current_txn( db ) ? Qtrue : Qfalse;
+}
+
+
+/* Gather every thread with transaction state. */
+int
+rmdbx_txn_state_threads_i( st_data_t thread, st_data_t state, st_data_t threads )
+{
+	rb_ary_push( (VALUE)threads, (VALUE)thread );
+	return ST_CONTINUE;
+}
+
+
+/*
+ * Discard transaction state belonging to threads that have
+ * exited.  Their transactions can no longer be used.  They're
+ * aborted only if transactions aren't bound to the thread that
+ * began them (with +no_stickythreads+); otherwise just forgotten.
+ */
+void
+rmdbx_prune_txn_states( rmdbx_db_t *db )
+{
+	VALUE threads = rb_ary_new();
+	st_foreach( db->txns, rmdbx_txn_state_threads_i, (st_data_t)threads );
+
+	int unbound = rmdbx_unbound_txns( db );
+
+	for ( long i = 0; i < RARRAY_LEN(threads); i++ ) {
+		st_data_t thread = (st_data_t)RARRAY_AREF( threads, i );
+		st_data_t state;
+
+		if ( RTEST( rb_funcall((VALUE)thread, rb_intern("alive?"), 0) ) ) continue;
+		if ( ! st_delete( db->txns, &thread, &state ) ) continue;
+
+		if ( unbound ) {
+			rmdbx_free_txn_state( (rmdbx_txn_state_t *)state );
+		}
+		else {
+			rmdbx_forget_txn_state( (rmdbx_txn_state_t *)state );
+		}
+	}
+
+	return;
+}
+
+
+/*
+ * Return the calling thread's transaction state, creating it
+ * if necessary.
+ */
+rmdbx_txn_state_t *
+rmdbx_txn_state( rmdbx_db_t *db )
+{
+	st_data_t state;
+	VALUE thread = rb_thread_current();
+
+	if ( st_lookup( db->txns, (st_data_t)thread, &state ) )
+		return (rmdbx_txn_state_t *)state;
+
+	/* A new thread is a good time to clean up after old ones. */
+	rmdbx_prune_txn_states( db );
+
+	rmdbx_txn_state_t *new = ZALLOC( rmdbx_txn_state_t );
+	new->retain_txn = -1;
+	st_insert( db->txns, (st_data_t)thread, (st_data_t)new );
+
+	return new;
+}
+
+
+/*
+ * Return the calling thread's open transaction, or NULL.
+ */
+MDBX_txn *
+rmdbx_current_txn( rmdbx_db_t *db )
+{
+	st_data_t state;
+
+	if ( ! db->txns ) return NULL;
+	if ( ! st_lookup( db->txns, (st_data_t)rb_thread_current(), &state ) ) return NULL;
+
+	return ((rmdbx_txn_state_t *)state)->txn;
+}
+
+
+/* Inline struct for finding open transactions, passed as a void pointer. */
+struct txn_search_s {
+	VALUE skip;
+	int found;
+};
+
+
+/* Check a single thread for an open transaction. */
+int
+rmdbx_any_txn_open_i( st_data_t thread, st_data_t state, st_data_t arg )
+{
+	struct txn_search_s *search = (struct txn_search_s *)arg;
+
+	if ( (VALUE)thread == search->skip ) return ST_CONTINUE;
+	if ( ! ((rmdbx_txn_state_t *)state)->txn ) return ST_CONTINUE;
+
+	search->found = 1;
+	return ST_STOP;
+}
+
+
+/*
+ * Returns true if any thread has a transaction open.
+ */
+int
+rmdbx_any_txn_open( rmdbx_db_t *db )
+{
+	struct txn_search_s search = { Qundef, 0 };
+	if ( db->txns ) st_foreach( db->txns, rmdbx_any_txn_open_i, (st_data_t)&search );
+	return search.found;
+}
+
+
+/*
+ * Returns true if any thread other than the caller has a
+ * transaction open.
+ */
+int
+rmdbx_other_txn_open( rmdbx_db_t *db )
+{
+	struct txn_search_s search = { rb_thread_current(), 0 };
+	if ( db->txns ) st_foreach( db->txns, rmdbx_any_txn_open_i, (st_data_t)&search );
+	return search.found;
+}
+
+
+/* Inline struct for transaction arguments, passed as a void pointer. */
+struct txn_open_args_s {
+	rmdbx_db_t *db;
+	MDBX_txn *txn;
+	int rwflag;
+};
+
+
+/* Opens a transaction outside of the GVL. */
+void *
+rmdbx_open_txn_without_gvl( void *ptr )
+{
+	struct txn_open_args_s *txn_open_args = (struct txn_open_args_s *)ptr;
+
+	rmdbx_db_t *db = txn_open_args->db;
+	int rc = mdbx_txn_begin( db->env, NULL, txn_open_args->rwflag, &txn_open_args->txn );
+
+	return (void *)(intptr_t)rc;
+}
+
+
+/*
+ * Attempt to reuse the thread's parked read-only transaction,
+ * renewing it against the most recent snapshot.  Returns true on
+ * success.
+ */
+int
+rmdbx_renew_txn( rmdbx_txn_state_t *state )
+{
+	if ( ! state->rtxn ) return 0;
+
+	if ( mdbx_txn_renew( state->rtxn ) != MDBX_SUCCESS ) {
+		mdbx_txn_abort( state->rtxn );
+		state->rtxn = NULL;
+		return 0;
+	}
+
+	state->txn  = state->rtxn;
+	state->rtxn = NULL;
+	return 1;
+}
+
+
+/*
+ * Open a new database transaction for the calling thread, and
+ * return it.  If a transaction is already open, it is returned
+ * as-is.
+ *
+ * +rwflag+ must be either MDBX_TXN_RDONLY or MDBX_TXN_READWRITE.
+ */
+MDBX_txn *
+rmdbx_open_txn( rmdbx_db_t *db, int rwflag )
+{
+	CHECK_HANDLE();
+
+	rmdbx_txn_state_t *state = rmdbx_txn_state( db );
+	if ( state->txn ) return state->txn;
+
+	uint64_t start = rmdbx_metrics_start( db );
+
+	/* Renewing a cached read transaction is cheap enough to do
+	   without releasing the GVL. */
+	if ( rwflag == MDBX_TXN_RDONLY && db->settings.txn_cache ) {
+		if ( rmdbx_renew_txn( state ) ) {
+			db->counters.txn_cache_hits++;
+			goto open_dbi;
+		}
+		db->counters.txn_cache_misses++;
+	}
+
+	struct txn_open_args_s txn_open_args;
+	txn_open_args.db = db;
+	txn_open_args.txn = NULL;
+	txn_open_args.rwflag = rwflag;
+
+	void *result_ptr = rmdbx_db_without_gvl( db, rmdbx_open_txn_without_gvl, (void *)&txn_open_args );
+	int rc = (int)(intptr_t)result_ptr;
+
+	if ( rc != MDBX_SUCCESS )
+		rb_raise( rmdbx_eDatabaseError, "mdbx_txn_begin: (%d) %s", rc, mdbx_strerror(rc) );
+
+	/* The handle may have been closed while the transaction began. */
+	if ( ! db->state.open ) {
+		mdbx_txn_abort( txn_open_args.txn );
+		rb_raise( rmdbx_eDatabaseError, "Closed database." );
+	}
+	state->txn = txn_open_args.txn;
+
+open_dbi:
+	rmdbx_metrics_finish( db, RMDBX_OP_TXN_BEGIN, start, 1 );
+
+	if ( db->dbi == 0 ) {
+		int rc = mdbx_dbi_open( state->txn, db->subdb, db->settings.db_flags, &db->dbi );
+		if ( rc != MDBX_SUCCESS ) {
+			rmdbx_close_txn( db, RMDBX_TXN_ROLLBACK );
+			rb_raise( rmdbx_eDatabaseError, "mdbx_dbi_open: (%d) %s", rc, mdbx_strerror(rc) );
+		}
+		rmdbx_cache_dbi( db );
+	}
+
+	return state->txn;
+}
+
+
+/*
+ * Close the calling thread's database transaction. If there is no
+ * active transaction, this is a no-op.  If there is a long
+ * running transaction open, this is a no-op.
+ *
+ * When the read transaction cache is enabled, a read-only
+ * transaction is reset and parked for reuse rather than aborted.
+ *
+ * +txnflag must either be RMDBX_TXN_ROLLBACK or RMDBX_TXN_COMMIT.
+ */
+void
+rmdbx_close_txn( rmdbx_db_t *db, int txnflag )
+{
+	st_data_t ptr;
+	if ( ! db->txns || ! st_lookup( db->txns, (st_data_t)rb_thread_current(), &ptr ) ) return;
+
+	rmdbx_txn_state_t *state = (rmdbx_txn_state_t *)ptr;
+	if ( ! state->txn || state->retain_txn > -1 ) return;
+
+	rmdbx_close_cursors( state );
+
+	/*
+	 * Ending the outermost transaction ends any savepoints still
+	 * open within it too -- committing them, or discarding them.
+	 */
+	if ( state->depth ) {
+		state->txn   = state->parents[0];
+		state->depth = 0;
+	}
+
+	if ( db->settings.txn_cache && ! state->rtxn &&
+		 ( mdbx_txn_flags(state->txn) & MDBX_TXN_RDONLY ) &&
+		 mdbx_txn_reset( state->txn ) == MDBX_SUCCESS ) {
+		state->rtxn = state->txn;
+	}
+	else if ( txnflag == RMDBX_TXN_COMMIT ) {
+		/* Commits may fsync, so don't hold up other threads. */
+		rmdbx_timed_without_gvl( db, RMDBX_OP_COMMIT, rmdbx_commit_without_gvl, (void *)state->txn );
+	}
+	else {
+		mdbx_txn_abort( state->txn );
+	}
+
+	state->txn = 0;
+	return;
+}
+
+
+/*
+ * call-seq:
+ *    db.open_transaction( mode )
+ *
+ * Open a new long-running transaction.  If +mode+ is true,
+ * it is opened read/write.
+ *
+ */
+VALUE
+rmdbx_rb_opentxn( VALUE self, VALUE mode )
+{
+	UNWRAP_DB( self, db );
+	CHECK_HANDLE();
+
+	rmdbx_open_txn( db, RTEST(mode) ? MDBX_TXN_READWRITE : MDBX_TXN_RDONLY );
+	rmdbx_txn_state( db )->retain_txn = RTEST(mode) ? 1 : 0;
+
+	return Qtrue;
+}
+
+
+/*
+ * call-seq:
+ *    db.close_transaction( mode )
+ *
+ * Close a long-running transaction.  If +write+ is true,
+ * the transaction is committed.  Otherwise, rolled back.
+ *
+ */
+VALUE
+rmdbx_rb_closetxn( VALUE self, VALUE write )
+{
+	UNWRAP_DB( self, db );
+
+	if ( ! rmdbx_current_txn(db) ) return Qtrue;
+
+	rmdbx_txn_state( db )->retain_txn = -1;
+	rmdbx_close_txn( db, RTEST(write) ? RMDBX_TXN_COMMIT : RMDBX_TXN_ROLLBACK );
+
+	return Qtrue;
+}
+
+
+/*
+ * call-seq:
+ *    db.open_savepoint
+ *
+ * Open a savepoint within the calling thread's read/write
+ * transaction: a child transaction whose changes can be discarded
+ * without losing those already made by its parent.  Until it's
+ * closed, all reads and writes go through the savepoint.
+ *
  */
 VALUE
-rmdbx_get_subdb( VALUE self )
+rmdbx_rb_open_savepoint( VALUE self )
 {
 	UNWRAP_DB( self, db );
-	return ( db->subdb == NULL ) ? Qnil : rb_str_new_cstr( db->subdb );
+	CHECK_HANDLE();
+
+	rmdbx_txn_state_t *state = rmdbx_txn_state( db );
+	if ( ! state->txn || state->retain_txn != 1 )
+		rb_raise( rmdbx_eDatabaseError, "Unable to open savepoint: no read/write transaction open." );
+
+	MDBX_txn *child;
+	int rc = mdbx_txn_begin( db->env, state->txn, MDBX_TXN_READWRITE, &child );
+	if ( rc != MDBX_SUCCESS )
+		rb_raise( rmdbx_eDatabaseError, "Unable to open savepoint: (%d) %s", rc, mdbx_strerror(rc) );
+
+	if ( state->depth == state->depth_capa ) {
+		state->depth_capa = state->depth_capa ? state->depth_capa * 2 : 4;
+		REALLOC_N( state->parents, MDBX_txn *, state->depth_capa );
+	}
+
+	/* The parent can't be used while the child is open, nor can its cursors. */
+	rmdbx_close_cursors( state );
+	state->parents[ state->depth++ ] = state->txn;
+	state->txn = child;
+
+	return Qtrue;
 }
 
 
 /*
- * Sets the current collection name for read/write operations.
+ * call-seq:
+ *    db.close_savepoint( commit ) => true or false
+ *
+ * Close the innermost savepoint.  If +commit+ is true, its changes
+ * are merged into the enclosing transaction.  Otherwise, they're
+ * discarded.  Returns false if no savepoint was open (the block
+ * ended the whole transaction, for example.)
  *
  */
 VALUE
-rmdbx_set_subdb( VALUE self, VALUE name )
+rmdbx_rb_close_savepoint( VALUE self, VALUE commit )
 {
 	UNWRAP_DB( self, db );
 
-	/* Provide a friendlier error message if max_collections is 0. */
-	if ( db->settings.max_collections == 0 )
-		rb_raise( rmdbx_eDatabaseError, "Unable to change collection: collections are not enabled." );
+	if ( ! db->state.open ) return Qfalse;
 
-	/* All transactions must be closed when switching database handles. */
-	if ( db->txn )
-		rb_raise( rmdbx_eDatabaseError, "Unable to change collection: transaction open" );
+	rmdbx_txn_state_t *state = rmdbx_txn_state( db );
+	if ( ! state->depth ) return Qfalse;
 
-	xfree( db->subdb );
-	db->subdb = NULL;
+	MDBX_txn *child = state->txn;
+	int rc = MDBX_SUCCESS;
 
-	if ( ! NIL_P(name) ) {
-		size_t len = RSTRING_LEN( name ) + 1;
-		db->subdb = malloc( len );
-		strlcpy( db->subdb, StringValuePtr(name), len );
-		rmdbx_log_obj( self, "debug", "setting subdb: %s", RSTRING_PTR(name) );
+	rmdbx_close_cursors( state );
+	state->txn = state->parents[ --state->depth ];
+
+	/* Merging into the parent doesn't touch the disk. */
+	if ( RTEST(commit) ) {
+		rc = mdbx_txn_commit( child );
 	}
 	else {
-		rmdbx_log_obj( self, "debug", "clearing subdb" );
+		mdbx_txn_abort( child );
 	}
 
-	/* Reset the db handle and issue a single transaction to reify
-	   the collection.
-	*/
-	rmdbx_close_dbi( db );
-	rmdbx_open_txn( db, MDBX_TXN_READWRITE );
-	rmdbx_close_txn( db, RMDBX_TXN_COMMIT );
+	if ( rc != MDBX_SUCCESS )
+		rb_raise( rmdbx_eDatabaseError, "Unable to commit savepoint: (%d) %s", rc, mdbx_strerror(rc) );
 
-	return self;
+	return Qtrue;
 }
 
 
 /*
- * call-seq:
- *    db.in_transaction? => false
- *
- * Predicate: return true if a transaction (or snapshot)
- * is currently open.
+ * Open a cursor for iteration within the calling thread's
+ * transaction.
  */
-VALUE
-rmdbx_in_transaction_p( VALUE self )
+MDBX_cursor *
+rmdbx_open_cursor( rmdbx_db_t *db )
 {
-	UNWRAP_DB( self, db );
-	return db->txn ? Qtrue : Qfalse;
-}
+	CHECK_HANDLE();
+	CHECK_TXN();
 
+	rmdbx_txn_state_t *state = rmdbx_txn_state( db );
+	int rc = mdbx_cursor_open( state->txn, db->dbi, &state->cursor );
+	if ( rc != MDBX_SUCCESS ) {
+		state->cursor = NULL;
+		rb_raise( rmdbx_eDatabaseError, "Unable to open cursor: (%d) %s", rc, mdbx_strerror(rc) );
+	}
 
-/* Inline struct for transaction arguments, passed as a void pointer. */
-struct txn_open_args_s {
-	rmdbx_db_t *db;
-	int rwflag;
-};
+	return state->cursor;
+}
 
 
-/* Opens a transaction outside of the GVL. */
-void *
-rmdbx_open_txn_without_gvl( void *ptr )
+/*
+ * Close the calling thread's iteration cursor.
+ */
+void
+rmdbx_close_cursor( rmdbx_db_t *db )
 {
-	struct txn_open_args_s *txn_open_args = (struct txn_open_args_s *)ptr;
+	rmdbx_txn_state_t *state = rmdbx_txn_state( db );
+	if ( ! state->cursor ) return;
 
-	rmdbx_db_t *db = txn_open_args->db;
-	int rc = mdbx_txn_begin( db->env, NULL, txn_open_args->rwflag, &db->txn );
+	mdbx_cursor_close( state->cursor );
+	state->cursor = NULL;
+	return;
+}
+
+
+/*
+ * Compare two keys in mdbx's default (lexicographic) order.
+ */
+int
+rmdbx_key_cmp( const MDBX_val *a, const MDBX_val *b )
+{
+	size_t len = a->iov_len < b->iov_len ? a->iov_len : b->iov_len;
+	int diff   = len ? memcmp( a->iov_base, b->iov_base, len ) : 0;
 
-	return (void *)rc;
+	if ( diff ) return diff;
+	return ( a->iov_len > b->iov_len ) - ( a->iov_len < b->iov_len );
 }
 
 
 /*
- * Open a new database transaction.  If a transaction is already
- * open, this is a no-op.
+ * Return where +key+ sits relative to the scan's bounds, in the
+ * direction of travel: negative if the range hasn't been reached
+ * yet, zero if within it, and positive if it has been passed.
+ * Unset bounds have a NULL iov_base.
  *
- * +rwflag+ must be either MDBX_TXN_RDONLY or MDBX_TXN_READWRITE.
+ * Bounds are compared in the collection's own key order, which
+ * differs from rmdbx_key_cmp() for integer or reversed keys.
+ * Prefixes are only allowed for lexicographically ordered keys.
  */
-void
-rmdbx_open_txn( rmdbx_db_t *db, int rwflag )
+int
+rmdbx_scan_position( struct scan_args_s *args, const MDBX_val *key )
 {
-	if ( db->txn ) return;
+	MDBX_txn *txn = mdbx_cursor_txn( args->cursor );
+	MDBX_dbi dbi  = mdbx_cursor_dbi( args->cursor );
+	int pos = 0;
 
-	struct txn_open_args_s txn_open_args;
-	txn_open_args.db = db;
-	txn_open_args.rwflag = rwflag;
+	if ( args->from.iov_base && mdbx_cmp( txn, dbi, key, &args->from ) < 0 ) {
+		pos = -1;
+	}
+	else if ( args->to.iov_base && mdbx_cmp( txn, dbi, key, &args->to ) > 0 ) {
+		pos = 1;
+	}
+	else if ( args->prefix.iov_base ) {
+		if ( key->iov_len >= args->prefix.iov_len &&
+			 memcmp( key->iov_base, args->prefix.iov_base, args->prefix.iov_len ) == 0 ) {
+			pos = 0;
+		}
+		else {
+			pos = rmdbx_key_cmp( key, &args->prefix ) < 0 ? -1 : 1;
+		}
+	}
 
-	void *result_ptr = rb_thread_call_without_gvl(
-		rmdbx_open_txn_without_gvl, (void *)&txn_open_args,
-		RUBY_UBF_IO, NULL
-	);
+	return args->reverse ? -pos : pos;
+}
 
-	int rc = (int)result_ptr;
 
-	if ( rc != MDBX_SUCCESS ) {
-		rmdbx_close_all( db );
-		rb_raise( rmdbx_eDatabaseError, "mdbx_txn_begin: (%d) %s", rc, mdbx_strerror(rc) );
-	}
+/*
+ * Step the cursor, collecting pointers to up to +limit+ keys and
+ * values that fall within the scan's bounds.  The scan ends (with
+ * MDBX_NOTFOUND) as soon as a key passes the end of the range.
+ */
+void *
+rmdbx_scan_without_gvl( void *ptr )
+{
+	struct scan_args_s *args = (struct scan_args_s *)ptr;
+	MDBX_val key, data;
 
-	if ( db->dbi == 0 ) {
-		rc = mdbx_dbi_open( db->txn, db->subdb, db->settings.db_flags, &db->dbi );
-		if ( rc != MDBX_SUCCESS ) {
-			rmdbx_close_all( db );
-			rb_raise( rmdbx_eDatabaseError, "mdbx_dbi_open: (%d) %s", rc, mdbx_strerror(rc) );
+	for ( args->count = 0; args->count < args->limit; ) {
+		if ( args->op == MDBX_SET_RANGE ) {
+			key = args->seek;
+			args->rc = mdbx_cursor_get( args->cursor, &key, &data, MDBX_SET_RANGE );
+
+			/* Seeking past the last key in reverse starts from the end. */
+			if ( args->rc == MDBX_NOTFOUND && args->reverse )
+				args->rc = mdbx_cursor_get( args->cursor, &key, &data, MDBX_LAST );
+		}
+		else {
+			args->rc = mdbx_cursor_get( args->cursor, &key, &data, args->op );
+		}
+
+		if ( args->rc != MDBX_SUCCESS ) break;
+		args->op = args->reverse ? MDBX_PREV : MDBX_NEXT;
+
+		int pos = rmdbx_scan_position( args, &key );
+		if ( pos < 0 ) continue;
+		if ( pos > 0 ) {
+			args->rc = MDBX_NOTFOUND;
+			break;
 		}
+
+		args->keys[ args->count ] = key;
+		args->vals[ args->count ] = data;
+		args->count++;
 	}
 
-	return;
+	return NULL;
 }
 
 
 /*
- * Close any existing database transaction. If there is no
- * active transaction, this is a no-op.  If there is a long
- * running transaction open, this is a no-op.
- *
- * +txnflag must either be RMDBX_TXN_ROLLBACK or RMDBX_TXN_COMMIT.
+ * Run a cursor +scan+ for +db+, without the GVL if +nogvl+ is true,
+ * counting each entry collected as a cursor step.
  */
 void
-rmdbx_close_txn( rmdbx_db_t *db, int txnflag )
+rmdbx_scan( rmdbx_db_t *db, struct scan_args_s *scan, int nogvl )
 {
-	if ( ! db->txn || db->state.retain_txn > -1 ) return;
+	uint64_t start = rmdbx_metrics_start( db );
 
-	if ( txnflag == RMDBX_TXN_COMMIT ) {
-		mdbx_txn_commit( db->txn );
+	if ( nogvl ) {
+		rmdbx_db_without_gvl( db, rmdbx_scan_without_gvl, (void *)scan );
 	}
 	else {
-		mdbx_txn_abort( db->txn );
+		rmdbx_scan_without_gvl( (void *)scan );
 	}
 
-	db->txn = 0;
-	return;
+	if ( ! start ) return;
+	rmdbx_metrics_finish( db, RMDBX_OP_CURSOR_STEP, start, scan->count );
+	for ( int i = 0; i < scan->count; i++ )
+		rmdbx_metrics_bytes( db, scan->keys[i].iov_len + scan->vals[i].iov_len, 0 );
 }
 
 
+/* What an each_* iterator yields. */
+#define RMDBX_EACH_KEY   0
+#define RMDBX_EACH_VALUE 1
+#define RMDBX_EACH_PAIR  2
+#define RMDBX_EACH_SLICE 3
+
+/* Inline struct for iteration arguments, passed as a void pointer. */
+struct each_args_s {
+	VALUE self;
+	rmdbx_db_t *db;
+	int mode;
+	long limit;
+	long slice;
+	int raw;
+	struct scan_args_s scan;
+};
+
+
 /*
- * call-seq:
- *    db.open_transaction( mode )
- *
- * Open a new long-running transaction.  If +mode+ is true,
- * it is opened read/write.
- *
+ * Stage a range option +name+ from +opts+ into +val+, returning
+ * the (frozen) key String, or Qnil if the option isn't set.
  */
 VALUE
-rmdbx_rb_opentxn( VALUE self, VALUE mode )
+rmdbx_range_opt( rmdbx_db_t *db, VALUE opts, const char *name, MDBX_val *val )
 {
-	UNWRAP_DB( self, db );
-	CHECK_HANDLE();
+	VALUE opt = rb_hash_delete( opts, ID2SYM( rb_intern(name) ) );
 
-	rmdbx_open_txn( db, RTEST(mode) ? MDBX_TXN_READWRITE : MDBX_TXN_RDONLY );
-	db->state.retain_txn = RTEST(mode) ? 1 : 0;
+	val->iov_base = NULL;
+	val->iov_len  = 0;
+	if ( NIL_P(opt) ) return Qnil;
 
-	return Qtrue;
+	return rmdbx_key_for( db, opt, val );
 }
 
 
 /*
- * call-seq:
- *    db.close_transaction( mode )
- *
- * Close a long-running transaction.  If +write+ is true,
- * the transaction is committed.  Otherwise, rolled back.
+ * Parse iteration options into +args+, returning an Array of
+ * Strings that +args+ points into.
  *
+ * A reverse scan seeks to the first key after the range, and the
+ * scan steps back into it from there.  For a +prefix+ that's the
+ * prefix with its last byte incremented (dropping trailing 0xff
+ * bytes); a prefix of only 0xff bytes scans from the end.
  */
 VALUE
-rmdbx_rb_closetxn( VALUE self, VALUE write )
+rmdbx_each_opts( VALUE opts, struct each_args_s *args )
 {
-	UNWRAP_DB( self, db );
+	struct scan_args_s *scan = &args->scan;
+	VALUE held = rb_ary_new();
+	VALUE opt;
 
-	db->state.retain_txn = -1;
-	rmdbx_close_txn( db, RTEST(write) ? RMDBX_TXN_COMMIT : RMDBX_TXN_ROLLBACK );
+	opts = NIL_P(opts) ? rb_hash_new() : rb_hash_dup( opts );
 
-	return Qtrue;
+	rb_ary_push( held, rmdbx_range_opt( args->db, opts, "from", &scan->from ) );
+	rb_ary_push( held, rmdbx_range_opt( args->db, opts, "to", &scan->to ) );
+	rb_ary_push( held, rmdbx_range_opt( args->db, opts, "prefix", &scan->prefix ) );
+	if ( scan->prefix.iov_len == 0 ) scan->prefix.iov_base = NULL;
+	if ( scan->prefix.iov_base && ( args->db->settings.db_flags & (MDBX_INTEGERKEY | MDBX_REVERSEKEY) ) )
+		rb_raise( rb_eArgError, "prefix isn't supported with integer or reversed keys" );
+
+	opt = rb_hash_delete( opts, ID2SYM( rb_intern("limit") ) );
+	args->limit = NIL_P(opt) ? -1 : NUM2LONG( opt );
+	if ( args->limit < -1 ) rb_raise( rb_eArgError, "limit must not be negative" );
+
+	opt = rb_hash_delete( opts, ID2SYM( rb_intern("reverse") ) );
+	scan->reverse = RTEST( opt );
+
+	if ( rb_hash_size_num(opts) > 0 ) {
+		rb_raise( rb_eArgError, "Unknown option(s): %"PRIsVALUE, opts );
+	}
+
+	scan->seek.iov_base = NULL;
+	scan->seek.iov_len  = 0;
+
+	if ( ! scan->reverse ) {
+		/* Seek to the greater of the lower bounds. */
+		if ( scan->from.iov_base ) scan->seek = scan->from;
+		if ( scan->prefix.iov_base &&
+			 ( ! scan->seek.iov_base || rmdbx_key_cmp( &scan->prefix, &scan->seek ) > 0 ) ) {
+			scan->seek = scan->prefix;
+		}
+	}
+	else {
+		/* Seek to the lesser of the upper bounds. */
+		if ( scan->to.iov_base ) scan->seek = scan->to;
+		if ( scan->prefix.iov_base ) {
+			VALUE next = rb_str_new( scan->prefix.iov_base, scan->prefix.iov_len );
+			unsigned char *ptr = (unsigned char *)RSTRING_PTR( next );
+			long len = RSTRING_LEN( next );
+
+			while ( len > 0 && ptr[ len - 1 ] == 0xff ) len--;
+			if ( len > 0 ) {
+				ptr[ len - 1 ]++;
+				rb_str_set_len( next, len );
+				rb_ary_push( held, next );
+
+				MDBX_val after = { RSTRING_PTR(next), len };
+				if ( ! scan->seek.iov_base || rmdbx_key_cmp( &after, &scan->seek ) < 0 )
+					scan->seek = after;
+			}
+		}
+	}
+
+	if ( scan->seek.iov_base ) {
+		scan->op = MDBX_SET_RANGE;
+	}
+	else {
+		scan->op = scan->reverse ? MDBX_LAST : MDBX_FIRST;
+	}
+
+	return held;
 }
 
 
 /*
- * Open a cursor for iteration.
+ * Enumerate over the current collection.
+ *
+ * Within a snapshot, entries are collected in batches without
+ * the GVL -- the pointers remain valid until the snapshot closes.
+ * A read/write transaction may move pages when the block writes,
+ * so each entry is copied out before yielding it.
  */
-void
-rmdbx_open_cursor( rmdbx_db_t *db )
+VALUE
+rmdbx_each_i( VALUE argp )
 {
-	CHECK_HANDLE();
-	if ( ! db->txn ) rb_raise( rmdbx_eDatabaseError, "No snapshot or transaction currently open." );
+	struct each_args_s *each = (struct each_args_s *)argp;
+	struct scan_args_s *scan = &each->scan;
+	rmdbx_db_t *db = each->db;
+	rmdbx_txn_state_t *state = rmdbx_txn_state( db );
+	MDBX_txn *txn  = state->txn;
+	uint64_t txnid = mdbx_txn_id( txn );
+	int readonly   = mdbx_txn_flags( txn ) & MDBX_TXN_RDONLY;
+	long remaining = each->limit;
+
+	scan->cursor = state->cursor;
+
+	while ( remaining != 0 ) {
+		scan->limit = readonly ? RMDBX_SCAN_BATCH : 1;
+		if ( remaining > 0 && remaining < scan->limit ) scan->limit = (int)remaining;
+
+		rmdbx_scan( db, scan, readonly );
+
+		for ( int i = 0; i < scan->count; i++ ) {
+			/* Stop if the block closed the transaction out from under us. */
+			if ( ! db->state.open || state->txn != txn || mdbx_txn_id(txn) != txnid ) return Qnil;
+
+			VALUE rkey = Qnil, rval = Qnil;
+			if ( each->mode != RMDBX_EACH_VALUE )
+				rkey = rmdbx_key_str( db, &scan->keys[i] );
+			if ( each->mode != RMDBX_EACH_KEY ) {
+				rval = rmdbx_load_val( each->self, db, &scan->vals[i] );
+			}
+
+			switch ( each->mode ) {
+				case RMDBX_EACH_KEY:
+					rb_yield( rkey );
+					break;
+				case RMDBX_EACH_VALUE:
+					rb_yield( rval );
+					break;
+				default:
+					rb_yield( rb_assoc_new( rkey, rval ) );
+			}
+		}
 
-	int rc = mdbx_cursor_open( db->txn, db->dbi, &db->cursor );
-	if ( rc != MDBX_SUCCESS ) {
-		rmdbx_close_all( db );
-		rb_raise( rmdbx_eDatabaseError, "Unable to open cursor: (%d) %s", rc, mdbx_strerror(rc) );
+		if ( remaining > 0 ) remaining -= scan->count;
+		if ( scan->rc != MDBX_SUCCESS ) break;
 	}
 
-	return;
+	return Qnil;
 }
 
 
 /*
- * Enumerate over keys for the current collection.
+ * Enumerate over the current collection in slices, yielding an
+ * Array of keys and an Array of their values for every +slice+
+ * entries.  Each scan batch is copied out before any values are
+ * deserialized, so a slice costs a single yield into Ruby.
  */
 VALUE
-rmdbx_each_key_i( VALUE self )
+rmdbx_each_slice_i( VALUE argp )
 {
-	UNWRAP_DB( self, db );
-	MDBX_val key, data;
+	struct each_args_s *each = (struct each_args_s *)argp;
+	struct scan_args_s *scan = &each->scan;
+	rmdbx_db_t *db = each->db;
+	rmdbx_txn_state_t *state = rmdbx_txn_state( db );
+	MDBX_txn *txn  = state->txn;
+	uint64_t txnid = mdbx_txn_id( txn );
+	int readonly   = mdbx_txn_flags( txn ) & MDBX_TXN_RDONLY;
+	long remaining = each->limit;
+	VALUE keys = rb_ary_new_capa( each->slice );
+	VALUE vals = rb_ary_new_capa( each->slice );
+
+	/* MessagePack is decoded in place, as it can't run Ruby code. */
+	int decoded = ! each->raw && db->settings.serializer == RMDBX_SERIALIZE_MSGPACK;
+
+	scan->cursor = state->cursor;
+	scan->rc     = MDBX_SUCCESS;
+
+	while ( remaining != 0 && scan->rc == MDBX_SUCCESS ) {
+		/* Stop if the block closed the transaction out from under us. */
+		if ( ! db->state.open || state->txn != txn || mdbx_txn_id(txn) != txnid ) return Qnil;
+
+		long wanted = each->slice - RARRAY_LEN( keys );
+		if ( remaining > 0 && remaining < wanted ) wanted = remaining;
+		scan->limit = wanted < RMDBX_SCAN_BATCH ? (int)wanted : RMDBX_SCAN_BATCH;
+		if ( ! readonly ) scan->limit = 1;
+
+		rmdbx_scan( db, scan, readonly );
+
+		for ( int i = 0; i < scan->count; i++ ) {
+			rb_ary_push( keys, rmdbx_key_str( db, &scan->keys[i] ) );
+			rb_ary_push( vals, decoded ?
+				rmdbx_load_val( each->self, db, &scan->vals[i] ) :
+				rmdbx_stored_str( each->self, db, &scan->vals[i] ) );
+		}
+		if ( remaining > 0 ) remaining -= scan->count;
 
-	if ( mdbx_cursor_get( db->cursor, &key, &data, MDBX_FIRST ) == MDBX_SUCCESS ) {
-		rb_yield( rb_str_new( key.iov_base, key.iov_len ) );
-		while ( mdbx_cursor_get( db->cursor, &key, &data, MDBX_NEXT ) == MDBX_SUCCESS ) {
-			rb_yield( rb_str_new( key.iov_base, key.iov_len ) );
+		long len = RARRAY_LEN( keys );
+		if ( len == 0 || ( len < each->slice && remaining != 0 && scan->rc == MDBX_SUCCESS ) ) continue;
+
+		if ( ! each->raw && ! decoded ) {
+			for ( long i = 0; i < len; i++ )
+				RARRAY_ASET( vals, i, rmdbx_deserialize( each->self, db, RARRAY_AREF(vals, i) ) );
 		}
+		rb_yield_values( 2, keys, vals );
+
+		keys = rb_ary_new_capa( each->slice );
+		vals = rb_ary_new_capa( each->slice );
 	}
 
-	return self;
+	return Qnil;
 }
 
 
-/* call-seq:
- *    db.each_key {|key| block } => self
- *
- * Calls the block once for each key, returning self.
- * A transaction must be opened prior to use.
+/*
+ * Open a cursor and iterate over the current collection with
+ * +args+, closing the cursor afterwards.
  */
 VALUE
-rmdbx_each_key( VALUE self )
+rmdbx_each_run( struct each_args_s *args, VALUE opts )
 {
-	UNWRAP_DB( self, db );
+	rmdbx_db_t *db = args->db;
+	VALUE held = rmdbx_each_opts( opts, args );
 	int state;
 
-	CHECK_HANDLE();
 	rmdbx_open_cursor( db );
-	RETURN_ENUMERATOR( self, 0, 0 );
 
-	rb_protect( rmdbx_each_key_i, self, &state );
+	if ( args->mode == RMDBX_EACH_SLICE ) {
+		rb_protect( rmdbx_each_slice_i, (VALUE)args, &state );
+	}
+	else {
+		rb_protect( rmdbx_each_i, (VALUE)args, &state );
+	}
 
-	mdbx_cursor_close( db->cursor );
-	db->cursor = NULL;
+	if ( db->state.open ) rmdbx_close_cursor( db );
+	RB_GC_GUARD( held );
 
 	if ( state ) rb_jump_tag( state );
 
-	return self;
+	return args->self;
 }
 
 
-/* Enumerate over values for the current collection.
+/*
+ * Parse iteration options, and iterate with +mode+.
  */
 VALUE
-rmdbx_each_value_i( VALUE self )
+rmdbx_each( int argc, VALUE *argv, VALUE self, int mode )
 {
 	UNWRAP_DB( self, db );
-	MDBX_val key, data;
+	struct each_args_s args;
+	VALUE opts;
 
-	if ( mdbx_cursor_get( db->cursor, &key, &data, MDBX_FIRST ) == MDBX_SUCCESS ) {
-		VALUE rv = rb_str_new( data.iov_base, data.iov_len );
-		rb_yield( rb_funcall( self, rb_intern("deserialize"), 1, rv ) );
+	rb_scan_args( argc, argv, "0:", &opts );
 
-		while ( mdbx_cursor_get( db->cursor, &key, &data, MDBX_NEXT ) == MDBX_SUCCESS ) {
-			rv = rb_str_new( data.iov_base, data.iov_len );
-			rb_yield( rb_funcall( self, rb_intern("deserialize"), 1, rv ) );
-		}
-	}
+	args.self = self;
+	args.db   = db;
+	args.mode = mode;
 
-	return self;
+	return rmdbx_each_run( &args, opts );
 }
 
 
 /* call-seq:
- *    db.each_value {|value| block } => self
+ *    db.each_key {|key| block } => self
+ *    db.each_key( from: nil, to: nil, prefix: nil, reverse: false, limit: nil ) {|key| block } => self
  *
- * Calls the block once for each value, returning self.
+ * Calls the block once for each key, returning self.
  * A transaction must be opened prior to use.
+ *
+ * Iteration can be restricted to keys between +from+ and +to+
+ * (inclusive), and/or starting with +prefix+.  The cursor seeks
+ * directly to the start of the range and stops as soon as it is
+ * left, so cost is proportional to the number of keys yielded.
+ * +reverse+ walks the range from the end, and +limit+ stops after
+ * that many keys.
  */
 VALUE
-rmdbx_each_value( VALUE self )
+rmdbx_each_key( int argc, VALUE *argv, VALUE self )
 {
 	UNWRAP_DB( self, db );
-	int state;
 
 	CHECK_HANDLE();
-	rmdbx_open_cursor( db );
-	RETURN_ENUMERATOR( self, 0, 0 );
+	CHECK_TXN();
+	RETURN_ENUMERATOR( self, argc, argv );
 
-	rb_protect( rmdbx_each_value_i, self, &state );
+	return rmdbx_each( argc, argv, self, RMDBX_EACH_KEY );
+}
 
-	mdbx_cursor_close( db->cursor );
-	db->cursor = NULL;
 
-	if ( state ) rb_jump_tag( state );
+/* call-seq:
+ *    db.each_value {|value| block } => self
+ *    db.each_value( from: nil, to: nil, prefix: nil, reverse: false, limit: nil ) {|value| block } => self
+ *
+ * Calls the block once for each value, returning self.
+ * A transaction must be opened prior to use.  Options are as
+ * for #each_key.
+ */
+VALUE
+rmdbx_each_value( int argc, VALUE *argv, VALUE self )
+{
+	UNWRAP_DB( self, db );
 
-	return self;
+	CHECK_HANDLE();
+	CHECK_TXN();
+	RETURN_ENUMERATOR( self, argc, argv );
+
+	return rmdbx_each( argc, argv, self, RMDBX_EACH_VALUE );
 }
 
 
-/* Enumerate over key and value pairs for the current collection.
+/* call-seq:
+ *    db.each_pair {|key, value| block } => self
+ *    db.each_pair( from: nil, to: nil, prefix: nil, reverse: false, limit: nil ) {|key, value| block } => self
+ *
+ * Calls the block once for each key and value, returning self.
+ * A transaction must be opened prior to use.  Options are as
+ * for #each_key.
+ *
+ *    db.each_pair( from: 'events:2026-10-01', to: 'events:2026-10-02' ) {|k, v| ... }
+ *    db.each_pair( prefix: 'users:', reverse: true, limit: 10 ) {|k, v| ... }
  */
 VALUE
-rmdbx_each_pair_i( VALUE self )
+rmdbx_each_pair( int argc, VALUE *argv, VALUE self )
 {
 	UNWRAP_DB( self, db );
-	MDBX_val key, data;
-
-	if ( mdbx_cursor_get( db->cursor, &key, &data, MDBX_FIRST ) == MDBX_SUCCESS ) {
-		VALUE rkey = rb_str_new( key.iov_base, key.iov_len );
-		VALUE rval = rb_str_new( data.iov_base, data.iov_len );
-		rval = rb_funcall( self, rb_intern("deserialize"), 1, rval );
-		rb_yield( rb_assoc_new( rkey, rval  ) );
 
-		while ( mdbx_cursor_get( db->cursor, &key, &data, MDBX_NEXT ) == MDBX_SUCCESS ) {
-			rkey = rb_str_new( key.iov_base, key.iov_len );
-			rval = rb_str_new( data.iov_base, data.iov_len );
-			rval = rb_funcall( self, rb_intern("deserialize"), 1, rval );
-
-			rb_yield( rb_assoc_new( rkey, rval ) );
-		}
-	}
+	CHECK_HANDLE();
+	CHECK_TXN();
+	RETURN_ENUMERATOR( self, argc, argv );
 
-	return self;
+	return rmdbx_each( argc, argv, self, RMDBX_EACH_PAIR );
 }
 
 
 /* call-seq:
- *    db.each_pair {|key, value| block } => self
+ *    db.each_slice_pairs( count ) {|keys, values| block } => self
+ *    db.each_slice_pairs( count, raw: false, from: nil, to: nil, prefix: nil, reverse: false, limit: nil ) {|keys, values| block } => self
  *
- * Calls the block once for each key and value, returning self.
- * A transaction must be opened prior to use.
+ * Calls the block once for every +count+ entries, with an Array of
+ * their keys and an Array of their values, returning self.  The
+ * final slice may be shorter.  A transaction must be opened prior
+ * to use.
+ *
+ * Entries are read from the cursor in batches, so a full table
+ * export costs one Ruby block call per slice rather than per entry.
+ * If +raw+ is true, values are returned serialized, without
+ * deserializing them.  Other options are as for #each_key.
+ *
+ *    db.each_slice_pairs( 1000, raw: true ) do |keys, values|
+ *        out.write( ... )
+ *    end
  */
 VALUE
-rmdbx_each_pair( VALUE self )
+rmdbx_each_slice_pairs( int argc, VALUE *argv, VALUE self )
 {
 	UNWRAP_DB( self, db );
-	int state;
+	struct each_args_s args;
+	VALUE count, opts;
 
 	CHECK_HANDLE();
-	rmdbx_open_cursor( db );
-	RETURN_ENUMERATOR( self, 0, 0 );
+	CHECK_TXN();
+	RETURN_ENUMERATOR( self, argc, argv );
 
-	rb_protect( rmdbx_each_pair_i, self, &state );
+	rb_scan_args( argc, argv, "1:", &count, &opts );
 
-	mdbx_cursor_close( db->cursor );
-	db->cursor = NULL;
+	args.self  = self;
+	args.db    = db;
+	args.mode  = RMDBX_EACH_SLICE;
+	args.slice = NUM2LONG( count );
+	if ( args.slice < 1 ) rb_raise( rb_eArgError, "slice size must be positive" );
 
-	if ( state ) rb_jump_tag( state );
+	opts = NIL_P(opts) ? rb_hash_new() : rb_hash_dup( opts );
+	args.raw = RTEST( rb_hash_delete( opts, ID2SYM( rb_intern("raw") ) ) );
 
-	return self;
+	return rmdbx_each_run( &args, opts );
 }
 
 
@@ -790,18 +2552,42 @@ rmdbx_database_initialize( int argc, VALUE *argv, VALUE self )
 	UNWRAP_DB( self, db );
 	db->env    = NULL;
 	db->dbi    = 0;
-	db->txn    = NULL;
-	db->cursor = NULL;
+	db->txns   = st_init_numtable();
+	db->dbis   = st_init_strtable();
 	db->path   = StringValueCStr( path );
 	db->subdb  = NULL;
+	db->group  = NULL;
+	db->syncer = NULL;
+	db->metrics = NULL;
 	db->state.open       = 0;
-	db->state.retain_txn = -1;
 	db->settings.env_flags       = MDBX_ENV_DEFAULTS;
 	db->settings.db_flags        = MDBX_DB_DEFAULTS | MDBX_CREATE;
 	db->settings.mode            = 0644;
 	db->settings.max_collections = 0;
 	db->settings.max_readers     = 0;
 	db->settings.max_size        = 0;
+	db->settings.size_lower       = -1;
+	db->settings.size_now         = -1;
+	db->settings.growth_step      = -1;
+	db->settings.shrink_threshold = -1;
+	db->settings.page_size        = -1;
+	db->settings.txn_cache       = 0;
+	db->settings.serializer      = RMDBX_SERIALIZE_MARSHAL;
+	db->settings.compress        = RMDBX_COMPRESS_NONE;
+	db->settings.compress_min    = 512;
+	db->settings.group_commit         = 0;
+	db->settings.group_commit_size    = 1000;
+	db->settings.group_commit_latency = 0;
+	db->settings.sync_mode   = RMDBX_SYNC_DURABLE;
+	db->settings.sync_period = 0;
+	db->settings.sync_bytes  = 0;
+	db->counters.txn_cache_hits   = 0;
+	db->counters.txn_cache_misses = 0;
+	db->counters.compress_values       = 0;
+	db->counters.compress_compressed   = 0;
+	db->counters.compress_raw_bytes    = 0;
+	db->counters.compress_stored_bytes = 0;
+	db->counters.compress_dictionary   = 0;
 
 	/* Set instance variables.
 	 */
@@ -815,8 +2601,26 @@ rmdbx_database_initialize( int argc, VALUE *argv, VALUE self )
 		db->settings.db_flags  = db->settings.db_flags | MDBX_DB_ACCEDE;
 		db->settings.env_flags = db->settings.env_flags | MDBX_ACCEDE;
 	}
+	opt = rb_hash_delete( opts, ID2SYM( rb_intern("compress") ) );
+	rmdbx_set_compression( db, opt );
+	opt = rb_hash_delete( opts, ID2SYM( rb_intern("compress_min") ) );
+	if ( ! NIL_P(opt) ) db->settings.compress_min = NUM2LONG( opt );
+	opt = rb_hash_delete( opts, ID2SYM( rb_intern("dup_fixed") ) );
+	if ( RTEST(opt) ) db->settings.db_flags = db->settings.db_flags | MDBX_DUPSORT | MDBX_DUPFIXED;
+	opt = rb_hash_delete( opts, ID2SYM( rb_intern("dup_sort") ) );
+	if ( RTEST(opt) ) db->settings.db_flags = db->settings.db_flags | MDBX_DUPSORT;
 	opt = rb_hash_delete( opts, ID2SYM( rb_intern("exclusive") ) );
 	if ( RTEST(opt) ) db->settings.env_flags = db->settings.env_flags | MDBX_EXCLUSIVE;
+	opt = rb_hash_delete( opts, ID2SYM( rb_intern("group_commit") ) );
+	if ( RTEST(opt) ) db->settings.group_commit = 1;
+	opt = rb_hash_delete( opts, ID2SYM( rb_intern("group_commit_latency") ) );
+	if ( ! NIL_P(opt) ) db->settings.group_commit_latency = (long)( NUM2DBL(opt) * 1000000 );
+	opt = rb_hash_delete( opts, ID2SYM( rb_intern("group_commit_size") ) );
+	if ( ! NIL_P(opt) ) db->settings.group_commit_size = NUM2LONG( opt );
+	opt = rb_hash_delete( opts, ID2SYM( rb_intern("growth_step") ) );
+	db->settings.growth_step = rmdbx_geometry_opt( opt );
+	opt = rb_hash_delete( opts, ID2SYM( rb_intern("integer_keys") ) );
+	if ( RTEST(opt) ) db->settings.db_flags = db->settings.db_flags | MDBX_INTEGERKEY;
 	opt = rb_hash_delete( opts, ID2SYM( rb_intern("lifo_reclaim") ) );
 	if ( RTEST(opt) ) db->settings.env_flags = db->settings.env_flags | MDBX_LIFORECLAIM;
 	opt = rb_hash_delete( opts, ID2SYM( rb_intern("max_collections") ) );
@@ -842,8 +2646,30 @@ rmdbx_database_initialize( int argc, VALUE *argv, VALUE self )
 	opt = rb_hash_delete( opts, ID2SYM( rb_intern("no_threadlocal") ) );
 	if ( RTEST(opt) ) db->settings.env_flags = db->settings.env_flags | MDBX_NOTLS;
 #endif
+	opt = rb_hash_delete( opts, ID2SYM( rb_intern("operation_stats") ) );
+	if ( opt != Qfalse ) rmdbx_metrics_enable( db );
+	opt = rb_hash_delete( opts, ID2SYM( rb_intern("page_size") ) );
+	db->settings.page_size = rmdbx_geometry_opt( opt );
 	opt = rb_hash_delete( opts, ID2SYM( rb_intern("readonly") ) );
 	if ( RTEST(opt) ) db->settings.env_flags = db->settings.env_flags | MDBX_RDONLY;
+	opt = rb_hash_delete( opts, ID2SYM( rb_intern("reverse_keys") ) );
+	if ( RTEST(opt) ) db->settings.db_flags = db->settings.db_flags | MDBX_REVERSEKEY;
+	opt = rb_hash_delete( opts, ID2SYM( rb_intern("serializer") ) );
+	rmdbx_set_serializer_mode( self, NIL_P(opt) ? ID2SYM( rb_intern("marshal") ) : opt );
+	opt = rb_hash_delete( opts, ID2SYM( rb_intern("shrink_threshold") ) );
+	db->settings.shrink_threshold = rmdbx_geometry_opt( opt );
+	opt = rb_hash_delete( opts, ID2SYM( rb_intern("size_lower") ) );
+	db->settings.size_lower = rmdbx_geometry_opt( opt );
+	opt = rb_hash_delete( opts, ID2SYM( rb_intern("size_now") ) );
+	db->settings.size_now = rmdbx_geometry_opt( opt );
+	opt = rb_hash_delete( opts, ID2SYM( rb_intern("sync_bytes") ) );
+	if ( ! NIL_P(opt) ) db->settings.sync_bytes = NUM2LONG( opt );
+	opt = rb_hash_delete( opts, ID2SYM( rb_intern("sync_mode") ) );
+	rmdbx_set_sync_mode( db, opt );
+	opt = rb_hash_delete( opts, ID2SYM( rb_intern("sync_period") ) );
+	if ( ! NIL_P(opt) ) db->settings.sync_period = NUM2DBL( opt );
+	opt = rb_hash_delete( opts, ID2SYM( rb_intern("txn_cache") ) );
+	if ( RTEST(opt) ) db->settings.txn_cache = 1;
 	opt = rb_hash_delete( opts, ID2SYM( rb_intern("writemap") ) );
 	if ( RTEST(opt) ) db->settings.env_flags = db->settings.env_flags | MDBX_WRITEMAP;
 
@@ -851,11 +2677,97 @@ rmdbx_database_initialize( int argc, VALUE *argv, VALUE self )
 		rb_raise( rb_eArgError, "Unknown option(s): %"PRIsVALUE, opts );
 	}
 
+	/* Compressed values wouldn't sort, or be a fixed size. */
+	if ( (db->settings.db_flags & MDBX_DUPSORT) && db->settings.compress != RMDBX_COMPRESS_NONE )
+		rb_raise( rb_eArgError, "Compression isn't supported with dup_sort" );
+
+	if ( db->settings.group_commit_size < 1 || db->settings.group_commit_latency < 0 )
+		rb_raise( rb_eArgError, "group_commit_size must be positive, and group_commit_latency can't be negative" );
+	/* Sync thresholds only apply to periodic syncs, which sync every second by default. */
+	if ( db->settings.sync_mode == RMDBX_SYNC_PERIODIC ) {
+		if ( db->settings.sync_period <= 0 && db->settings.sync_bytes <= 0 ) db->settings.sync_period = 1;
+	}
+	else if ( db->settings.sync_period || db->settings.sync_bytes ) {
+		rb_raise( rb_eArgError, "sync_period and sync_bytes require sync_mode: :periodic" );
+	}
+	db->settings.env_flags = db->settings.env_flags | rmdbx_sync_env_flags( db );
+
+#ifndef HAVE_PTHREAD_H
+	if ( db->settings.group_commit )
+		rb_raise( rb_eArgError, "Group commit isn't supported on this platform" );
+#endif
+
 	rmdbx_open_env( self );
 	return self;
 }
 
 
+/* Inline struct for map geometry arguments, passed as a void pointer. */
+struct geometry_args_s {
+	MDBX_env *env;
+	intptr_t lower;
+	intptr_t now;
+	intptr_t upper;
+	intptr_t growth;
+	intptr_t shrink;
+	int rc;
+};
+
+
+/* Change the map geometry outside of the GVL.  It may wait for writers. */
+static void *
+rmdbx_set_geometry_without_gvl( void *ptr )
+{
+	struct geometry_args_s *args = (struct geometry_args_s *)ptr;
+	args->rc = mdbx_env_set_geometry( args->env,
+		args->lower, args->now, args->upper, args->growth, args->shrink, -1 );
+	return NULL;
+}
+
+
+/*
+ * call-seq:
+ *    db.set_geometry( size_lower, size_now, max_size, growth_step, shrink_threshold )
+ *
+ * Change the map geometry of an open database.  nil leaves a value
+ * as it is.  The page size can't be changed once a database has
+ * been created.
+ *
+ */
+VALUE
+rmdbx_set_geometry( VALUE self, VALUE lower, VALUE now, VALUE upper, VALUE growth, VALUE shrink )
+{
+	UNWRAP_DB( self, db );
+	struct geometry_args_s args;
+
+	CHECK_HANDLE();
+
+	/* libmdbx resizes within a write transaction of its own. */
+	if ( rmdbx_current_txn(db) )
+		rb_raise( rmdbx_eDatabaseError, "Unable to resize: transaction open" );
+
+	args.lower  = rmdbx_geometry_opt( lower );
+	args.now    = rmdbx_geometry_opt( now );
+	args.upper  = rmdbx_geometry_opt( upper );
+	args.growth = rmdbx_geometry_opt( growth );
+	args.shrink = rmdbx_geometry_opt( shrink );
+	args.env    = db->env; /* after any conversions, which may let it be reopened */
+
+	rmdbx_db_without_gvl( db, rmdbx_set_geometry_without_gvl, (void *)&args );
+	if ( args.rc != MDBX_SUCCESS )
+		rb_raise( rmdbx_eDatabaseError, "Unable to resize: (%d) %s", args.rc, mdbx_strerror(args.rc) );
+
+	/* Keep the new geometry when reopening. */
+	if ( args.lower > -1 )  db->settings.size_lower       = args.lower;
+	if ( args.now > -1 )    db->settings.size_now         = args.now;
+	if ( args.upper > -1 )  db->settings.max_size         = args.upper;
+	if ( args.growth > -1 ) db->settings.growth_step      = args.growth;
+	if ( args.shrink > -1 ) db->settings.shrink_threshold = args.shrink;
+
+	return Qtrue;
+}
+
+
 /*
  * call-seq:
  *    db.statistics => (hash of stats)
@@ -893,9 +2805,18 @@ static VALUE rmdbx_init_copy( VALUE copy, VALUE orig )
 	TypedData_Get_Struct( copy, rmdbx_db_t, &rmdbx_db_data, copy_db );
 
 	/* Copy all fields from the original to the copy, and force-close
-	   the copy.
+	   the copy.  Transaction state, handles, and dictionaries belong
+	   to the original.
 	*/
 	MEMCPY( copy_db, orig_db, rmdbx_db_t, 1 );
+	copy_db->txns  = st_init_numtable();
+	copy_db->dbis  = st_init_strtable();
+	copy_db->dicts = NULL;
+	copy_db->group = NULL;
+	copy_db->syncer = NULL;
+	copy_db->metrics = NULL;
+	if ( orig_db->metrics ) rmdbx_metrics_enable( copy_db );
+	copy_db->subdb = orig_db->subdb ? ruby_strdup( orig_db->subdb ) : NULL;
 	rmdbx_close_all( copy_db );
 
 	return copy;
@@ -928,22 +2849,35 @@ rmdbx_init_database( void )
 	rb_define_method( rmdbx_cDatabase, "reopen", rmdbx_open_env, 0 );
 	rb_define_method( rmdbx_cDatabase, "[]", rmdbx_get_val, 1 );
 	rb_define_method( rmdbx_cDatabase, "[]=", rmdbx_put_val, 2 );
+	rb_define_method( rmdbx_cDatabase, "get_many", rmdbx_get_many, 1 );
+	rb_define_protected_method( rmdbx_cDatabase, "put_pairs", rmdbx_put_many, 3 );
 
 	/* Enumerables */
-	rb_define_method( rmdbx_cDatabase, "each_key", rmdbx_each_key, 0 );
-	rb_define_method( rmdbx_cDatabase, "each_pair", rmdbx_each_pair, 0 );
-	rb_define_method( rmdbx_cDatabase, "each_value", rmdbx_each_value, 0 );
+	rb_define_method( rmdbx_cDatabase, "each_key", rmdbx_each_key, -1 );
+	rb_define_method( rmdbx_cDatabase, "each_pair", rmdbx_each_pair, -1 );
+	rb_define_method( rmdbx_cDatabase, "each_slice_pairs", rmdbx_each_slice_pairs, -1 );
+	rb_define_method( rmdbx_cDatabase, "each_value", rmdbx_each_value, -1 );
 
 	/* Manually open/close transactions from ruby. */
 	rb_define_method( rmdbx_cDatabase, "in_transaction?", rmdbx_in_transaction_p, 0 );
 	rb_define_protected_method( rmdbx_cDatabase, "open_transaction",  rmdbx_rb_opentxn, 1 );
 	rb_define_protected_method( rmdbx_cDatabase, "close_transaction", rmdbx_rb_closetxn, 1 );
+	rb_define_protected_method( rmdbx_cDatabase, "open_savepoint",  rmdbx_rb_open_savepoint, 0 );
+	rb_define_protected_method( rmdbx_cDatabase, "close_savepoint", rmdbx_rb_close_savepoint, 1 );
 
 	/* Collection functions */
 	rb_define_protected_method( rmdbx_cDatabase, "get_subdb", rmdbx_get_subdb, 0 );
 	rb_define_protected_method( rmdbx_cDatabase, "set_subdb", rmdbx_set_subdb, 1 );
 
 	rb_define_protected_method( rmdbx_cDatabase, "raw_stats", rmdbx_stats, 0 );
+	rb_define_protected_method( rmdbx_cDatabase, "set_geometry", rmdbx_set_geometry, 5 );
+
+	/* Serialization */
+	rb_define_method( rmdbx_cDatabase, "serializer_mode", rmdbx_get_serializer_mode, 0 );
+	rb_define_protected_method( rmdbx_cDatabase, "serializer_mode=", rmdbx_set_serializer_mode, 1 );
+
+	id_serialize   = rb_intern( "serialize" );
+	id_deserialize = rb_intern( "deserialize" );
 
 	rb_require( "mdbx/database" );
 }
@@ -0,0 +1,280 @@
+/* vim: set noet sta sw=4 ts=4 fdm=marker: */
+/*
+ * Duplicate-sorted collections.
+ *
+ * A database opened with +dup_sort+ stores any number of sorted
+ * values under each key, so a growing set (an index of ids for a
+ * tag, say) is appended to and pruned one value at a time rather
+ * than rewritten whole.  With +dup_fixed+ every value is the same
+ * size, and they're read a page at a time.
+ *
+ */
+
+#include "mdbx_ext.h"
+
+
+/* Inline struct for a single duplicate operation, passed as a void pointer. */
+struct dup_args_s {
+	MDBX_txn *txn;
+	MDBX_dbi dbi;
+	MDBX_val key;
+	MDBX_val data;
+	int rc;
+};
+
+
+/* Raise unless +db+ was opened for duplicate values. */
+#define CHECK_DUPSORT() \
+	if ( ! (db->settings.db_flags & MDBX_DUPSORT) ) \
+		rb_raise( rmdbx_eDatabaseError, "Database wasn't opened with dup_sort." )
+
+
+/*
+ * Add a single key/value pair, unless that exact pair exists.
+ */
+void *
+rmdbx_add_dup_without_gvl( void *ptr )
+{
+	struct dup_args_s *args = (struct dup_args_s *)ptr;
+	args->rc = mdbx_put( args->txn, args->dbi, &args->key, &args->data, MDBX_NODUPDATA );
+	return NULL;
+}
+
+
+/*
+ * Remove a single key/value pair.
+ */
+void *
+rmdbx_delete_dup_without_gvl( void *ptr )
+{
+	struct dup_args_s *args = (struct dup_args_s *)ptr;
+	args->rc = mdbx_del( args->txn, args->dbi, &args->key, &args->data );
+	return NULL;
+}
+
+
+/*
+ * call-seq:
+ *    db.add_dup( key, value ) => true or false
+ *
+ * Add +value+ to the values stored under +key+.  Returns false if
+ * it was already there.
+ */
+VALUE
+rmdbx_add_dup( VALUE self, VALUE key, VALUE val )
+{
+	UNWRAP_DB( self, db );
+	struct dup_args_s args;
+
+	CHECK_HANDLE();
+	CHECK_DUPSORT();
+	VALUE key_str = rmdbx_key_for( db, key, &args.key );
+	VALUE val_str = rmdbx_val_for( self, val, &args.data );
+
+	args.txn = rmdbx_open_txn( db, MDBX_TXN_READWRITE );
+	args.dbi = db->dbi;
+	rmdbx_timed_without_gvl( db, RMDBX_OP_PUT, rmdbx_add_dup_without_gvl, (void *)&args );
+	if ( args.rc == MDBX_SUCCESS ) rmdbx_metrics_bytes( db, 0, args.key.iov_len + args.data.iov_len );
+
+	rmdbx_close_txn( db, RMDBX_TXN_COMMIT );
+	RB_GC_GUARD( key_str );
+	RB_GC_GUARD( val_str );
+
+	switch ( args.rc ) {
+		case MDBX_SUCCESS:
+			return Qtrue;
+		case MDBX_KEYEXIST:
+			return Qfalse;
+		default:
+			rb_raise( rmdbx_eDatabaseError, "Unable to add value: (%d) %s", args.rc, mdbx_strerror(args.rc) );
+	}
+}
+
+
+/*
+ * call-seq:
+ *    db.delete_dup( key, value ) => true or false
+ *
+ * Remove +value+ from the values stored under +key+, leaving the
+ * others in place.  Returns false if it wasn't there.
+ */
+VALUE
+rmdbx_delete_dup( VALUE self, VALUE key, VALUE val )
+{
+	UNWRAP_DB( self, db );
+	struct dup_args_s args;
+
+	CHECK_HANDLE();
+	CHECK_DUPSORT();
+	VALUE key_str = rmdbx_key_for( db, key, &args.key );
+	VALUE val_str = rmdbx_val_for( self, val, &args.data );
+
+	args.txn = rmdbx_open_txn( db, MDBX_TXN_READWRITE );
+	args.dbi = db->dbi;
+	rmdbx_timed_without_gvl( db, RMDBX_OP_DEL, rmdbx_delete_dup_without_gvl, (void *)&args );
+
+	rmdbx_close_txn( db, RMDBX_TXN_COMMIT );
+	RB_GC_GUARD( key_str );
+	RB_GC_GUARD( val_str );
+
+	switch ( args.rc ) {
+		case MDBX_SUCCESS:
+			return Qtrue;
+		case MDBX_NOTFOUND:
+			return Qfalse;
+		default:
+			rb_raise( rmdbx_eDatabaseError, "Unable to delete value: (%d) %s", args.rc, mdbx_strerror(args.rc) );
+	}
+}
+
+
+/*
+ * call-seq:
+ *    db.count_dups( key ) => integer
+ *
+ * Return the number of values stored under +key+.
+ */
+VALUE
+rmdbx_count_dups( VALUE self, VALUE key )
+{
+	UNWRAP_DB( self, db );
+	MDBX_cursor *cursor;
+	MDBX_val ckey, data;
+	size_t count = 0;
+
+	CHECK_HANDLE();
+	CHECK_DUPSORT();
+	VALUE key_str = rmdbx_key_for( db, key, &ckey );
+
+	MDBX_txn *txn = rmdbx_open_txn( db, MDBX_TXN_RDONLY );
+	int rc = mdbx_cursor_open( txn, db->dbi, &cursor );
+
+	if ( rc == MDBX_SUCCESS ) {
+		rc = mdbx_cursor_get( cursor, &ckey, &data, MDBX_SET );
+		if ( rc == MDBX_SUCCESS ) rc = mdbx_cursor_count( cursor, &count );
+		mdbx_cursor_close( cursor );
+	}
+
+	rmdbx_close_txn( db, RMDBX_TXN_ROLLBACK );
+	RB_GC_GUARD( key_str );
+
+	if ( rc != MDBX_SUCCESS && rc != MDBX_NOTFOUND )
+		rb_raise( rmdbx_eDatabaseError, "Unable to count values: (%d) %s", rc, mdbx_strerror(rc) );
+
+	return SIZET2NUM( count );
+}
+
+
+/* Inline struct for duplicate iteration arguments, passed as a void pointer. */
+struct each_dup_args_s {
+	VALUE self;
+	rmdbx_db_t *db;
+	MDBX_val key;
+};
+
+
+/*
+ * Yield every value stored under a key.
+ *
+ * With fixed size values, a page of them is fetched per cursor
+ * step (MDBX_GET_MULTIPLE / MDBX_NEXT_MULTIPLE), and copied out
+ * before any is yielded.  Otherwise values are copied and yielded
+ * one at a time.  Iteration stops if the block closes the
+ * transaction.
+ */
+VALUE
+rmdbx_each_dup_i( VALUE argp )
+{
+	struct each_dup_args_s *args = (struct each_dup_args_s *)argp;
+	rmdbx_db_t *db = args->db;
+	rmdbx_txn_state_t *state = rmdbx_txn_state( db );
+	MDBX_cursor *cursor = state->cursor;
+	MDBX_txn *txn  = state->txn;
+	uint64_t txnid = mdbx_txn_id( txn );
+	int fixed = db->settings.db_flags & MDBX_DUPFIXED;
+	MDBX_val key = args->key, data;
+
+	/* Landing on the key also gives the size of fixed values. */
+	int rc = mdbx_cursor_get( cursor, &key, &data, MDBX_SET );
+	MDBX_cursor_op op = fixed ? MDBX_GET_MULTIPLE : MDBX_GET_CURRENT;
+	size_t size = data.iov_len;
+
+	while ( rc == MDBX_SUCCESS ) {
+		rc = mdbx_cursor_get( cursor, &key, &data, op );
+		if ( rc != MDBX_SUCCESS ) break;
+
+		if ( fixed ) {
+			op = MDBX_NEXT_MULTIPLE;
+
+			long count = size ? (long)( data.iov_len / size ) : 0;
+			VALUE vals = rb_ary_new_capa( count );
+			for ( long i = 0; i < count; i++ ) {
+				MDBX_val val = { (char *)data.iov_base + i * size, size };
+				rb_ary_push( vals, rmdbx_stored_str( args->self, db, &val ) );
+			}
+
+			for ( long i = 0; i < count; i++ )
+				rb_yield( rmdbx_deserialize( args->self, db, RARRAY_AREF(vals, i) ) );
+		}
+		else {
+			op = MDBX_NEXT_DUP;
+			rb_yield( rmdbx_deserialize( args->self, db, rmdbx_stored_str( args->self, db, &data ) ) );
+		}
+
+		/* Stop if the block closed the transaction out from under us. */
+		if ( ! db->state.open || state->txn != txn || mdbx_txn_id(txn) != txnid ) return Qnil;
+	}
+
+	if ( rc != MDBX_SUCCESS && rc != MDBX_NOTFOUND )
+		rb_raise( rmdbx_eDatabaseError, "Unable to iterate values: (%d) %s", rc, mdbx_strerror(rc) );
+
+	return Qnil;
+}
+
+
+/*
+ * call-seq:
+ *    db.each_dup( key ) {|value| block } => self
+ *
+ * Yield every value stored under +key+, in sorted order.  Must be
+ * called within a snapshot or transaction.
+ */
+VALUE
+rmdbx_each_dup( int argc, VALUE *argv, VALUE self )
+{
+	UNWRAP_DB( self, db );
+	struct each_dup_args_s args;
+	VALUE key;
+	int state;
+
+	CHECK_HANDLE();
+	CHECK_TXN();
+	CHECK_DUPSORT();
+	RETURN_ENUMERATOR( self, argc, argv );
+
+	rb_scan_args( argc, argv, "1", &key );
+
+	args.self = self;
+	args.db   = db;
+	VALUE key_str = rmdbx_key_for( db, key, &args.key );
+
+	rmdbx_open_cursor( db );
+	rb_protect( rmdbx_each_dup_i, (VALUE)&args, &state );
+	if ( db->state.open ) rmdbx_close_cursor( db );
+	RB_GC_GUARD( key_str );
+
+	if ( state ) rb_jump_tag( state );
+
+	return self;
+}
+
+
+void
+rmdbx_init_dups( void )
+{
+	rb_define_method( rmdbx_cDatabase, "add_dup", rmdbx_add_dup, 2 );
+	rb_define_method( rmdbx_cDatabase, "delete_dup", rmdbx_delete_dup, 2 );
+	rb_define_method( rmdbx_cDatabase, "count_dups", rmdbx_count_dups, 1 );
+	rb_define_method( rmdbx_cDatabase, "each_dup", rmdbx_each_dup, -1 );
+}
+
@@ -10,6 +10,14 @@ have_library( 'mdbx' )  or abort "No mdbx library!"
 have_header( 'mdbx.h' ) or abort "No mdbx.h header!"
 
 have_const( 'MDBX_NOSTICKYTHREADS', 'mdbx.h' )
+have_func( 'mdbx_env_warmup', 'mdbx.h' )
+
+# Optional value compression codecs.
+have_library( 'lz4' ) and have_header( 'lz4.h' )
+have_library( 'zstd' ) and have_header( 'zstd.h' )
+
+# Group commit runs a native committer thread.
+have_header( 'pthread.h' )
 
 create_header()
 create_makefile( 'mdbx_ext' )
@@ -0,0 +1,378 @@
+/* vim: set noet sta sw=4 ts=4 fdm=marker: */
+/*
+ * Group commit.
+ *
+ * With group commit enabled, single writes made outside of a
+ * transaction aren't each committed by the thread making them.
+ * They're queued for a committer thread instead, which applies
+ * everything waiting within one transaction and commits it once.
+ * Each writer sleeps (without the GVL) until the transaction that
+ * holds its write is durably committed, so a write has returned
+ * only once it's on disk -- just as before -- but many threads
+ * share the cost of each fsync.
+ *
+ * The committer is a native thread that never touches Ruby.  It's
+ * started by the first queued write, and stopped (after writing
+ * everything still queued) when the database is closed.
+ *
+ */
+
+#include "mdbx_ext.h"
+
+#ifdef HAVE_PTHREAD_H
+#include <errno.h>
+#include <time.h>
+#endif
+
+
+/*
+ * A single queued write.  It lives on the writer's stack, which
+ * stays put until the committer marks it done.
+ */
+struct rmdbx_group_op {
+	struct rmdbx_group *group;
+	struct op_args_s *args;
+	int del;
+	int failed;
+	int done;
+	struct rmdbx_group_op *next;
+};
+
+
+/*
+ * The write queue and committer thread for a database handle.
+ */
+struct rmdbx_group {
+#ifdef HAVE_PTHREAD_H
+	MDBX_env *env;
+	long max_writes;
+	long latency;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t queued;    /* writes were queued, or stopping */
+	pthread_cond_t committed; /* a batch of writes is done */
+	int running;
+	int stopping;
+
+	struct rmdbx_group_op *head;
+	struct rmdbx_group_op *tail;
+	long count;
+
+	uint64_t commits;
+	uint64_t writes;
+	uint64_t largest;
+#else
+	int unused;
+#endif
+};
+
+
+#ifdef HAVE_PTHREAD_H
+
+/*
+ * Apply a +batch+ of writes in a single transaction, and commit it.
+ * A write that fails is dropped and the transaction retried without
+ * it, so one bad write doesn't fail the others.  If the commit
+ * itself fails, every write in it does.
+ */
+static void
+rmdbx_group_apply( MDBX_env *env, struct rmdbx_group_op *batch )
+{
+	struct rmdbx_group_op *op;
+	MDBX_txn *txn;
+	int rc;
+
+	for ( ;; ) {
+		struct rmdbx_group_op *failed = NULL;
+
+		rc = mdbx_txn_begin( env, NULL, MDBX_TXN_READWRITE, &txn );
+		if ( rc != MDBX_SUCCESS ) break;
+
+		for ( op = batch; op && ! failed; op = op->next ) {
+			if ( op->failed ) continue;
+
+			struct op_args_s *args = op->args;
+			args->txn = txn;
+			args->rc  = op->del ?
+				mdbx_del( txn, args->dbi, &args->key, NULL ) :
+				mdbx_put( txn, args->dbi, &args->key, &args->data, args->flags );
+
+			if ( args->rc != MDBX_SUCCESS && args->rc != MDBX_NOTFOUND ) failed = op;
+		}
+
+		if ( ! failed ) {
+			rc = mdbx_txn_commit( txn );
+			break;
+		}
+
+		mdbx_txn_abort( txn );
+		failed->failed = 1;
+	}
+
+	for ( op = batch; op; op = op->next ) {
+		op->args->txn = NULL;
+		if ( rc != MDBX_SUCCESS && ! op->failed ) op->args->rc = rc;
+	}
+}
+
+
+/*
+ * The committer thread.  Waits for queued writes, gives other
+ * writers up to the configured latency to join them, then writes
+ * as many as allowed in a single transaction.  Exits once asked to
+ * stop and the queue is empty.
+ */
+static void *
+rmdbx_group_run( void *ptr )
+{
+	struct rmdbx_group *group = (struct rmdbx_group *)ptr;
+
+	pthread_mutex_lock( &group->lock );
+
+	for ( ;; ) {
+		while ( ! group->head && ! group->stopping )
+			pthread_cond_wait( &group->queued, &group->lock );
+		if ( ! group->head ) break;
+
+		if ( group->latency > 0 && ! group->stopping ) {
+			struct timespec until;
+			clock_gettime( CLOCK_REALTIME, &until );
+			until.tv_sec  += group->latency / 1000000;
+			until.tv_nsec += ( group->latency % 1000000 ) * 1000;
+			if ( until.tv_nsec >= 1000000000 ) {
+				until.tv_sec++;
+				until.tv_nsec -= 1000000000;
+			}
+
+			while ( group->count < group->max_writes && ! group->stopping &&
+					pthread_cond_timedwait( &group->queued, &group->lock, &until ) != ETIMEDOUT )
+				;
+		}
+
+		/* Take up to max_writes off the front of the queue. */
+		struct rmdbx_group_op *batch = group->head, *last = batch;
+		long count = 1;
+		while ( last->next && count < group->max_writes ) {
+			last = last->next;
+			count++;
+		}
+
+		group->head  = last->next;
+		group->count -= count;
+		if ( ! group->head ) group->tail = NULL;
+		last->next = NULL;
+
+		pthread_mutex_unlock( &group->lock );
+		rmdbx_group_apply( group->env, batch );
+		pthread_mutex_lock( &group->lock );
+
+		/* A writer may return as soon as its op is done, taking the op with it. */
+		while ( batch ) {
+			struct rmdbx_group_op *next = batch->next;
+			batch->done = 1;
+			batch = next;
+		}
+
+		group->commits++;
+		group->writes += count;
+		if ( (uint64_t)count > group->largest ) group->largest = count;
+		pthread_cond_broadcast( &group->committed );
+	}
+
+	group->running = 0;
+	pthread_mutex_unlock( &group->lock );
+
+	return NULL;
+}
+
+
+/*
+ * Start the committer thread for +db+, if it isn't running.
+ */
+static struct rmdbx_group *
+rmdbx_group_start( rmdbx_db_t *db )
+{
+	struct rmdbx_group *group = db->group;
+
+	if ( ! group ) {
+		group = ZALLOC( struct rmdbx_group );
+		pthread_mutex_init( &group->lock, NULL );
+		pthread_cond_init( &group->queued, NULL );
+		pthread_cond_init( &group->committed, NULL );
+		db->group = group;
+	}
+
+	if ( group->running ) return group;
+
+	group->env        = db->env;
+	group->max_writes = db->settings.group_commit_size;
+	group->latency    = db->settings.group_commit_latency;
+	group->stopping   = 0;
+
+	int rc = rmdbx_start_thread( &group->thread, rmdbx_group_run, (void *)group );
+	if ( rc != 0 )
+		rb_raise( rmdbx_eDatabaseError, "Unable to start the group committer: (%d) %s", rc, strerror(rc) );
+
+	group->running = 1;
+	return group;
+}
+
+
+/* Wait for a queued write to be committed, outside of the GVL. */
+static void *
+rmdbx_group_wait_without_gvl( void *ptr )
+{
+	struct rmdbx_group_op *op  = (struct rmdbx_group_op *)ptr;
+	struct rmdbx_group *group = op->group;
+
+	pthread_mutex_lock( &group->lock );
+	while ( ! op->done ) pthread_cond_wait( &group->committed, &group->lock );
+	pthread_mutex_unlock( &group->lock );
+
+	return NULL;
+}
+
+
+/*
+ * Stop the committer thread for +db+, after it has written
+ * everything still queued.  See rmdbx_join_thread() for +nogvl+.
+ */
+static void
+rmdbx_group_halt( rmdbx_db_t *db, int nogvl )
+{
+	struct rmdbx_group *group = db->group;
+	if ( ! group ) return;
+
+	/* Only one caller joins, should two threads close at once. */
+	pthread_mutex_lock( &group->lock );
+	if ( ! group->running || group->stopping ) {
+		pthread_mutex_unlock( &group->lock );
+		return;
+	}
+	group->stopping = 1;
+	pthread_cond_signal( &group->queued );
+	pthread_mutex_unlock( &group->lock );
+
+	rmdbx_join_thread( group->thread, nogvl );
+}
+
+#endif /* HAVE_PTHREAD_H */
+
+
+/*
+ * Returns true if a write by the calling thread should be queued
+ * for the committer, rather than committed on its own: group
+ * commit is enabled, and the thread has no transaction open.
+ */
+int
+rmdbx_group_writes( rmdbx_db_t *db )
+{
+	return db->settings.group_commit && ! rmdbx_current_txn( db );
+}
+
+
+/*
+ * Queue the staged write in +args+ (a delete, if +del+ is true),
+ * and wait until it's committed.  The result is left in args->rc,
+ * as if the write were made directly.
+ */
+void
+rmdbx_group_write( rmdbx_db_t *db, struct op_args_s *args, int del )
+{
+#ifdef HAVE_PTHREAD_H
+	/* Serializing the value may have let another thread close the handle. */
+	CHECK_HANDLE();
+
+	/* Queued with the GVL held, so the handle can't be closed underneath. */
+	struct rmdbx_group *group = rmdbx_group_start( db );
+	struct rmdbx_group_op op  = { group, args, del, 0, 0, NULL };
+
+	pthread_mutex_lock( &group->lock );
+	if ( group->tail ) {
+		group->tail->next = &op;
+	}
+	else {
+		group->head = &op;
+	}
+	group->tail = &op;
+	group->count++;
+	pthread_cond_signal( &group->queued );
+	pthread_mutex_unlock( &group->lock );
+
+	rmdbx_db_without_gvl( db, rmdbx_group_wait_without_gvl, (void *)&op );
+#else
+	rb_raise( rmdbx_eDatabaseError, "Group commit isn't supported on this platform." );
+#endif
+}
+
+
+/*
+ * Stop the committer thread for +db+, after it has written
+ * everything still queued.  The committer may be waiting on another
+ * Ruby thread's transaction, so this waits without the GVL.
+ */
+void
+rmdbx_group_stop( rmdbx_db_t *db )
+{
+#ifdef HAVE_PTHREAD_H
+	rmdbx_group_halt( db, 1 );
+#endif
+}
+
+
+/*
+ * Stop the committer thread, and free the queue.
+ */
+void
+rmdbx_free_group( rmdbx_db_t *db )
+{
+	if ( ! db->group ) return;
+
+#ifdef HAVE_PTHREAD_H
+	rmdbx_group_halt( db, 0 );
+	pthread_mutex_destroy( &db->group->lock );
+	pthread_cond_destroy( &db->group->queued );
+	pthread_cond_destroy( &db->group->committed );
+#endif
+
+	xfree( db->group );
+	db->group = NULL;
+}
+
+
+/*
+ * Add group commit settings and counters to +stat+.
+ */
+void
+rmdbx_gather_group_stats( rmdbx_db_t *db, VALUE stat )
+{
+	VALUE group_stat = rb_hash_new();
+	uint64_t commits = 0, writes = 0, largest = 0;
+
+	rb_hash_aset( stat, ID2SYM(rb_intern("group_commit")), group_stat );
+
+#ifdef HAVE_PTHREAD_H
+	struct rmdbx_group *group = db->group;
+	if ( group ) {
+		pthread_mutex_lock( &group->lock );
+		commits = group->commits;
+		writes  = group->writes;
+		largest = group->largest;
+		pthread_mutex_unlock( &group->lock );
+	}
+#endif
+
+	rb_hash_aset( group_stat, ID2SYM(rb_intern("enabled")),
+			db->settings.group_commit ? Qtrue : Qfalse );
+	rb_hash_aset( group_stat, ID2SYM(rb_intern("size")),
+			LONG2NUM( db->settings.group_commit_size ) );
+	rb_hash_aset( group_stat, ID2SYM(rb_intern("latency")),
+			DBL2NUM( db->settings.group_commit_latency / 1000000.0 ) );
+	rb_hash_aset( group_stat, ID2SYM(rb_intern("commits")), ULL2NUM( commits ) );
+	rb_hash_aset( group_stat, ID2SYM(rb_intern("writes")), ULL2NUM( writes ) );
+	rb_hash_aset( group_stat, ID2SYM(rb_intern("largest_batch")), ULL2NUM( largest ) );
+	rb_hash_aset( group_stat, ID2SYM(rb_intern("average_batch")),
+			DBL2NUM( commits ? (double)writes / commits : 0.0 ) );
+}
+
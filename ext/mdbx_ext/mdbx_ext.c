@@ -80,5 +80,14 @@ Init_mdbx_ext( void )
 	rmdbx_eRollback = rb_define_class_under( rmdbx_mMDBX, "Rollback", rb_eRuntimeError );
 
 	rmdbx_init_database();
+	rmdbx_init_cursor();
+	rmdbx_init_msgpack();
+	rmdbx_init_compress();
+	rmdbx_init_dups();
+	rmdbx_init_collection();
+	rmdbx_init_sync();
+	rmdbx_init_backup();
+	rmdbx_init_warmup();
+	rmdbx_init_metrics();
 }
 
@@ -5,12 +5,52 @@
 
 #include "mdbx.h"
 
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
 #ifndef RBMDBX_EXT
 #define RBMDBX_EXT
 
 #define RMDBX_TXN_ROLLBACK 0
 #define RMDBX_TXN_COMMIT 1
 
+/* Value serialization modes. */
+#define RMDBX_SERIALIZE_CUSTOM  0 /* via the Ruby #serialize and #deserialize methods */
+#define RMDBX_SERIALIZE_RAW     1
+#define RMDBX_SERIALIZE_MARSHAL 2
+#define RMDBX_SERIALIZE_STRING  3
+#define RMDBX_SERIALIZE_MSGPACK 4
+
+/* Value compression codecs. */
+#define RMDBX_COMPRESS_NONE 0
+#define RMDBX_COMPRESS_LZ4  1
+#define RMDBX_COMPRESS_ZSTD 2
+
+/* Commit durability modes. */
+#define RMDBX_SYNC_DURABLE  0
+#define RMDBX_SYNC_LAZY     1
+#define RMDBX_SYNC_PERIODIC 2
+#define RMDBX_SYNC_UNSAFE   3
+
+/* Timed operations, for statistics[:operations]. */
+#define RMDBX_OP_GET         0
+#define RMDBX_OP_PUT         1
+#define RMDBX_OP_DEL         2
+#define RMDBX_OP_TXN_BEGIN   3
+#define RMDBX_OP_COMMIT      4
+#define RMDBX_OP_CURSOR_STEP 5
+#define RMDBX_OP_SERIALIZE   6
+#define RMDBX_OP_DESERIALIZE 7
+#define RMDBX_OP_COUNT       8
+
+/* Read-only transactions may be used across threads. */
+#if defined(HAVE_CONST_MDBX_NOSTICKYTHREADS)
+#define RMDBX_NOSTICKY MDBX_NOSTICKYTHREADS
+#else
+#define RMDBX_NOSTICKY MDBX_NOTLS
+#endif
+
 /* Shortcut for fetching wrapped data structure.
  */
 #define UNWRAP_DB( self, db ) \
@@ -21,6 +61,49 @@
 #define CHECK_HANDLE() \
 	if ( ! db->state.open ) rb_raise( rmdbx_eDatabaseError, "Closed database." )
 
+/* Raise if the calling thread has no open transaction. */
+#define CHECK_TXN() \
+	if ( ! rmdbx_current_txn(db) ) rb_raise( rmdbx_eDatabaseError, "No snapshot or transaction currently open." )
+
+
+/*
+ * Transaction state for a single thread.  mdbx transactions
+ * are bound to the thread that began them, so every thread
+ * using a database handle carries its own.
+ */
+struct rmdbx_txn_state {
+	MDBX_txn *txn;
+	MDBX_cursor *cursor;
+	MDBX_txn *rtxn; /* a parked (reset) read-only transaction */
+	int retain_txn;
+
+	/* Cursors opened by MDBX::Cursor objects within txn. */
+	MDBX_cursor **cursors;
+	long cursor_count;
+	long cursor_capa;
+
+	/* Incremented whenever txn ends, invalidating its cursors. */
+	uint64_t generation;
+
+	/* Enclosing transactions of open savepoints, outermost first. */
+	MDBX_txn **parents;
+	long depth;
+	long depth_capa;
+};
+typedef struct rmdbx_txn_state rmdbx_txn_state_t;
+
+/* Loaded compression dictionaries, private to compress.c. */
+struct rmdbx_dicts;
+
+/* The group commit queue, private to group.c. */
+struct rmdbx_group;
+
+/* The background syncer, private to sync.c. */
+struct rmdbx_syncer;
+
+/* Operation counters, private to metrics.c. */
+struct rmdbx_metrics;
+
 
 /*
  * A struct encapsulating an instance's DB
@@ -29,8 +112,12 @@
 struct rmdbx_db {
 	MDBX_env *env;
 	MDBX_dbi dbi;
-	MDBX_txn *txn;
-	MDBX_cursor *cursor;
+
+	/* Ruby Thread -> rmdbx_txn_state_t */
+	st_table *txns;
+
+	/* Collection name ("" for the top level) -> MDBX_dbi */
+	st_table *dbis;
 
     struct {
        unsigned int env_flags;
@@ -39,20 +126,85 @@ struct rmdbx_db {
        int open;
        int max_collections;
        int max_readers;
+       int txn_cache;
+       int serializer;
+       int compress;
+       long compress_min;
+       int group_commit;
+       long group_commit_size;
+       long group_commit_latency;
+       int sync_mode;
+       double sync_period;
+       long sync_bytes;
        uint64_t max_size;
+       intptr_t size_lower;
+       intptr_t size_now;
+       intptr_t growth_step;
+       intptr_t shrink_threshold;
+       intptr_t page_size;
     } settings;
 
     struct {
        int open;
-       int retain_txn;
+       int inflight; /* calls using the environment without the GVL */
     } state;
 
+    struct {
+       uint64_t txn_cache_hits;
+       uint64_t txn_cache_misses;
+       uint64_t compress_values;
+       uint64_t compress_compressed;
+       uint64_t compress_raw_bytes;
+       uint64_t compress_stored_bytes;
+       uint64_t compress_dictionary;
+    } counters;
+
+	struct rmdbx_dicts *dicts;
+	struct rmdbx_group *group;
+	struct rmdbx_syncer *syncer;
+	struct rmdbx_metrics *metrics;
+
 	char *path;
 	char *subdb;
 };
 typedef struct rmdbx_db rmdbx_db_t;
 
-static const rb_data_type_t rmdbx_db_data;
+extern const rb_data_type_t rmdbx_db_data;
+
+
+/* Arguments for a single staged operation, passed as a void pointer. */
+struct op_args_s {
+	MDBX_txn *txn;
+	MDBX_dbi dbi;
+	MDBX_val key;
+	MDBX_val data;
+	int flags;
+	int rc;
+};
+
+
+/* The maximum number of entries fetched per cursor scan. */
+#define RMDBX_SCAN_BATCH 64
+
+/*
+ * Arguments for a batched cursor scan.  Collects pointers to up to
+ * +limit+ entries starting with +op+, within any set bounds (a NULL
+ * iov_base is unbounded).
+ */
+struct scan_args_s {
+	MDBX_cursor *cursor;
+	MDBX_cursor_op op;
+	int reverse;
+	MDBX_val seek;
+	MDBX_val from;
+	MDBX_val to;
+	MDBX_val prefix;
+	int limit;
+	int count;
+	int rc;
+	MDBX_val keys[ RMDBX_SCAN_BATCH ];
+	MDBX_val vals[ RMDBX_SCAN_BATCH ];
+};
 
 
 /* ------------------------------------------------------------
@@ -76,6 +228,9 @@ void rmdbx_log( const char *, const char *, va_dcl );
  * ------------------------------------------------------------ */
 extern VALUE rmdbx_mMDBX;
 extern VALUE rmdbx_cDatabase;
+extern VALUE rmdbx_cCursor;
+extern VALUE rmdbx_cCollection;
+extern VALUE rmdbx_mMessagePack;
 extern VALUE rmdbx_eDatabaseError;
 extern VALUE rmdbx_eRollback;
 
@@ -84,12 +239,80 @@ extern VALUE rmdbx_eRollback;
  * Functions
  * ------------------------------------------------------------ */
 extern void rmdbx_free( void *db ); /* forward declaration for the allocator */
+extern void rmdbx_mark( void *db );
 extern void Init_rmdbx ( void );
 extern void rmdbx_init_database ( void );
+extern void rmdbx_init_cursor ( void );
+extern void rmdbx_init_msgpack ( void );
+extern void rmdbx_init_compress ( void );
+extern void rmdbx_init_dups ( void );
+extern void rmdbx_init_collection ( void );
+extern void rmdbx_init_sync ( void );
+extern void rmdbx_init_backup ( void );
+extern void rmdbx_init_warmup ( void );
+extern void rmdbx_init_metrics ( void );
 extern void rmdbx_close_all( rmdbx_db_t* );
-extern void rmdbx_open_txn( rmdbx_db_t*, int );
+extern MDBX_dbi rmdbx_cached_dbi( rmdbx_db_t*, const char* );
+extern void rmdbx_store_dbi( rmdbx_db_t*, const char*, MDBX_dbi );
+extern int rmdbx_use_cached_dbi( rmdbx_db_t* );
+extern void rmdbx_cache_dbi( rmdbx_db_t* );
+extern void rmdbx_uncache_dbi( rmdbx_db_t* );
+extern void rmdbx_clear_dbis( rmdbx_db_t* );
+extern rmdbx_txn_state_t *rmdbx_txn_state( rmdbx_db_t* );
+extern MDBX_txn *rmdbx_current_txn( rmdbx_db_t* );
+extern int rmdbx_any_txn_open( rmdbx_db_t* );
+extern int rmdbx_other_txn_open( rmdbx_db_t* );
+extern MDBX_txn *rmdbx_open_txn( rmdbx_db_t*, int );
 extern void rmdbx_close_txn( rmdbx_db_t*, int );
-extern void rmdbx_open_cursor( rmdbx_db_t* );
+extern MDBX_cursor *rmdbx_open_cursor( rmdbx_db_t* );
+extern void rmdbx_close_cursor( rmdbx_db_t* );
+extern void rmdbx_register_cursor( rmdbx_txn_state_t*, MDBX_cursor* );
+extern void rmdbx_unregister_cursor( rmdbx_txn_state_t*, MDBX_cursor* );
+extern VALUE rmdbx_key_for( rmdbx_db_t*, VALUE, MDBX_val* );
+extern VALUE rmdbx_key_str( rmdbx_db_t*, const MDBX_val* );
+extern VALUE rmdbx_val_for( VALUE, VALUE, MDBX_val* );
+extern VALUE rmdbx_collection_val_for( VALUE, const char*, VALUE, MDBX_val* );
+extern VALUE rmdbx_serialize( VALUE, rmdbx_db_t*, VALUE );
+extern VALUE rmdbx_deserialize( VALUE, rmdbx_db_t*, VALUE );
+extern VALUE rmdbx_load_val( VALUE, rmdbx_db_t*, const MDBX_val* );
+extern void rmdbx_set_compression( rmdbx_db_t*, VALUE );
+extern VALUE rmdbx_compression_name( rmdbx_db_t* );
+extern VALUE rmdbx_compress( rmdbx_db_t*, const char*, VALUE );
+extern VALUE rmdbx_stored_str( VALUE, rmdbx_db_t*, const MDBX_val* );
+extern void rmdbx_free_dictionaries( rmdbx_db_t* );
+extern int rmdbx_group_writes( rmdbx_db_t* );
+extern void rmdbx_group_write( rmdbx_db_t*, struct op_args_s*, int );
+extern void rmdbx_group_stop( rmdbx_db_t* );
+extern void rmdbx_free_group( rmdbx_db_t* );
+extern void rmdbx_gather_group_stats( rmdbx_db_t*, VALUE );
+extern void rmdbx_set_sync_mode( rmdbx_db_t*, VALUE );
+extern unsigned int rmdbx_sync_env_flags( rmdbx_db_t* );
+extern void rmdbx_set_sync_thresholds( rmdbx_db_t* );
+extern void rmdbx_start_syncer( rmdbx_db_t* );
+extern void rmdbx_stop_syncer( rmdbx_db_t* );
+extern void rmdbx_free_syncer( rmdbx_db_t* );
+extern void rmdbx_gather_sync_stats( rmdbx_db_t*, VALUE, MDBX_envinfo );
+extern void rmdbx_metrics_enable( rmdbx_db_t* );
+extern void rmdbx_free_metrics( rmdbx_db_t* );
+extern uint64_t rmdbx_metrics_start( rmdbx_db_t* );
+extern void rmdbx_metrics_finish( rmdbx_db_t*, int, uint64_t, long );
+extern void rmdbx_metrics_bytes( rmdbx_db_t*, uint64_t, uint64_t );
+extern void *rmdbx_timed_without_gvl( rmdbx_db_t*, int, void *(*)( void * ), void* );
+extern void rmdbx_scan( rmdbx_db_t*, struct scan_args_s*, int );
+extern void rmdbx_gather_operation_stats( rmdbx_db_t*, VALUE );
+extern VALUE rmdbx_msgpack_encode( VALUE );
+extern VALUE rmdbx_msgpack_decode( const char*, size_t );
+extern VALUE rmdbx_rb_closetxn( VALUE, VALUE );
+extern void *rmdbx_without_gvl( void *(*)( void * ), void* );
+extern void *rmdbx_db_without_gvl( rmdbx_db_t*, void *(*)( void * ), void* );
+#ifdef HAVE_PTHREAD_H
+extern int rmdbx_start_thread( pthread_t*, void *(*)( void * ), void* );
+extern void rmdbx_join_thread( pthread_t, int );
+#endif
+extern void *rmdbx_get_without_gvl( void* );
+extern void *rmdbx_put_without_gvl( void* );
+extern void *rmdbx_del_without_gvl( void* );
+extern void *rmdbx_scan_without_gvl( void* );
 extern VALUE rmdbx_gather_stats( rmdbx_db_t* );
 
 
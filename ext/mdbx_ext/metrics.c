@@ -0,0 +1,266 @@
+/* vim: set noet sta sw=4 ts=4 fdm=marker: */
+/*
+ * Operation counters and latency histograms.
+ *
+ * Every timed operation adds to a count, a total and a maximum, and
+ * to one bucket of a log-linear histogram: four buckets per power of
+ * two nanoseconds, so each is within 25% of the time it stands for.
+ * Updates are relaxed atomic adds, as they come from threads running
+ * without the GVL, and a timing is two reads of the monotonic clock
+ * -- cheap enough to leave on.
+ *
+ */
+
+#include "mdbx_ext.h"
+#include <time.h>
+
+/* Histogram buckets per operation: 4 per power of two, up to 2^64ns. */
+#define RMDBX_METRICS_BUCKETS 256
+
+
+/*
+ * Counters for a single kind of operation.
+ */
+struct rmdbx_op_metrics {
+	uint64_t count;
+	uint64_t total;
+	uint64_t max;
+	uint64_t buckets[ RMDBX_METRICS_BUCKETS ];
+};
+
+
+/*
+ * Counters for every kind of operation, and bytes moved.
+ */
+struct rmdbx_metrics {
+	struct rmdbx_op_metrics ops[ RMDBX_OP_COUNT ];
+	uint64_t bytes_read;
+	uint64_t bytes_written;
+};
+
+
+/* Operation names, in RMDBX_OP_* order. */
+static const char *rmdbx_op_names[ RMDBX_OP_COUNT ] = {
+	"get", "put", "del", "txn_begin", "commit", "cursor_step", "serialize", "deserialize"
+};
+
+
+/* Nanoseconds on a monotonic clock. */
+static uint64_t
+rmdbx_metrics_now( void )
+{
+	struct timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+/* The histogram bucket for +ns+. */
+static int
+rmdbx_metrics_bucket( uint64_t ns )
+{
+	if ( ns < 4 ) return (int)ns;
+
+	int exp = 63 - __builtin_clzll( ns );
+	return exp * 4 + (int)( ( ns >> (exp - 2) ) & 3 );
+}
+
+
+/* The largest time (in nanoseconds) counted in +bucket+. */
+static uint64_t
+rmdbx_metrics_bucket_max( int bucket )
+{
+	if ( bucket < 4 ) return bucket;
+
+	int exp = bucket / 4;
+	uint64_t next = (uint64_t)( 5 + bucket % 4 ) << ( exp - 2 );
+	return next - 1;
+}
+
+
+/*
+ * Allocate the counters for +db+.
+ */
+void
+rmdbx_metrics_enable( rmdbx_db_t *db )
+{
+	if ( ! db->metrics ) db->metrics = ZALLOC( struct rmdbx_metrics );
+}
+
+
+/*
+ * Free the counters for +db+.
+ */
+void
+rmdbx_free_metrics( rmdbx_db_t *db )
+{
+	xfree( db->metrics );
+	db->metrics = NULL;
+}
+
+
+/*
+ * Start timing an operation.  Returns 0 if +db+ isn't counting.
+ */
+uint64_t
+rmdbx_metrics_start( rmdbx_db_t *db )
+{
+	return db->metrics ? rmdbx_metrics_now() : 0;
+}
+
+
+/*
+ * Count +n+ operations of kind +op+, which together took the time
+ * since +start+.
+ */
+void
+rmdbx_metrics_finish( rmdbx_db_t *db, int op, uint64_t start, long n )
+{
+	if ( ! start || ! db->metrics || n < 1 ) return;
+
+	struct rmdbx_op_metrics *m = &db->metrics->ops[ op ];
+	uint64_t elapsed = rmdbx_metrics_now() - start;
+	uint64_t each    = elapsed / n;
+
+	__atomic_fetch_add( &m->count, n, __ATOMIC_RELAXED );
+	__atomic_fetch_add( &m->total, elapsed, __ATOMIC_RELAXED );
+	__atomic_fetch_add( &m->buckets[ rmdbx_metrics_bucket(each) ], n, __ATOMIC_RELAXED );
+
+	uint64_t max = __atomic_load_n( &m->max, __ATOMIC_RELAXED );
+	while ( each > max &&
+			! __atomic_compare_exchange_n( &m->max, &max, each, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+		;
+}
+
+
+/*
+ * Count +read+ bytes read from, and +written+ bytes written to, +db+.
+ */
+void
+rmdbx_metrics_bytes( rmdbx_db_t *db, uint64_t read, uint64_t written )
+{
+	if ( ! db->metrics ) return;
+
+	if ( read )    __atomic_fetch_add( &db->metrics->bytes_read, read, __ATOMIC_RELAXED );
+	if ( written ) __atomic_fetch_add( &db->metrics->bytes_written, written, __ATOMIC_RELAXED );
+}
+
+
+/*
+ * Run +func+ without the GVL (see rmdbx_db_without_gvl()), timed as a
+ * single operation of kind +op+.
+ */
+void *
+rmdbx_timed_without_gvl( rmdbx_db_t *db, int op, void *(*func)( void * ), void *arg )
+{
+	uint64_t start = rmdbx_metrics_start( db );
+	void *rv = rmdbx_db_without_gvl( db, func, arg );
+	rmdbx_metrics_finish( db, op, start, 1 );
+
+	return rv;
+}
+
+
+/*
+ * The time (in seconds) within which fraction +p+ of the operations
+ * counted by +m+ finished.
+ */
+static double
+rmdbx_metrics_percentile( struct rmdbx_op_metrics *m, uint64_t count, double p )
+{
+	uint64_t wanted = (uint64_t)( count * p + 0.5 ), seen = 0;
+	if ( wanted < 1 ) wanted = 1;
+
+	for ( int i = 0; i < RMDBX_METRICS_BUCKETS; i++ ) {
+		seen += m->buckets[i];
+		if ( seen < wanted ) continue;
+
+		uint64_t ns = rmdbx_metrics_bucket_max( i );
+		return ( ns < m->max ? ns : m->max ) / 1e9;
+	}
+
+	return m->max / 1e9;
+}
+
+
+/*
+ * Summarize the counters for a single kind of operation.
+ */
+static VALUE
+rmdbx_op_metrics_hash( struct rmdbx_op_metrics *m )
+{
+	VALUE stat = rb_hash_new();
+	VALUE histogram = rb_hash_new();
+	uint64_t count = m->count;
+
+	rb_hash_aset( stat, ID2SYM(rb_intern("count")), ULL2NUM( count ) );
+	rb_hash_aset( stat, ID2SYM(rb_intern("total")), DBL2NUM( m->total / 1e9 ) );
+	rb_hash_aset( stat, ID2SYM(rb_intern("mean")), DBL2NUM( count ? m->total / 1e9 / count : 0.0 ) );
+	rb_hash_aset( stat, ID2SYM(rb_intern("max")), DBL2NUM( m->max / 1e9 ) );
+
+	if ( count ) {
+		rb_hash_aset( stat, ID2SYM(rb_intern("p50")), DBL2NUM( rmdbx_metrics_percentile(m, count, 0.5) ) );
+		rb_hash_aset( stat, ID2SYM(rb_intern("p90")), DBL2NUM( rmdbx_metrics_percentile(m, count, 0.9) ) );
+		rb_hash_aset( stat, ID2SYM(rb_intern("p99")), DBL2NUM( rmdbx_metrics_percentile(m, count, 0.99) ) );
+		rb_hash_aset( stat, ID2SYM(rb_intern("p999")), DBL2NUM( rmdbx_metrics_percentile(m, count, 0.999) ) );
+	}
+
+	/* Upper bound of each bucket (in seconds) => count, skipping empty buckets. */
+	for ( int i = 0; i < RMDBX_METRICS_BUCKETS; i++ ) {
+		if ( ! m->buckets[i] ) continue;
+		rb_hash_aset( histogram, DBL2NUM( (rmdbx_metrics_bucket_max(i) + 1) / 1e9 ), ULL2NUM( m->buckets[i] ) );
+	}
+	rb_hash_aset( stat, ID2SYM(rb_intern("histogram")), histogram );
+
+	return stat;
+}
+
+
+/*
+ * Add operation counters to +stat+.
+ */
+void
+rmdbx_gather_operation_stats( rmdbx_db_t *db, VALUE stat )
+{
+	VALUE ops = rb_hash_new();
+	rb_hash_aset( stat, ID2SYM(rb_intern("operations")), ops );
+	rb_hash_aset( ops, ID2SYM(rb_intern("enabled")), db->metrics ? Qtrue : Qfalse );
+	if ( ! db->metrics ) return;
+
+	/* Take a copy, so each summary is consistent with itself. */
+	VALUE tmp;
+	struct rmdbx_metrics *copy = ALLOCV( tmp, sizeof(struct rmdbx_metrics) );
+	MEMCPY( copy, db->metrics, struct rmdbx_metrics, 1 );
+
+	rb_hash_aset( ops, ID2SYM(rb_intern("bytes_read")), ULL2NUM( copy->bytes_read ) );
+	rb_hash_aset( ops, ID2SYM(rb_intern("bytes_written")), ULL2NUM( copy->bytes_written ) );
+
+	for ( int op = 0; op < RMDBX_OP_COUNT; op++ )
+		rb_hash_aset( ops, ID2SYM(rb_intern(rmdbx_op_names[op])), rmdbx_op_metrics_hash( &copy->ops[op] ) );
+
+	ALLOCV_END( tmp );
+}
+
+
+/*
+ * call-seq:
+ *    db.reset_operation_stats => true
+ *
+ * Zero every operation counter and histogram.
+ *
+ */
+VALUE
+rmdbx_reset_operation_stats( VALUE self )
+{
+	UNWRAP_DB( self, db );
+	if ( db->metrics ) MEMZERO( db->metrics, struct rmdbx_metrics, 1 );
+	return Qtrue;
+}
+
+
+void
+rmdbx_init_metrics( void )
+{
+	rb_define_method( rmdbx_cDatabase, "reset_operation_stats", rmdbx_reset_operation_stats, 0 );
+}
+
@@ -0,0 +1,421 @@
+/* vim: set noet sta sw=4 ts=4 fdm=marker: */
+/*
+ * A compact MessagePack value codec.
+ *
+ * Supports nil, booleans, Integers (within 64 bits), Floats,
+ * Strings (binary Strings as msgpack bin), Symbols (as Strings),
+ * and Arrays and Hashes of those -- the same mapping as the
+ * msgpack gem's defaults, so data stays readable from other
+ * languages.
+ *
+ */
+
+#include "mdbx_ext.h"
+#include <ruby/encoding.h>
+
+VALUE rmdbx_mMessagePack;
+
+/* Guards against cyclical structures. */
+#define RMDBX_MSGPACK_MAX_DEPTH 512
+
+
+/* ------------------------------------------------------------
+ * Encoding
+ * ------------------------------------------------------------ */
+
+/* Append a type byte and a +size+ byte big-endian +num+. */
+static void
+rmdbx_msgpack_write( VALUE buf, unsigned char type, uint64_t num, int size )
+{
+	unsigned char bytes[9];
+
+	bytes[0] = type;
+	for ( int i = 0; i < size; i++ ) bytes[ size - i ] = (unsigned char)( num >> (i * 8) );
+
+	rb_str_cat( buf, (const char *)bytes, size + 1 );
+}
+
+
+/* Append a length header, choosing the smallest of the given forms. */
+static void
+rmdbx_msgpack_write_len( VALUE buf, long len, unsigned char fix, long fixmax,
+		unsigned char t8, unsigned char t16, unsigned char t32 )
+{
+	if ( len <= fixmax ) {
+		rmdbx_msgpack_write( buf, fix | (unsigned char)len, 0, 0 );
+	}
+	else if ( t8 && len <= 0xff ) {
+		rmdbx_msgpack_write( buf, t8, len, 1 );
+	}
+	else if ( len <= 0xffff ) {
+		rmdbx_msgpack_write( buf, t16, len, 2 );
+	}
+	else if ( len <= 0xffffffffL ) {
+		rmdbx_msgpack_write( buf, t32, len, 4 );
+	}
+	else {
+		rb_raise( rb_eRangeError, "object too large to serialize as msgpack" );
+	}
+}
+
+
+static void rmdbx_msgpack_pack( VALUE buf, VALUE obj, int depth );
+
+/* Hash iterator for encoding maps. */
+static int
+rmdbx_msgpack_pack_pair_i( VALUE key, VALUE val, VALUE argp )
+{
+	VALUE *args = (VALUE *)argp;
+	int depth   = FIX2INT( args[1] );
+
+	rmdbx_msgpack_pack( args[0], key, depth );
+	rmdbx_msgpack_pack( args[0], val, depth );
+
+	return ST_CONTINUE;
+}
+
+
+/* Append an Integer, in its smallest encoding. */
+static void
+rmdbx_msgpack_pack_int( VALUE buf, VALUE obj )
+{
+	if ( RB_FIXNUM_P(obj) || rb_big_sign(obj) == 0 ) {
+		int64_t num = NUM2LL( obj );
+
+		if ( num >= 0 ) {
+			/* Falls through to the unsigned forms below. */
+		}
+		else if ( num >= -32 ) {
+			rmdbx_msgpack_write( buf, (unsigned char)num, 0, 0 );
+			return;
+		}
+		else if ( num >= INT8_MIN ) {
+			rmdbx_msgpack_write( buf, 0xd0, (uint64_t)num, 1 );
+			return;
+		}
+		else if ( num >= INT16_MIN ) {
+			rmdbx_msgpack_write( buf, 0xd1, (uint64_t)num, 2 );
+			return;
+		}
+		else if ( num >= INT32_MIN ) {
+			rmdbx_msgpack_write( buf, 0xd2, (uint64_t)num, 4 );
+			return;
+		}
+		else {
+			rmdbx_msgpack_write( buf, 0xd3, (uint64_t)num, 8 );
+			return;
+		}
+	}
+
+	uint64_t num = NUM2ULL( obj );
+
+	if ( num <= 0x7f ) {
+		rmdbx_msgpack_write( buf, (unsigned char)num, 0, 0 );
+	}
+	else if ( num <= UINT8_MAX ) {
+		rmdbx_msgpack_write( buf, 0xcc, num, 1 );
+	}
+	else if ( num <= UINT16_MAX ) {
+		rmdbx_msgpack_write( buf, 0xcd, num, 2 );
+	}
+	else if ( num <= UINT32_MAX ) {
+		rmdbx_msgpack_write( buf, 0xce, num, 4 );
+	}
+	else {
+		rmdbx_msgpack_write( buf, 0xcf, num, 8 );
+	}
+}
+
+
+/* Append any supported +obj+. */
+static void
+rmdbx_msgpack_pack( VALUE buf, VALUE obj, int depth )
+{
+	if ( ++depth > RMDBX_MSGPACK_MAX_DEPTH )
+		rb_raise( rb_eArgError, "object nested too deeply to serialize as msgpack" );
+
+	switch ( rb_type(obj) ) {
+		case T_NIL:
+			rmdbx_msgpack_write( buf, 0xc0, 0, 0 );
+			break;
+
+		case T_FALSE:
+			rmdbx_msgpack_write( buf, 0xc2, 0, 0 );
+			break;
+
+		case T_TRUE:
+			rmdbx_msgpack_write( buf, 0xc3, 0, 0 );
+			break;
+
+		case T_FIXNUM:
+		case T_BIGNUM:
+			rmdbx_msgpack_pack_int( buf, obj );
+			break;
+
+		case T_FLOAT: {
+			union { double d; uint64_t u; } num;
+			num.d = RFLOAT_VALUE( obj );
+			rmdbx_msgpack_write( buf, 0xcb, num.u, 8 );
+			break;
+		}
+
+		case T_SYMBOL:
+			obj = rb_sym2str( obj );
+			/* fall through */
+
+		case T_STRING: {
+			rb_encoding *enc = rb_enc_get( obj );
+
+			if ( enc == rb_ascii8bit_encoding() ) {
+				rmdbx_msgpack_write_len( buf, RSTRING_LEN(obj), 0, -1, 0xc4, 0xc5, 0xc6 );
+			}
+			else {
+				if ( enc != rb_utf8_encoding() && enc != rb_usascii_encoding() )
+					obj = rb_str_conv_enc( obj, enc, rb_utf8_encoding() );
+				rmdbx_msgpack_write_len( buf, RSTRING_LEN(obj), 0xa0, 31, 0xd9, 0xda, 0xdb );
+			}
+			rb_str_cat( buf, RSTRING_PTR(obj), RSTRING_LEN(obj) );
+			break;
+		}
+
+		case T_ARRAY: {
+			long len = RARRAY_LEN( obj );
+			rmdbx_msgpack_write_len( buf, len, 0x90, 15, 0, 0xdc, 0xdd );
+			for ( long i = 0; i < RARRAY_LEN(obj) && i < len; i++ )
+				rmdbx_msgpack_pack( buf, RARRAY_AREF(obj, i), depth );
+			break;
+		}
+
+		case T_HASH: {
+			VALUE args[2] = { buf, INT2FIX(depth) };
+			rmdbx_msgpack_write_len( buf, RHASH_SIZE(obj), 0x80, 15, 0, 0xde, 0xdf );
+			rb_hash_foreach( obj, rmdbx_msgpack_pack_pair_i, (VALUE)args );
+			break;
+		}
+
+		default:
+			rb_raise( rb_eTypeError, "can't serialize %"PRIsVALUE" as msgpack", rb_obj_class(obj) );
+	}
+}
+
+
+/*
+ * Serialize +obj+ as MessagePack, returning a binary String.
+ */
+VALUE
+rmdbx_msgpack_encode( VALUE obj )
+{
+	VALUE buf = rb_str_buf_new( 64 );
+
+	rmdbx_msgpack_pack( buf, obj, 0 );
+	rb_enc_associate( buf, rb_ascii8bit_encoding() );
+
+	return buf;
+}
+
+
+/* ------------------------------------------------------------
+ * Decoding
+ * ------------------------------------------------------------ */
+
+struct msgpack_reader_s {
+	const unsigned char *ptr;
+	const unsigned char *end;
+};
+
+
+/* Raise for truncated or unsupported data. */
+static void
+rmdbx_msgpack_invalid( const char *why )
+{
+	rb_raise( rmdbx_eDatabaseError, "Invalid msgpack data: %s", why );
+}
+
+
+/* Consume and return a +size+ byte big-endian number. */
+static uint64_t
+rmdbx_msgpack_read( struct msgpack_reader_s *r, int size )
+{
+	uint64_t num = 0;
+
+	if ( r->end - r->ptr < size ) rmdbx_msgpack_invalid( "truncated" );
+	for ( int i = 0; i < size; i++ ) num = ( num << 8 ) | *r->ptr++;
+
+	return num;
+}
+
+
+/* Consume +len+ bytes as a String. */
+static VALUE
+rmdbx_msgpack_read_str( struct msgpack_reader_s *r, uint64_t len, int binary )
+{
+	if ( (uint64_t)( r->end - r->ptr ) < len ) rmdbx_msgpack_invalid( "truncated" );
+
+	const char *ptr = (const char *)r->ptr;
+	r->ptr += len;
+
+	return binary ? rb_str_new( ptr, len ) : rb_utf8_str_new( ptr, len );
+}
+
+
+static VALUE rmdbx_msgpack_unpack( struct msgpack_reader_s *r, int depth );
+
+/* Consume +len+ elements as an Array. */
+static VALUE
+rmdbx_msgpack_read_ary( struct msgpack_reader_s *r, uint64_t len, int depth )
+{
+	if ( (uint64_t)( r->end - r->ptr ) < len ) rmdbx_msgpack_invalid( "truncated" );
+
+	VALUE ary = rb_ary_new_capa( (long)len );
+	for ( uint64_t i = 0; i < len; i++ ) rb_ary_push( ary, rmdbx_msgpack_unpack(r, depth) );
+
+	return ary;
+}
+
+
+/* Consume +len+ key/value pairs as a Hash. */
+static VALUE
+rmdbx_msgpack_read_map( struct msgpack_reader_s *r, uint64_t len, int depth )
+{
+	if ( (uint64_t)( r->end - r->ptr ) < len * 2 ) rmdbx_msgpack_invalid( "truncated" );
+
+	VALUE hash = rb_hash_new();
+	for ( uint64_t i = 0; i < len; i++ ) {
+		VALUE key = rmdbx_msgpack_unpack( r, depth );
+		rb_hash_aset( hash, key, rmdbx_msgpack_unpack(r, depth) );
+	}
+
+	return hash;
+}
+
+
+/* Consume and return a single object. */
+static VALUE
+rmdbx_msgpack_unpack( struct msgpack_reader_s *r, int depth )
+{
+	if ( ++depth > RMDBX_MSGPACK_MAX_DEPTH ) rmdbx_msgpack_invalid( "nested too deeply" );
+
+	unsigned char type = (unsigned char)rmdbx_msgpack_read( r, 1 );
+
+	if ( type <= 0x7f ) return INT2FIX( type );
+	if ( type >= 0xe0 ) return INT2FIX( (int8_t)type );
+	if ( ( type & 0xe0 ) == 0xa0 ) return rmdbx_msgpack_read_str( r, type & 0x1f, 0 );
+	if ( ( type & 0xf0 ) == 0x90 ) return rmdbx_msgpack_read_ary( r, type & 0x0f, depth );
+	if ( ( type & 0xf0 ) == 0x80 ) return rmdbx_msgpack_read_map( r, type & 0x0f, depth );
+
+	switch ( type ) {
+		case 0xc0: return Qnil;
+		case 0xc2: return Qfalse;
+		case 0xc3: return Qtrue;
+
+		case 0xc4: return rmdbx_msgpack_read_str( r, rmdbx_msgpack_read(r, 1), 1 );
+		case 0xc5: return rmdbx_msgpack_read_str( r, rmdbx_msgpack_read(r, 2), 1 );
+		case 0xc6: return rmdbx_msgpack_read_str( r, rmdbx_msgpack_read(r, 4), 1 );
+
+		case 0xca: {
+			union { float f; uint32_t u; } num;
+			num.u = (uint32_t)rmdbx_msgpack_read( r, 4 );
+			return DBL2NUM( num.f );
+		}
+		case 0xcb: {
+			union { double d; uint64_t u; } num;
+			num.u = rmdbx_msgpack_read( r, 8 );
+			return DBL2NUM( num.d );
+		}
+
+		case 0xcc: return UINT2NUM( (unsigned int)rmdbx_msgpack_read(r, 1) );
+		case 0xcd: return UINT2NUM( (unsigned int)rmdbx_msgpack_read(r, 2) );
+		case 0xce: return ULONG2NUM( (unsigned long)rmdbx_msgpack_read(r, 4) );
+		case 0xcf: return ULL2NUM( rmdbx_msgpack_read(r, 8) );
+
+		case 0xd0: return INT2FIX( (int8_t)rmdbx_msgpack_read(r, 1) );
+		case 0xd1: return INT2FIX( (int16_t)rmdbx_msgpack_read(r, 2) );
+		case 0xd2: return LONG2NUM( (int32_t)rmdbx_msgpack_read(r, 4) );
+		case 0xd3: return LL2NUM( (int64_t)rmdbx_msgpack_read(r, 8) );
+
+		case 0xd9: return rmdbx_msgpack_read_str( r, rmdbx_msgpack_read(r, 1), 0 );
+		case 0xda: return rmdbx_msgpack_read_str( r, rmdbx_msgpack_read(r, 2), 0 );
+		case 0xdb: return rmdbx_msgpack_read_str( r, rmdbx_msgpack_read(r, 4), 0 );
+
+		case 0xdc: return rmdbx_msgpack_read_ary( r, rmdbx_msgpack_read(r, 2), depth );
+		case 0xdd: return rmdbx_msgpack_read_ary( r, rmdbx_msgpack_read(r, 4), depth );
+		case 0xde: return rmdbx_msgpack_read_map( r, rmdbx_msgpack_read(r, 2), depth );
+		case 0xdf: return rmdbx_msgpack_read_map( r, rmdbx_msgpack_read(r, 4), depth );
+
+		default:
+			rmdbx_msgpack_invalid( "unsupported type" );
+	}
+
+	return Qnil; /* not reached */
+}
+
+
+/*
+ * Deserialize the MessagePack object in +len+ bytes at +ptr+.
+ * Decodes straight from the buffer (which may be an mdbx page),
+ * copying out only the bytes of Strings.
+ */
+VALUE
+rmdbx_msgpack_decode( const char *ptr, size_t len )
+{
+	struct msgpack_reader_s r = {
+		(const unsigned char *)ptr,
+		(const unsigned char *)ptr + len
+	};
+
+	VALUE rv = rmdbx_msgpack_unpack( &r, 0 );
+	if ( r.ptr != r.end ) rmdbx_msgpack_invalid( "trailing bytes" );
+
+	return rv;
+}
+
+
+/*
+ * call-seq:
+ *    MDBX::MessagePack.dump( obj ) => String
+ *
+ * Serialize +obj+ as MessagePack.
+ */
+VALUE
+rmdbx_msgpack_dump( VALUE self, VALUE obj )
+{
+	return rmdbx_msgpack_encode( obj );
+}
+
+
+/*
+ * call-seq:
+ *    MDBX::MessagePack.load( string ) => obj
+ *
+ * Deserialize a MessagePack +string+.
+ */
+VALUE
+rmdbx_msgpack_load( VALUE self, VALUE str )
+{
+	StringValue( str );
+	VALUE rv = rmdbx_msgpack_decode( RSTRING_PTR(str), RSTRING_LEN(str) );
+	RB_GC_GUARD( str );
+
+	return rv;
+}
+
+
+/*
+ * MDBX::MessagePack initialization
+ */
+void
+rmdbx_init_msgpack( void )
+{
+#ifdef FOR_RDOC
+	rmdbx_mMDBX = rb_define_module( "MDBX" );
+#endif
+
+	/*
+	 * The native MessagePack codec used by the +:msgpack+ serializer.
+	 */
+	rmdbx_mMessagePack = rb_define_module_under( rmdbx_mMDBX, "MessagePack" );
+
+	rb_define_module_function( rmdbx_mMessagePack, "dump", rmdbx_msgpack_dump, 1 );
+	rb_define_module_function( rmdbx_mMessagePack, "load", rmdbx_msgpack_load, 1 );
+}
+
@@ -189,6 +189,59 @@ rmdbx_gather_reader_stats(
 }
 
 
+/*
+ * Counters for the read transaction cache.
+ */
+void
+rmdbx_gather_txn_cache_stats( rmdbx_db_t *db, VALUE stat )
+{
+	VALUE cache = rb_hash_new();
+	rb_hash_aset( stat, ID2SYM(rb_intern("txn_cache")), cache );
+
+	rb_hash_aset( cache, ID2SYM(rb_intern("enabled")),
+			db->settings.txn_cache ? Qtrue : Qfalse );
+	rb_hash_aset( cache, ID2SYM(rb_intern("hits")),
+			ULL2NUM( db->counters.txn_cache_hits ) );
+	rb_hash_aset( cache, ID2SYM(rb_intern("misses")),
+			ULL2NUM( db->counters.txn_cache_misses ) );
+
+	return;
+}
+
+
+/*
+ * Value compression settings and counters.
+ */
+void
+rmdbx_gather_compression_stats( rmdbx_db_t *db, VALUE stat )
+{
+	VALUE compression = rb_hash_new();
+	rb_hash_aset( stat, ID2SYM(rb_intern("compression")), compression );
+
+	uint64_t raw    = db->counters.compress_raw_bytes;
+	uint64_t stored = db->counters.compress_stored_bytes;
+
+	rb_hash_aset( compression, ID2SYM(rb_intern("codec")),
+			rmdbx_compression_name( db ) );
+	rb_hash_aset( compression, ID2SYM(rb_intern("min_size")),
+			LONG2NUM( db->settings.compress_min ) );
+	rb_hash_aset( compression, ID2SYM(rb_intern("values")),
+			ULL2NUM( db->counters.compress_values ) );
+	rb_hash_aset( compression, ID2SYM(rb_intern("compressed_values")),
+			ULL2NUM( db->counters.compress_compressed ) );
+	rb_hash_aset( compression, ID2SYM(rb_intern("dictionary_values")),
+			ULL2NUM( db->counters.compress_dictionary ) );
+	rb_hash_aset( compression, ID2SYM(rb_intern("raw_bytes")),
+			ULL2NUM( raw ) );
+	rb_hash_aset( compression, ID2SYM(rb_intern("stored_bytes")),
+			ULL2NUM( stored ) );
+	rb_hash_aset( compression, ID2SYM(rb_intern("ratio")),
+			stored ? DBL2NUM( (double)raw / (double)stored ) : Qnil );
+
+	return;
+}
+
+
 /*
  * Build and return a hash of various statistic/metadata
  * for the open +db+ handle.
@@ -205,18 +258,23 @@ rmdbx_gather_stats( rmdbx_db_t *db )
 	rmdbx_gather_memory_stats( stat );
 	rmdbx_gather_build_stats( stat );
 
-	rmdbx_open_txn( db, MDBX_TXN_RDONLY );
-    rc = mdbx_env_info_ex( db->env, db->txn, &menvinfo, sizeof(menvinfo) );
+	MDBX_txn *txn = rmdbx_open_txn( db, MDBX_TXN_RDONLY );
+    rc = mdbx_env_info_ex( db->env, txn, &menvinfo, sizeof(menvinfo) );
 	if ( rc != MDBX_SUCCESS )
 		rb_raise( rmdbx_eDatabaseError, "mdbx_env_info_ex: (%d) %s", rc, mdbx_strerror(rc) );
 
-    rc = mdbx_env_stat_ex( db->env, db->txn, &mstat, sizeof(mstat) );
+    rc = mdbx_env_stat_ex( db->env, txn, &mstat, sizeof(mstat) );
 	if ( rc != MDBX_SUCCESS )
 		rb_raise( rmdbx_eDatabaseError, "mdbx_env_stat_ex: (%d) %s", rc, mdbx_strerror(rc) );
 	rmdbx_close_txn( db, RMDBX_TXN_ROLLBACK );
 
 	rmdbx_gather_environment_stats( stat, mstat, menvinfo );
 	rmdbx_gather_reader_stats( db, stat, mstat, menvinfo );
+	rmdbx_gather_txn_cache_stats( db, stat );
+	rmdbx_gather_compression_stats( db, stat );
+	rmdbx_gather_group_stats( db, stat );
+	rmdbx_gather_sync_stats( db, stat, menvinfo );
+	rmdbx_gather_operation_stats( db, stat );
 
 	return stat;
 }
@@ -0,0 +1,361 @@
+/* vim: set noet sta sw=4 ts=4 fdm=marker: */
+/*
+ * Commit durability.
+ *
+ * By default every commit is fsynced before it returns.  The other
+ * sync modes let commits return before their data reaches the disk,
+ * trading the most recent commits after a system crash for much
+ * faster writes:
+ *
+ * - :lazy leaves syncing to the caller (or the OS).  After a crash,
+ *   the database rolls back to the last sync, intact.
+ * - :periodic is :lazy with an upper bound: a sync after every
+ *   +sync_period+ seconds, or +sync_bytes+ of unsynced changes.  A
+ *   background thread ensures the period is honored even when no
+ *   further commits arrive.
+ * - :unsafe doesn't sync metadata either, and a crash can leave the
+ *   database corrupt.  Only for data that can be rebuilt.
+ *
+ */
+
+#include "mdbx_ext.h"
+
+#ifdef HAVE_PTHREAD_H
+#include <errno.h>
+#include <time.h>
+#endif
+
+
+/*
+ * The background syncer for a database handle.
+ */
+struct rmdbx_syncer {
+#ifdef HAVE_PTHREAD_H
+	MDBX_env *env;
+	long period; /* microseconds */
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	int running;
+	int stopping;
+
+	uint64_t syncs;
+#else
+	int unused;
+#endif
+};
+
+
+/*
+ * Set the sync mode for +db+ from a Symbol (or nil, for durable
+ * commits).
+ */
+void
+rmdbx_set_sync_mode( rmdbx_db_t *db, VALUE mode )
+{
+	ID id;
+
+	if ( NIL_P(mode) ) {
+		db->settings.sync_mode = RMDBX_SYNC_DURABLE;
+		return;
+	}
+
+	id = rb_sym2id( mode );
+	if ( id == rb_intern("durable") ) {
+		db->settings.sync_mode = RMDBX_SYNC_DURABLE;
+	}
+	else if ( id == rb_intern("lazy") ) {
+		db->settings.sync_mode = RMDBX_SYNC_LAZY;
+	}
+	else if ( id == rb_intern("periodic") ) {
+		db->settings.sync_mode = RMDBX_SYNC_PERIODIC;
+	}
+	else if ( id == rb_intern("unsafe") ) {
+		db->settings.sync_mode = RMDBX_SYNC_UNSAFE;
+	}
+	else {
+		rb_raise( rb_eArgError, "Unknown sync mode: %"PRIsVALUE, mode );
+	}
+}
+
+
+/*
+ * Return the name of the sync mode for +db+.
+ */
+VALUE
+rmdbx_sync_mode_name( rmdbx_db_t *db )
+{
+	switch ( db->settings.sync_mode ) {
+		case RMDBX_SYNC_LAZY:
+			return ID2SYM( rb_intern("lazy") );
+		case RMDBX_SYNC_PERIODIC:
+			return ID2SYM( rb_intern("periodic") );
+		case RMDBX_SYNC_UNSAFE:
+			return ID2SYM( rb_intern("unsafe") );
+		default:
+			return ID2SYM( rb_intern("durable") );
+	}
+}
+
+
+/*
+ * The environment flags for the sync mode of +db+.
+ */
+unsigned int
+rmdbx_sync_env_flags( rmdbx_db_t *db )
+{
+	switch ( db->settings.sync_mode ) {
+		case RMDBX_SYNC_LAZY:
+		case RMDBX_SYNC_PERIODIC:
+			return MDBX_SAFE_NOSYNC;
+		case RMDBX_SYNC_UNSAFE:
+			return MDBX_UTTERLY_NOSYNC;
+		default:
+			return MDBX_SYNC_DURABLE;
+	}
+}
+
+
+/*
+ * Set the automatic sync thresholds for a periodic +db+, before its
+ * environment is opened.  libmdbx checks them as each write
+ * transaction is committed.
+ */
+void
+rmdbx_set_sync_thresholds( rmdbx_db_t *db )
+{
+	if ( db->settings.sync_mode != RMDBX_SYNC_PERIODIC ) return;
+
+	if ( db->settings.sync_period > 0 )
+		mdbx_env_set_syncperiod( db->env, (unsigned)( db->settings.sync_period * 65536 ) );
+	if ( db->settings.sync_bytes > 0 )
+		mdbx_env_set_syncbytes( db->env, (size_t)db->settings.sync_bytes );
+}
+
+
+#ifdef HAVE_PTHREAD_H
+
+/*
+ * The syncer thread.  Every period, syncs if libmdbx says the
+ * thresholds have been passed.
+ */
+static void *
+rmdbx_syncer_run( void *ptr )
+{
+	struct rmdbx_syncer *syncer = (struct rmdbx_syncer *)ptr;
+	struct timespec until;
+
+	pthread_mutex_lock( &syncer->lock );
+
+	while ( ! syncer->stopping ) {
+		clock_gettime( CLOCK_REALTIME, &until );
+		until.tv_sec  += syncer->period / 1000000;
+		until.tv_nsec += ( syncer->period % 1000000 ) * 1000;
+		if ( until.tv_nsec >= 1000000000 ) {
+			until.tv_sec++;
+			until.tv_nsec -= 1000000000;
+		}
+
+		while ( ! syncer->stopping &&
+				pthread_cond_timedwait( &syncer->wake, &syncer->lock, &until ) != ETIMEDOUT )
+			;
+		if ( syncer->stopping ) break;
+
+		pthread_mutex_unlock( &syncer->lock );
+		int rc = mdbx_env_sync_poll( syncer->env );
+		pthread_mutex_lock( &syncer->lock );
+
+		if ( rc == MDBX_SUCCESS ) syncer->syncs++;
+	}
+
+	syncer->running = 0;
+	pthread_mutex_unlock( &syncer->lock );
+
+	return NULL;
+}
+
+
+
+/*
+ * Stop the background syncer for +db+, if it's running.  See
+ * rmdbx_join_thread() for +nogvl+.
+ */
+static void
+rmdbx_syncer_halt( rmdbx_db_t *db, int nogvl )
+{
+	struct rmdbx_syncer *syncer = db->syncer;
+	if ( ! syncer ) return;
+
+	/* Only one caller joins, should two threads close at once. */
+	pthread_mutex_lock( &syncer->lock );
+	if ( ! syncer->running || syncer->stopping ) {
+		pthread_mutex_unlock( &syncer->lock );
+		return;
+	}
+	syncer->stopping = 1;
+	pthread_cond_signal( &syncer->wake );
+	pthread_mutex_unlock( &syncer->lock );
+
+	rmdbx_join_thread( syncer->thread, nogvl );
+}
+
+#endif /* HAVE_PTHREAD_H */
+
+
+/*
+ * Start the background syncer for a periodic +db+, once its
+ * environment is open.  Without threads, syncs happen only as
+ * transactions are committed.
+ */
+void
+rmdbx_start_syncer( rmdbx_db_t *db )
+{
+#ifdef HAVE_PTHREAD_H
+	if ( db->settings.sync_mode != RMDBX_SYNC_PERIODIC || db->settings.sync_period <= 0 ) return;
+
+	struct rmdbx_syncer *syncer = db->syncer;
+	if ( ! syncer ) {
+		syncer = ZALLOC( struct rmdbx_syncer );
+		pthread_mutex_init( &syncer->lock, NULL );
+		pthread_cond_init( &syncer->wake, NULL );
+		db->syncer = syncer;
+	}
+
+	if ( syncer->running ) return;
+
+	syncer->env      = db->env;
+	syncer->period   = (long)( db->settings.sync_period * 1000000 );
+	syncer->stopping = 0;
+
+	int rc = rmdbx_start_thread( &syncer->thread, rmdbx_syncer_run, (void *)syncer );
+	if ( rc != 0 )
+		rb_raise( rmdbx_eDatabaseError, "Unable to start the background syncer: (%d) %s", rc, strerror(rc) );
+
+	syncer->running = 1;
+#endif
+}
+
+
+/*
+ * Stop the background syncer for +db+, if it's running.  A sync in
+ * progress can take a while, so this waits without the GVL.
+ */
+void
+rmdbx_stop_syncer( rmdbx_db_t *db )
+{
+#ifdef HAVE_PTHREAD_H
+	rmdbx_syncer_halt( db, 1 );
+#endif
+}
+
+
+/*
+ * Stop the background syncer, and free it.
+ */
+void
+rmdbx_free_syncer( rmdbx_db_t *db )
+{
+	if ( ! db->syncer ) return;
+
+#ifdef HAVE_PTHREAD_H
+	rmdbx_syncer_halt( db, 0 );
+	pthread_mutex_destroy( &db->syncer->lock );
+	pthread_cond_destroy( &db->syncer->wake );
+#endif
+
+	xfree( db->syncer );
+	db->syncer = NULL;
+}
+
+
+/* Inline struct for sync arguments, passed as a void pointer. */
+struct sync_args_s {
+	MDBX_env *env;
+	bool force;
+	int rc;
+};
+
+
+/* Flush the environment outside of the GVL. */
+static void *
+rmdbx_sync_without_gvl( void *ptr )
+{
+	struct sync_args_s *args = (struct sync_args_s *)ptr;
+	args->rc = mdbx_env_sync_ex( args->env, args->force, false );
+	return NULL;
+}
+
+
+/*
+ * call-seq:
+ *    db.sync_env( force ) => true or false
+ *
+ * Flush committed changes to disk.  Unless +force+ is true, only
+ * if the periodic sync thresholds have been passed.  Returns false
+ * if there was nothing to sync.
+ *
+ */
+VALUE
+rmdbx_sync_env( VALUE self, VALUE force )
+{
+	UNWRAP_DB( self, db );
+	struct sync_args_s args;
+
+	CHECK_HANDLE();
+
+	args.env   = db->env;
+	args.force = RTEST( force );
+	rmdbx_db_without_gvl( db, rmdbx_sync_without_gvl, (void *)&args );
+
+	switch ( args.rc ) {
+		case MDBX_SUCCESS:
+			return Qtrue;
+		case MDBX_RESULT_TRUE:
+			return Qfalse;
+		default:
+			rb_raise( rmdbx_eDatabaseError, "mdbx_env_sync_ex: (%d) %s", args.rc, mdbx_strerror(args.rc) );
+	}
+}
+
+
+/*
+ * Add sync settings, and how much is waiting to be synced, to +stat+.
+ */
+void
+rmdbx_gather_sync_stats( rmdbx_db_t *db, VALUE stat, MDBX_envinfo menvinfo )
+{
+	VALUE sync = rb_hash_new();
+	uint64_t syncs = 0;
+
+	rb_hash_aset( stat, ID2SYM(rb_intern("sync")), sync );
+
+#ifdef HAVE_PTHREAD_H
+	if ( db->syncer ) {
+		pthread_mutex_lock( &db->syncer->lock );
+		syncs = db->syncer->syncs;
+		pthread_mutex_unlock( &db->syncer->lock );
+	}
+#endif
+
+	rb_hash_aset( sync, ID2SYM(rb_intern("mode")),
+			rmdbx_sync_mode_name( db ) );
+	rb_hash_aset( sync, ID2SYM(rb_intern("period")),
+			DBL2NUM( menvinfo.mi_autosync_period_seconds16dot16 / 65536.0 ) );
+	rb_hash_aset( sync, ID2SYM(rb_intern("bytes")),
+			ULL2NUM( menvinfo.mi_autosync_threshold ) );
+	rb_hash_aset( sync, ID2SYM(rb_intern("unsynced_bytes")),
+			ULL2NUM( menvinfo.mi_unsync_volume ) );
+	rb_hash_aset( sync, ID2SYM(rb_intern("since_sync")),
+			DBL2NUM( menvinfo.mi_since_sync_seconds16dot16 / 65536.0 ) );
+	rb_hash_aset( sync, ID2SYM(rb_intern("background_syncs")),
+			ULL2NUM( syncs ) );
+}
+
+
+void
+rmdbx_init_sync( void )
+{
+	rb_define_protected_method( rmdbx_cDatabase, "sync_env", rmdbx_sync_env, 1 );
+}
+
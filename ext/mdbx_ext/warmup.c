@@ -0,0 +1,240 @@
+/* vim: set noet sta sw=4 ts=4 fdm=marker: */
+/*
+ * Database warm-up.
+ *
+ * A freshly opened database faults its pages in from disk as they're
+ * first read, so the first requests after a start are slow.  Warming
+ * up reads them in ahead of time.  With libmdbx's mdbx_env_warmup,
+ * the whole environment is prefaulted (and optionally locked into
+ * memory); otherwise, or for particular collections, every entry is
+ * read through a cursor, touching each page along the way.
+ *
+ */
+
+#include "mdbx_ext.h"
+#include <time.h>
+
+
+/* Entries walked between checks of the deadline. */
+#define RMDBX_WARMUP_CHECK 1024
+
+/* Inline struct for warm-up arguments, passed as a void pointer. */
+struct warmup_args_s {
+	MDBX_env *env;
+	MDBX_txn *txn;
+	MDBX_dbi *dbis;
+	long count;
+	int lock;
+	double timeout;
+	int timed_out;
+	uint64_t pages;
+	uint64_t bytes;
+	int rc;
+};
+
+
+/* Seconds on a monotonic clock. */
+static double
+rmdbx_warmup_now( void )
+{
+	struct timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+/*
+ * Walk every entry of each collection, reading the first byte of
+ * each page of every value.  Keys are read in passing, as is every
+ * branch and leaf page on the way to them.
+ */
+static void *
+rmdbx_warmup_walk_without_gvl( void *ptr )
+{
+	struct warmup_args_s *args = (struct warmup_args_s *)ptr;
+	double deadline = args->timeout > 0 ? rmdbx_warmup_now() + args->timeout : 0;
+	volatile unsigned char sink = 0;
+	MDBX_stat mstat;
+	long seen = 0;
+
+	for ( long i = 0; i < args->count && ! args->timed_out; i++ ) {
+		MDBX_cursor *cursor;
+		MDBX_val key, data;
+
+		args->rc = mdbx_dbi_stat( args->txn, args->dbis[i], &mstat, sizeof(mstat) );
+		if ( args->rc != MDBX_SUCCESS ) return NULL;
+		args->pages += mstat.ms_branch_pages + mstat.ms_leaf_pages + mstat.ms_overflow_pages;
+
+		args->rc = mdbx_cursor_open( args->txn, args->dbis[i], &cursor );
+		if ( args->rc != MDBX_SUCCESS ) return NULL;
+
+		while ( ( args->rc = mdbx_cursor_get( cursor, &key, &data, MDBX_NEXT ) ) == MDBX_SUCCESS ) {
+			for ( size_t off = 0; off < data.iov_len; off += mstat.ms_psize )
+				sink ^= ((const unsigned char *)data.iov_base)[ off ];
+			args->bytes += key.iov_len + data.iov_len;
+
+			if ( deadline && ++seen % RMDBX_WARMUP_CHECK == 0 && rmdbx_warmup_now() > deadline ) {
+				args->timed_out = 1;
+				break;
+			}
+		}
+
+		mdbx_cursor_close( cursor );
+		if ( args->rc == MDBX_NOTFOUND ) args->rc = MDBX_SUCCESS;
+		if ( args->rc != MDBX_SUCCESS ) return NULL;
+	}
+
+	(void)sink;
+	return NULL;
+}
+
+
+#ifdef HAVE_MDBX_ENV_WARMUP
+/*
+ * Prefault (or lock) the used part of the whole environment.
+ */
+static void *
+rmdbx_warmup_env_without_gvl( void *ptr )
+{
+	struct warmup_args_s *args = (struct warmup_args_s *)ptr;
+	MDBX_warmup_flags_t flags = MDBX_warmup_force | MDBX_warmup_oomsafe;
+	unsigned timeout = args->timeout > 0 ? (unsigned)( args->timeout * 65536 ) : 0;
+	MDBX_envinfo menvinfo;
+	MDBX_stat mstat;
+
+	if ( args->lock ) flags |= MDBX_warmup_lock;
+
+	args->rc = mdbx_env_warmup( args->env, NULL, flags, timeout );
+	if ( args->rc == MDBX_RESULT_TRUE ) {
+		args->timed_out = 1;
+		args->rc = MDBX_SUCCESS;
+	}
+	if ( args->rc != MDBX_SUCCESS ) return NULL;
+
+	args->rc = mdbx_env_info_ex( args->env, NULL, &menvinfo, sizeof(menvinfo) );
+	if ( args->rc == MDBX_SUCCESS ) args->rc = mdbx_env_stat_ex( args->env, NULL, &mstat, sizeof(mstat) );
+	if ( args->rc != MDBX_SUCCESS ) return NULL;
+
+	args->pages = menvinfo.mi_last_pgno + 1;
+	args->bytes = args->pages * mstat.ms_psize;
+
+	return NULL;
+}
+#endif
+
+
+/*
+ * Return the handle for the collection +name+ (nil for the top
+ * level) within +txn+, or 0 if it doesn't exist.
+ */
+static MDBX_dbi
+rmdbx_warmup_dbi( rmdbx_db_t *db, MDBX_txn *txn, VALUE name )
+{
+	const char *cname = NULL;
+	MDBX_dbi dbi;
+
+	if ( ! NIL_P(name) ) {
+		name  = rb_funcall( name, rb_intern("to_s"), 0 );
+		cname = StringValueCStr( name );
+	}
+
+	dbi = rmdbx_cached_dbi( db, cname ? cname : "" );
+	if ( dbi ) return dbi;
+
+	int rc = mdbx_dbi_open( txn, cname, MDBX_DB_ACCEDE, &dbi );
+	if ( rc == MDBX_NOTFOUND ) return 0;
+	if ( rc != MDBX_SUCCESS ) {
+		rmdbx_close_txn( db, RMDBX_TXN_ROLLBACK );
+		rb_raise( rmdbx_eDatabaseError, "Unable to open collection %s: (%d) %s",
+			cname ? cname : "(top level)", rc, mdbx_strerror(rc) );
+	}
+
+	return dbi;
+}
+
+
+/*
+ * call-seq:
+ *    db.warm_pages( collections, lock, timeout ) => hash
+ *
+ * Read the database into memory.  If +collections+ is nil, the
+ * whole environment is prefaulted (locked into memory too, if +lock+
+ * is true) when libmdbx supports it, and the current collection is
+ * walked when it doesn't.  Otherwise, every entry of each named
+ * collection (nil for the top level) is read.  Stops early after
+ * +timeout+ seconds, if given.
+ *
+ * Returns a hash with the number of pages and bytes warmed, and
+ * whether the timeout was reached.
+ *
+ */
+VALUE
+rmdbx_warm_pages( VALUE self, VALUE collections, VALUE lock, VALUE timeout )
+{
+	UNWRAP_DB( self, db );
+	struct warmup_args_s args;
+	VALUE result = rb_hash_new();
+	VALUE tmp = 0;
+
+	CHECK_HANDLE();
+
+	args.txn       = NULL;
+	args.dbis      = NULL;
+	args.count     = 0;
+	args.lock      = RTEST( lock );
+	args.timeout   = NIL_P( timeout ) ? 0 : NUM2DBL( timeout );
+	args.timed_out = 0;
+	args.pages     = 0;
+	args.bytes     = 0;
+	args.rc        = MDBX_SUCCESS;
+	args.env       = db->env; /* after the timeout conversion, which may run Ruby */
+
+#ifdef HAVE_MDBX_ENV_WARMUP
+	if ( NIL_P(collections) ) {
+		rmdbx_db_without_gvl( db, rmdbx_warmup_env_without_gvl, (void *)&args );
+	}
+	else
+#endif
+	{
+		if ( args.lock )
+			rb_raise( rb_eArgError, "Locking pages needs libmdbx's mdbx_env_warmup, and the whole environment" );
+
+		if ( ! NIL_P(collections) ) collections = rb_Array( collections );
+
+		args.txn = rmdbx_open_txn( db, MDBX_TXN_RDONLY );
+
+		long capa  = NIL_P( collections ) ? 1 : RARRAY_LEN( collections );
+		args.dbis  = ALLOCV_N( MDBX_dbi, tmp, capa ? capa : 1 );
+
+		if ( NIL_P(collections) ) {
+			args.dbis[ args.count++ ] = db->dbi;
+		}
+		else {
+			for ( long i = 0; i < capa; i++ ) {
+				MDBX_dbi dbi = rmdbx_warmup_dbi( db, args.txn, RARRAY_AREF(collections, i) );
+				if ( dbi ) args.dbis[ args.count++ ] = dbi;
+			}
+		}
+
+		rmdbx_db_without_gvl( db, rmdbx_warmup_walk_without_gvl, (void *)&args );
+		rmdbx_close_txn( db, RMDBX_TXN_ROLLBACK );
+		ALLOCV_END( tmp );
+	}
+
+	if ( args.rc != MDBX_SUCCESS )
+		rb_raise( rmdbx_eDatabaseError, "Unable to warm up database: (%d) %s", args.rc, mdbx_strerror(args.rc) );
+
+	rb_hash_aset( result, ID2SYM(rb_intern("pages")), ULL2NUM( args.pages ) );
+	rb_hash_aset( result, ID2SYM(rb_intern("bytes")), ULL2NUM( args.bytes ) );
+	rb_hash_aset( result, ID2SYM(rb_intern("timed_out")), args.timed_out ? Qtrue : Qfalse );
+
+	return result;
+}
+
+
+void
+rmdbx_init_warmup( void )
+{
+	rb_define_protected_method( rmdbx_cDatabase, "warm_pages", rmdbx_warm_pages, 3 );
+}
+
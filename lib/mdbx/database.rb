@@ -36,10 +36,59 @@ class MDBX::Database
 	###   Skip compatibility checks when opening an in-use database with
 	###   unknown or mismatched flag values.
 	###
+	### [:compress]
+	###   Compress stored values with +:lz4+ or +:zstd+, if the extension
+	###   was built with that library.  Every value gains a one byte
+	###   header, so a database must always be opened with compression
+	###   either enabled or disabled.
+	###
+	### [:compress_min]
+	###   Only try to compress serialized values of at least this many
+	###   bytes.  Defaults to 512.
+	###
+	### [:dup_fixed]
+	###   As +:dup_sort+, for values that are all the same size once
+	###   serialized (such as fixed width ids with the +:raw+ serializer.)
+	###   Values are stored more compactly, and read a page at a time.
+	###
+	### [:dup_sort]
+	###   Store any number of sorted values under each key.  See #add_dup,
+	###   #delete_dup, #each_dup, and #count_dups.  Assigning a value adds
+	###   it to the key's values, and assigning nil removes them all.
+	###   Can't be combined with +:compress+.
+	###
 	### [:exclusive]
 	###   Access is restricted to the first opening process. Other attempts
 	###   to use this database (even in readonly mode) are denied.
 	###
+	### [:group_commit]
+	###   Queue single writes made outside of a transaction for a
+	###   committer thread, which writes everything queued by all threads
+	###   in one transaction.  Each write still returns only once it's
+	###   committed, but concurrent writers share each commit (and its
+	###   fsync) rather than taking turns.
+	###
+	### [:group_commit_latency]
+	###   How long (in seconds, default 0) the group committer waits for
+	###   more writes after the first is queued.  Waiting trades a little
+	###   latency for larger batches.
+	###
+	### [:group_commit_size]
+	###   The most writes (default 1000) the group committer writes
+	###   in one transaction.
+	###
+	### [:growth_step]
+	###   Grow (and remap) the database file by at least this many bytes
+	###   at a time.  A large step avoids frequent remaps while a big
+	###   database fills.
+	###
+	### [:integer_keys]
+	###   Store keys as native unsigned 64 bit integers, in numeric order.
+	###   Keys must be non-negative Integers, and are returned as such.
+	###   Keys are smaller and faster to compare than their decimal
+	###   strings, and range scans sort correctly.  A collection must
+	###   always be opened with the same key options.
+	###
 	### [:lifo_reclaim]
 	###   Recycle garbage collected items via LIFO, instead of FIFO.
 	###   Depending on underlying hardware (disk write-back cache), this
@@ -82,9 +131,71 @@ class MDBX::Database
 	###   Parallelize read-only transactions across threads.  Writes are
 	###   always thread local. (See MDBX documentation for details.)
 	###
+	### [:operation_stats]
+	###   Count operations, bytes read and written, and the time each
+	###   operation took, for #statistics.  Enabled by default; the cost
+	###   is a couple of clock reads per operation.  Pass false to skip.
+	###
+	### [:page_size]
+	###   The page size in bytes for a new database: a power of two from
+	###   256 to 65536.  Larger pages suit large values.  An existing
+	###   database keeps the page size it was created with.
+	###
 	### [:readonly]
 	###   Reject any write attempts while using this database handle.
 	###
+	### [:reverse_keys]
+	###   Order String keys by comparing them from their last byte to
+	###   their first, which clusters keys sharing a suffix (such as a
+	###   domain name.)  A collection must always be opened with the
+	###   same key options.
+	###
+	### [:serializer]
+	###   How values are serialized: +:marshal+ (the default) stores
+	###   any Ruby object via Marshal, +:msgpack+ stores nils, booleans,
+	###   numbers, Strings, Symbols (as Strings), and Arrays and Hashes of
+	###   them as compact MessagePack, +:string+ stores the result of
+	###   #to_s, and +:raw+ stores String values verbatim.  These are
+	###   handled natively, without dispatching to Ruby for every value.
+	###   Custom serialization is available via #serializer= and
+	###   #deserializer=.
+	###
+	### [:shrink_threshold]
+	###   Shrink the database file once this many bytes at its end are
+	###   unused.
+	###
+	### [:size_lower]
+	###   The smallest size in bytes the database file may shrink to.
+	###
+	### [:size_now]
+	###   Size the database file to this many bytes when opening it,
+	###   reserving the space up front.
+	###
+	### [:sync_bytes]
+	###   With +sync_mode: :periodic+, sync once this many bytes of
+	###   committed changes are waiting.
+	###
+	### [:sync_mode]
+	###   When commits reach the disk.  +:durable+ (the default) syncs
+	###   every commit before it returns.  +:lazy+ leaves syncing to #sync
+	###   and the OS: a system crash loses the commits since the last sync,
+	###   but the database stays intact.  +:periodic+ is +:lazy+, but also
+	###   syncs every +:sync_period+ seconds (1 by default) or
+	###   +:sync_bytes+, bounding the loss.  +:unsafe+ doesn't sync
+	###   metadata either, so a system crash can corrupt the database --
+	###   only for data that can be rebuilt.
+	###
+	### [:sync_period]
+	###   With +sync_mode: :periodic+, the most seconds committed changes
+	###   wait to be synced.  A background thread syncs even if no
+	###   further commits are made.
+	###
+	### [:txn_cache]
+	###   Park read-only transactions after use, and renew them for the
+	###   next read instead of beginning a new one.  This saves a reader
+	###   slot acquire and release for every read outside of a snapshot.
+	###   Cache hits are reported via #statistics.
+	###
 	### [:writemap]
 	###   Trade safety for speed for databases that fit within available
 	###   memory. (See MDBX documentation for details.)
@@ -92,9 +203,6 @@ class MDBX::Database
 	def self::open( *args, &block )
 		db = new( *args )
 
-		db.serializer   = ->( v ) { Marshal.dump( v ) }
-		db.deserializer = ->( v ) { Marshal.load( v ) }
-
 		if block_given?
 			begin
 				yield db
@@ -119,11 +227,29 @@ class MDBX::Database
 
 	# A Proc for automatically serializing values.
 	# Defaults to +Marshal.dump+.
-	attr_accessor :serializer
+	attr_reader :serializer
 
 	# A Proc for automatically deserializing values.
 	# Defaults to +Marshal.load+.
-	attr_accessor :deserializer
+	attr_reader :deserializer
+
+
+	### Replace the Proc used for serializing values, switching
+	### to custom (Ruby dispatched) serialization.
+	###
+	def serializer=( callable )
+		self.serializer_mode = :custom
+		@serializer = callable
+	end
+
+
+	### Replace the Proc used for deserializing values, switching
+	### to custom (Ruby dispatched) serialization.
+	###
+	def deserializer=( callable )
+		self.serializer_mode = :custom
+		@deserializer = callable
+	end
 
 
 	alias_method :size, :length
@@ -142,6 +268,11 @@ class MDBX::Database
 	###      [ ... ]
 	###  end # reverts to the previous collection name
 	###
+	### Switching to a collection that's been used before is cheap.  It
+	### can be done within an open snapshot or transaction, so a single
+	### transaction can span several collections -- but not while another
+	### thread has a transaction open on this handle.
+	###
 	def collection( name=nil )
 		current = self.get_subdb
 		return current unless name
@@ -157,6 +288,23 @@ class MDBX::Database
 	alias_method :namespace, :collection
 
 
+	### Returns a Hash-like object of MDBX::Collection handles by name.
+	### Each handle reads and writes its own collection, without
+	### switching the database's current one, so writes to several
+	### collections can share a single transaction and commit at once.
+	###
+	###  db.transaction do |txn|
+	###      txn.collections[ :users ][ id ] = user
+	###      txn.collections[ :by_email ][ user[:email] ] = id
+	###  end
+	###
+	def collections
+		return @collections ||= Hash.new do |handles, name|
+			handles[ name ] = MDBX::Collection.new( self, name )
+		end
+	end
+
+
 	### Switch to the top-level collection.
 	###
 	def main
@@ -202,6 +350,62 @@ class MDBX::Database
 	end
 
 
+	### Mark a savepoint within the open read/write transaction.
+	### Changes made within the block are kept when it ends, and
+	### discarded if it raises -- leaving everything written before
+	### the savepoint in place.  Raising MDBX::Rollback discards the
+	### savepoint's changes and carries on; any other exception is
+	### re-raised after discarding them.  Savepoints can be nested.
+	###
+	###    db.transaction do
+	###        import_users( db )
+	###        db.savepoint do
+	###            import_orders( db )
+	###            raise MDBX::Rollback unless orders_valid?( db )
+	###        end
+	###    end
+	###
+	def savepoint
+		self.open_savepoint
+		commit = false
+
+		begin
+			yield self
+			commit = true
+		rescue MDBX::Rollback
+			# Only this savepoint's changes are discarded.
+		ensure
+			self.close_savepoint( commit )
+		end
+
+		return self
+	end
+
+
+	### Open an MDBX::Cursor over the current collection, within the
+	### open snapshot or transaction.  In block form, the cursor is
+	### closed when the block exits; otherwise it stays open until
+	### closed or the transaction ends.
+	###
+	###    db.snapshot do
+	###        db.cursor do |cursor|
+	###            cursor.seek( 'user:1000' )
+	###            page = cursor.batch( 50 )
+	###        end
+	###    end
+	###
+	def cursor
+		cursor = MDBX::Cursor.new( self )
+		return cursor unless block_given?
+
+		begin
+			return yield( cursor )
+		ensure
+			cursor.close unless cursor.closed?
+		end
+	end
+
+
 	### Close any open transaction, abandoning all changes.
 	###
 	def rollback
@@ -283,6 +487,54 @@ class MDBX::Database
 	end
 
 
+	### Store every key/value pair from +pairs+ (a Hash, or any
+	### Enumerable that yields two element arrays) within a single
+	### transaction, returning the number of pairs written.  As with
+	### #[]=, a +nil+ value removes the key.
+	###
+	### If +commit_every+ is set, the transaction is committed every
+	### +commit_every+ pairs, bounding its size during large imports.
+	### When called within an open transaction, pairs are written
+	### into it and +commit_every+ is ignored.
+	###
+	###    db.put_many( 'a' => 1, 'b' => 2 ) #=> 2
+	###    db.put_many( rows.lazy.map {|r| [r.id, r] }, commit_every: 10_000 )
+	###
+	def put_many( pairs, commit_every: nil )
+		return self.put_pairs( pairs, commit_every, false )
+	end
+
+
+	### Load key/value pairs from +pairs+, which must be sorted by key
+	### (in the collection's key order) and sort after any existing
+	### keys -- such as when rebuilding a cleared collection from a
+	### sorted dump.  Pairs are appended to the end of the tree rather
+	### than each being looked up, leaving densely packed pages.  An
+	### out of order key raises an MDBX::DatabaseError, rolling back
+	### pairs since the last commit.
+	###
+	### Returns the number of pairs written.  As with #put_many, the
+	### transaction is committed every +commit_every+ pairs unless one
+	### is already open.  With +append+ false, this is #put_many.
+	###
+	###    db.clear
+	###    db.bulk_load( dump.each_pair, commit_every: 100_000 )
+	###
+	def bulk_load( pairs, append: true, commit_every: 100_000 )
+		return self.put_pairs( pairs, commit_every, append )
+	end
+
+
+	### Store every key/value pair from +other+ within a single
+	### transaction, returning the database handle.
+	###
+	def update( other )
+		self.put_many( other )
+		return self
+	end
+	alias_method :merge!, :update
+
+
 	### Returns a new Array containing all keys in the collection.
 	###
 	def keys
@@ -296,11 +548,8 @@ class MDBX::Database
 	### keys.  Any given keys that are not found are ignored.
 	###
 	def slice( *keys )
-		return self.conditional_snapshot do
-			keys.each_with_object( {} ) do |key, acc|
-				val = self[ key ]
-				acc[ key ] = val if val
-			end
+		return keys.zip( self.get_many(keys) ).each_with_object( {} ) do |(key, val), acc|
+			acc[ key ] = val if val
 		end
 	end
 
@@ -317,10 +566,16 @@ class MDBX::Database
 	### Returns a new Array containing values for the given +keys+.
 	###
 	def values_at( *keys )
+		return self.get_many( keys )
+	end
+
+
+	### Returns a new Array containing every value stored under +key+,
+	### for a database opened with +dup_sort+.
+	###
+	def dups( key )
 		return self.conditional_snapshot do
-			keys.each_with_object( [] ) do |key, acc|
-				acc << self[ key ]
-			end
+			self.each_dup( key ).to_a
 		end
 	end
 
@@ -329,6 +584,113 @@ class MDBX::Database
 	# Utility methods
 	#
 
+	### Train a zstd compression dictionary from up to +samples+ values
+	### in the current collection, and use it to compress values written
+	### to the collection from now on.  Small, similar values that are
+	### too short to compress on their own benefit the most.  Requires
+	### the +:zstd+ compression option, and a free collection slot for
+	### storing dictionaries.  Returns the new dictionary id.
+	###
+	### Existing values are left as they are; rewrite them to compress
+	### them with the new dictionary.
+	###
+	def train_dictionary( samples: 10_000, size: 16_384 )
+		values = []
+		self.snapshot do
+			self.each_slice_pairs( 256, raw: true, limit: samples ) {|_, vals| values.concat(vals) }
+		end
+
+		return self.store_dictionary( values, size )
+	end
+
+
+	### Read the database into memory ahead of use, so the first requests
+	### after opening it don't wait on the disk.  By default the whole
+	### environment is prefaulted.  Given +collections+ (names, with nil
+	### for the top level), every entry of each is read instead.  With
+	### +mode: :lock+, the pages are also locked into memory (subject to
+	### RLIMIT_MEMLOCK).  Stops early after +timeout+ seconds, if given.
+	###
+	### Returns a hash of the pages and bytes warmed, the elapsed
+	### seconds, and whether the timeout was reached -- or with
+	### +background+, a Thread that returns it.  Other threads keep
+	### running while the database warms up.
+	###
+	###    warming = db.warmup( background: true )
+	###    ...
+	###    ready! if warming.value[:timed_out] == false
+	###
+	def warmup( collections: nil, mode: :sequential, timeout: nil, background: false )
+		if background
+			return Thread.new do
+				self.warmup( collections: collections, mode: mode, timeout: timeout )
+			end
+		end
+
+		unless %i[ sequential lock ].include?( mode )
+			raise ArgumentError, "Unknown warmup mode: %p" % [ mode ]
+		end
+
+		start  = Process.clock_gettime( Process::CLOCK_MONOTONIC )
+		result = self.warm_pages( collections, mode == :lock, timeout )
+		result[ :seconds ] = Process.clock_gettime( Process::CLOCK_MONOTONIC ) - start
+
+		return result
+	end
+
+
+	### Copy the database while it's in use, to a new data file at +target+
+	### (a path), or streamed to +target+ (an IO with a file descriptor,
+	### such as a File, pipe, or socket).  With +compact+, only pages in
+	### use are written, in order, giving a defragmented and usually
+	### smaller file.  With +force_dynamic_size+, the copy is allowed to
+	### grow and shrink even if this database has a fixed size.
+	###
+	### The copy is a single data file.  Open it with +no_subdir: true+,
+	### or move it into an empty directory as +mdbx.dat+.  Other threads
+	### and processes can keep writing while the copy is made, but the
+	### calling thread can't have a transaction open.
+	###
+	###    db.copy_to( '/backups/db-%s.mdbx' % [ Date.today ] )
+	###    IO.popen( ['gzip'], 'w', out: 'backup.mdbx.gz' ) {|gz| db.copy_to(gz) }
+	###
+	def copy_to( target, compact: true, force_dynamic_size: false )
+		if target.respond_to?( :fileno )
+			target.flush
+			self.copy_to_fd( target.fileno, compact, force_dynamic_size )
+		else
+			self.copy_to_path( target, compact, force_dynamic_size )
+		end
+
+		return target
+	end
+
+
+	### Change the map geometry of the open database: its bounds, current
+	### size, and the steps it grows and shrinks by.  Options are as for
+	### ::open, and any left out are unchanged.  The new geometry is kept
+	### when the database is reopened.  Can't be called within a
+	### transaction.
+	###
+	###    db.resize( max_size: 200 * 2**30, growth_step: 2**30 )
+	###
+	def resize( size_lower: nil, size_now: nil, max_size: nil, growth_step: nil, shrink_threshold: nil )
+		self.set_geometry( size_lower, size_now, max_size, growth_step, shrink_threshold )
+		return self
+	end
+
+
+	### Flush committed changes to disk, for a database opened with a
+	### +:sync_mode+ other than +:durable+.  Unless +force+ is true, only
+	### syncs if the periodic sync thresholds have been passed.  Returns
+	### false if there was nothing to sync.  Other threads keep running
+	### while the sync is in progress.
+	###
+	def sync( force: true )
+		return self.sync_env( force )
+	end
+
+
 	### Return a hash of various metadata for the current database.
 	###
 	def statistics
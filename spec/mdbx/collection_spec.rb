@@ -0,0 +1,93 @@
+#!/usr/bin/env rspec -cfd
+# vim: set nosta noet ts=4 sw=4 ft=ruby:
+
+require_relative '../lib/helper'
+
+
+RSpec.describe( MDBX::Collection ) do
+
+	let!( :db ) { MDBX::Database.open( TEST_DATABASE.to_s, max_collections: 5 ) }
+
+	after( :each ) do
+		db.close
+		TEST_DATABASE.rmtree
+	end
+
+	let( :users ) { db.collections[:users] }
+	let( :by_email ) { db.collections[:by_email] }
+
+
+	it "fails if collections aren't enabled" do
+		db.close
+		db = MDBX::Database.open( TEST_DATABASE.to_s )
+		expect {
+			db.collections[ :users ]
+		}.to raise_exception( MDBX::DatabaseError, /not enabled/ )
+		db.close
+	end
+
+	it "is cached by the database" do
+		expect( users ).to be( db.collections[:users] )
+		expect( users.name ).to eq( 'users' )
+		expect( users.database ).to be( db )
+	end
+
+	it "reads and writes its own collection" do
+		users[ 'a' ] = { name: 'A' }
+		expect( users['a'] ).to eq( name: 'A' )
+		expect( users ).to include( 'a' )
+		expect( users.length ).to eq( 1 )
+
+		expect( db.collection ).to be_nil
+		expect( db['a'] ).to be_nil
+		expect( db.collection('users') { db['a'] } ).to eq( name: 'A' )
+	end
+
+	it "treats a collection that doesn't exist yet as empty" do
+		expect( users['a'] ).to be_nil
+		expect( users ).to_not include( 'a' )
+		expect( users.length ).to eq( 0 )
+	end
+
+	it "can remove keys" do
+		users[ 'a' ] = 1
+		expect( users.delete('a') ).to eq( 1 )
+		expect( users.delete('a') ).to be_nil
+		users[ 'b' ] = 2
+		users[ 'b' ] = nil
+		expect( users.length ).to eq( 0 )
+	end
+
+	it "writes several collections within one transaction" do
+		db.transaction do |txn|
+			txn.collections[ :users ][ 'u1' ] = { email: 'u1@example.com' }
+			txn.collections[ :by_email ][ 'u1@example.com' ] = 'u1'
+			db[ 'top' ] = true
+		end
+
+		expect( users['u1'] ).to eq( email: 'u1@example.com' )
+		expect( by_email['u1@example.com'] ).to eq( 'u1' )
+		expect( db['top'] ).to be( true )
+	end
+
+	it "rolls back every collection together" do
+		users[ 'u1' ] = 1
+
+		db.transaction do
+			users[ 'u1' ] = nil
+			by_email[ 'u1@example.com' ] = 'u1'
+			raise MDBX::Rollback
+		end
+
+		expect( users['u1'] ).to eq( 1 )
+		expect( by_email['u1@example.com'] ).to be_nil
+	end
+
+	it "reads within a snapshot" do
+		users[ 'u1' ] = 1
+		db.snapshot do
+			expect( users['u1'] ).to eq( 1 )
+		end
+	end
+end
+
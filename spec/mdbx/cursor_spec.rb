@@ -0,0 +1,103 @@
+#!/usr/bin/env rspec -cfd
+# vim: set nosta noet ts=4 sw=4 ft=ruby:
+
+require_relative '../lib/helper'
+
+
+RSpec.describe( MDBX::Cursor ) do
+
+	let!( :db ) { MDBX::Database.open( TEST_DATABASE.to_s ) }
+
+	before( :each ) do
+		db.put_many( %w[ a b c d e ].map {|k| [k, k.upcase] } )
+	end
+
+	after( :each ) do
+		db.close
+		TEST_DATABASE.rmtree
+	end
+
+
+	it "raises an exception if the caller didn't open a transaction first" do
+		expect { db.cursor }.to raise_exception( MDBX::DatabaseError, /no .*currently open/i )
+	end
+
+
+	context "within a snapshot" do
+
+		before( :each ) { db.snapshot }
+		after( :each )  { db.abort }
+
+		let( :cursor ) { db.cursor }
+
+
+		it "starts at the first entry" do
+			expect( cursor.next ).to eq([ 'a', 'A' ])
+			expect( cursor.next ).to eq([ 'b', 'B' ])
+		end
+
+		it "can move in either direction" do
+			expect( cursor.last ).to eq([ 'e', 'E' ])
+			expect( cursor.prev ).to eq([ 'd', 'D' ])
+			expect( cursor.current ).to eq([ 'd', 'D' ])
+			expect( cursor.first ).to eq([ 'a', 'A' ])
+			expect( cursor.prev ).to be_nil
+		end
+
+		it "can seek to a key" do
+			expect( cursor.seek('c') ).to eq([ 'c', 'C' ])
+			expect( cursor.seek('bb') ).to eq([ 'c', 'C' ])
+			expect( cursor.seek('z') ).to be_nil
+		end
+
+		it "can fetch entries in batches" do
+			cursor.seek( 'b' )
+			expect( cursor.batch(2) ).to eq([ ['c', 'C'], ['d', 'D'] ])
+			expect( cursor.batch(10) ).to eq([ ['e', 'E'] ])
+			expect( cursor.batch(10) ).to be_empty
+		end
+
+		it "can fetch raw keys and values in batches" do
+			keys, vals = cursor.read_batch( 3 )
+			expect( keys ).to eq( %w[ a b c ] )
+			expect( vals.map {|v| Marshal.load(v) } ).to eq( %w[ A B C ] )
+			expect( cursor.read_batch(10).first ).to eq( %w[ d e ] )
+		end
+
+		it "can interleave independent scans" do
+			other = db.cursor
+			cursor.next
+			expect( other.last ).to eq([ 'e', 'E' ])
+			expect( cursor.next ).to eq([ 'b', 'B' ])
+		end
+
+		it "can be closed" do
+			cursor.close
+			expect( cursor ).to be_closed
+			expect { cursor.next }.to raise_exception( MDBX::DatabaseError, /closed cursor/i )
+		end
+
+		it "is closed when its transaction ends" do
+			cursor.first
+			db.abort
+			db.snapshot
+			expect( cursor ).to be_closed
+			expect { cursor.next }.to raise_exception( MDBX::DatabaseError, /closed cursor/i )
+		end
+
+		it "closes automatically in block form" do
+			rv = db.cursor do |c|
+				expect( c.next ).to eq([ 'a', 'A' ])
+				c
+			end
+			expect( rv ).to be_closed
+		end
+
+		it "can only be used by the thread that opened it" do
+			expect {
+				Thread.new { cursor.next }.join
+			}.to raise_exception( MDBX::DatabaseError, /outside of the thread/i )
+		end
+	end
+end
+
@@ -66,6 +66,17 @@ RSpec.describe( MDBX::Database ) do
 			expect( db.path ).to match( %r|tmp/testdb$| )
 		end
 
+		it "sees new writes when reusing read transactions" do
+			db.close
+			db = described_class.open( TEST_DATABASE.to_s, txn_cache: true )
+			db[ 'key' ] = 1
+			expect( db['key'] ).to eq( 1 )
+			db[ 'key' ] = 2
+			expect( db['key'] ).to eq( 2 )
+			expect( db.length ).to eq( 1 )
+			db.close
+		end
+
 		it "fails if opened again within the same process" do
 			# This is a function of libmdbx internals, just testing
 			# here for behavior.
@@ -168,10 +179,77 @@ RSpec.describe( MDBX::Database ) do
 			expect( db.values_at('e', 'nopenopenope', 'g') ).to eq( ['eee', nil, 'ggg'] )
 		end
 
+		it "can fetch many values from a single snapshot" do
+			( 'a'..'z' ).each{|c| db[c] = c * 3 }
+			expect( db.get_many(['b', :c, 'nope']) ).to eq( ['bbb', 'ccc', nil] )
+			expect( db.get_many([]) ).to eq( [] )
+			expect( db.in_transaction? ).to be_falsey
+		end
+
 		it "can return an array of all values" do
 			( 'a'..'z' ).each{|c| db[c] = c * 2  }
 			expect( db.values ).to include( 'aa', 'hh', 'tt' )
 		end
+
+		it "can store many pairs at once" do
+			rv = db.put_many( 'a' => 1, 'b' => 2, 'c' => 3 )
+			expect( rv ).to eq( 3 )
+			expect( db.to_h ).to eq( 'a' => 1, 'b' => 2, 'c' => 3 )
+		end
+
+		it "can store many pairs from any enumerable" do
+			rv = db.put_many( (1..100).lazy.map {|i| [i, i * 2] }, commit_every: 7 )
+			expect( rv ).to eq( 100 )
+			expect( db.length ).to eq( 100 )
+			expect( db[50] ).to eq( 100 )
+		end
+
+		it "can store more pairs than are staged at once" do
+			rv = db.put_many( (1..1000).map {|i| [i, i] }, commit_every: 300 )
+			expect( rv ).to eq( 1000 )
+			expect( db.length ).to eq( 1000 )
+			expect( db[1000] ).to eq( 1000 )
+		end
+
+		it "removes keys with nil values when storing many pairs" do
+			db[ 'a' ] = 1
+			db.put_many( 'a' => nil, 'b' => 2 )
+			expect( db.to_h ).to eq( 'b' => 2 )
+		end
+
+		it "writes nothing if storing many pairs fails" do
+			pairs = Enumerator.new do |y|
+				y << [ 'a', 1 ]
+				raise "ka-bloooey!"
+			end
+			expect { db.put_many( pairs ) }.to raise_error( RuntimeError, /ka-bloooey!/ )
+			expect( db.in_transaction? ).to be_falsey
+			expect( db ).to_not include( 'a' )
+		end
+
+		it "can bulk load pre-sorted pairs" do
+			rv = db.bulk_load( (1..1000).map {|i| [ "key%04d" % [i], i ] }, commit_every: 300 )
+			expect( rv ).to eq( 1000 )
+			expect( db.length ).to eq( 1000 )
+			expect( db['key0500'] ).to eq( 500 )
+		end
+
+		it "fails fast when bulk loading out of order keys" do
+			db[ 'm' ] = 0
+			expect {
+				db.bulk_load([ ['n', 1], ['p', 2], ['o', 3] ])
+			}.to raise_error( MDBX::DatabaseError, /"o" is out of order/ )
+			expect( db.in_transaction? ).to be_falsey
+			expect( db.keys ).to eq([ 'm' ])
+
+			expect { db.bulk_load([ ['a', 1] ]) }.to raise_error( MDBX::DatabaseError, /out of order/ )
+		end
+
+		it "can be updated from a hash" do
+			db[ 'a' ] = 1
+			expect( db.merge!( 'a' => 2, 'b' => 3 ) ).to be( db )
+			expect( db.to_h ).to eq( 'a' => 2, 'b' => 3 )
+		end
 	end
 
 
@@ -234,6 +312,44 @@ RSpec.describe( MDBX::Database ) do
 			expect( db['key'] ).to be_truthy
 		end
 
+		it "can switch collections within a transaction" do
+			db.collection( 'existing' ) { db['a'] = 1 }
+
+			db.transaction do
+				db.collection( 'existing' ) { db['b'] = 2 }
+				db.collection( 'new' ) { db['c'] = 3 }
+				db['top'] = true
+			end
+			expect( db.collection('existing') { db.to_h } ).to eq( 'a' => 1, 'b' => 2 )
+			expect( db.collection('new') { db['c'] } ).to eq( 3 )
+
+			db.transaction do
+				db.collection( 'existing' ) { db['a'] = nil }
+				raise MDBX::Rollback
+			end
+			expect( db.collection('existing') { db['a'] } ).to eq( 1 )
+		end
+
+		it "can switch collections within a snapshot" do
+			db.collection( 'existing' ) { db['a'] = 1 }
+			db.snapshot do
+				expect( db.collection('existing') { db['a'] } ).to eq( 1 )
+			end
+		end
+
+		it "disallows switching collections while another thread is in a transaction" do
+			queue = Queue.new
+			thr = Thread.new { db.transaction { queue.pop } }
+			Thread.pass until thr.status == 'sleep'
+
+			expect {
+				db.collection( 'bucket' )
+			}.to raise_exception( MDBX::DatabaseError, /another thread/ )
+		ensure
+			queue << true
+			thr.join
+		end
+
 		it "automatically stringifies the collection argument" do
 			db.collection( :bucket )
 			expect( db.collection ).to eq( 'bucket' )
@@ -372,6 +488,14 @@ RSpec.describe( MDBX::Database ) do
 			TEST_DATABASE.rmtree
 		end
 
+		it "forgets snapshots left open by threads that have exited" do
+			db[ 'a' ] = 1
+			Thread.new { db.snapshot; db['a'] }.join
+
+			expect( Thread.new { db[ 'b' ] = 2; db['b'] }.value ).to eq( 2 )
+			expect( db.values_at('a', 'b') ).to eq([ 1, 2 ])
+		end
+
 		it "knows when a transaction is currently open" do
 			expect( db.in_transaction? ).to be_falsey
 			db.snapshot
@@ -385,10 +509,10 @@ RSpec.describe( MDBX::Database ) do
 			expect( db.in_transaction? ).to be_falsey
 		end
 
-		it "throws an error if changing collection mid-transaction" do
+		it "throws an error if switching to a missing collection mid-snapshot" do
 			db.snapshot do
 				expect{ db.collection('nope') }.
-					to raise_exception( MDBX::DatabaseError, /transaction open/ )
+					to raise_exception( MDBX::DatabaseError, /notfound/i )
 			end
 		end
 
@@ -451,6 +575,69 @@ RSpec.describe( MDBX::Database ) do
 			expect( db[ 1 ] ).to be_falsey
 		end
 
+		it "are isolated per thread" do
+			db[ 1 ] = true
+			db.snapshot do
+				thr = Thread.new do
+					expect( db.in_transaction? ).to be_falsey
+					db[ 1 ] = false
+				end
+				thr.join
+				expect( db[ 1 ] ).to be_truthy
+			end
+			expect( db[ 1 ] ).to be_falsey
+		end
+
+		it "keep earlier writes when a savepoint is rolled back" do
+			db.transaction do
+				db[ 1 ] = true
+				db.savepoint do
+					db[ 2 ] = true
+					expect( db[ 2 ] ).to be_truthy
+					raise MDBX::Rollback
+				end
+				expect( db[ 2 ] ).to be_nil
+				db.savepoint { db[ 3 ] = true }
+			end
+
+			expect( db[ 1 ] ).to be_truthy
+			expect( db[ 2 ] ).to be_nil
+			expect( db[ 3 ] ).to be_truthy
+		end
+
+		it "roll back a savepoint on other exceptions" do
+			db.transaction do
+				db[ 1 ] = true
+				expect {
+					db.savepoint do
+						db[ 1 ] = false
+						db.savepoint { db[ 2 ] = true }
+						raise "boom"
+					end
+				}.to raise_exception( RuntimeError, "boom" )
+			end
+
+			expect( db[ 1 ] ).to be( true )
+			expect( db[ 2 ] ).to be_nil
+		end
+
+		it "commit open savepoints with their transaction" do
+			db.transaction
+			db.savepoint do
+				db[ 1 ] = true
+				db.commit
+			end
+			expect( db.in_transaction? ).to be_falsey
+			expect( db[ 1 ] ).to be_truthy
+		end
+
+		it "require a read/write transaction for savepoints" do
+			expect { db.savepoint {} }.to raise_exception( MDBX::DatabaseError, /no read\/write transaction/ )
+			db.snapshot do
+				expect { db.savepoint {} }.to raise_exception( MDBX::DatabaseError, /no read\/write transaction/ )
+			end
+		end
+
 		it "doesn't inadvertantly close transactions when using hash-alike methods" do
 			expect( db.in_transaction? ).to be_falsey
 			db.transaction
@@ -482,6 +669,25 @@ RSpec.describe( MDBX::Database ) do
 			TEST_DATABASE.rmtree
 		end
 
+		it "refuses to close while another thread is iterating" do
+			iterating, release = Queue.new, Queue.new
+			reader = Thread.new do
+				db.snapshot do
+					db.each_pair.map {|pair| iterating << true; release.pop; pair }
+				end
+			end
+			iterating.pop
+
+			expect {
+				db.close
+			}.to raise_error( MDBX::DatabaseError, /transaction open in another thread/ )
+			3.times { release << true }
+
+			expect( reader.join(5) ).to be_truthy
+			expect( db.close ).to be( true )
+			expect( db ).to be_closed
+		end
+
 		it "raises an exception if the caller didn't open a transaction first" do
 			expect{ db.each_key }.to raise_exception( MDBX::DatabaseError, /no .*currently open/i )
 			expect{ db.each_value }.to raise_exception( MDBX::DatabaseError, /no .*currently open/i )
@@ -513,6 +719,62 @@ RSpec.describe( MDBX::Database ) do
 				expect( db.each_pair.to_a.first ).to eq([ "0", "0-val" ])
 				expect( db.each_pair.to_a.last ).to eq([ "2", "2-val" ])
 			end
+
+			it "can iterate through more entries than are fetched at once" do
+				db.abort
+				db.put_many( (100..299).map {|i| [i, i] } )
+				db.snapshot
+				expect( db.each_key.to_a.size ).to eq( 203 )
+				expect( db.each_value.to_a.last ).to eq( 299 )
+			end
+
+			it "can iterate over an inclusive range of keys" do
+				expect( db.each_key(from: '1', to: '2').to_a ).to eq( %w[ 1 2 ] )
+				expect( db.each_pair(from: '0a', to: '1').to_a ).to eq([ ['1', '1-val'] ])
+				expect( db.each_value(to: '0').to_a ).to eq( %w[ 0-val ] )
+			end
+
+			it "can iterate over keys with a prefix" do
+				db.abort
+				db.put_many( 'user:1' => 1, 'user:2' => 2, 'usex' => 3, 'use' => 4 )
+				db.snapshot
+				expect( db.each_key(prefix: 'user:').to_a ).to eq( %w[ user:1 user:2 ] )
+				expect( db.each_key(prefix: 'user:', reverse: true).to_a ).to eq( %w[ user:2 user:1 ] )
+				expect( db.each_key(prefix: 'nope').to_a ).to be_empty
+			end
+
+			it "can iterate in reverse" do
+				expect( db.each_key(reverse: true).to_a ).to eq( %w[ 2 1 0 ] )
+				expect( db.each_key(to: '1a', reverse: true).to_a ).to eq( %w[ 1 0 ] )
+				expect( db.each_key(from: '1', reverse: true).to_a ).to eq( %w[ 2 1 ] )
+			end
+
+			it "can limit the number of entries iterated" do
+				expect( db.each_key(limit: 2).to_a ).to eq( %w[ 0 1 ] )
+				expect( db.each_key(reverse: true, limit: 1).to_a ).to eq( %w[ 2 ] )
+				expect( db.each_key(limit: 0).to_a ).to be_empty
+			end
+
+			it "can iterate in slices of keys and values" do
+				slices = db.each_slice_pairs( 2 ).to_a
+				expect( slices ).to eq([ [%w[0 1], %w[0-val 1-val]], [%w[2], %w[2-val]] ])
+			end
+
+			it "can iterate in slices of raw values" do
+				keys, vals = db.each_slice_pairs( 10, raw: true, from: '1' ).first
+				expect( keys ).to eq( %w[ 1 2 ] )
+				expect( vals.map {|v| Marshal.load(v) } ).to eq( %w[ 1-val 2-val ] )
+			end
+
+			it "rejects unknown iteration options" do
+				expect { db.each_key(nope: true) {} }.to raise_error( ArgumentError, /unknown option/i )
+			end
+
+			it "stops iterating if the transaction is closed by the block" do
+				seen = []
+				db.each_key {|k| seen << k; db.abort }
+				expect( seen ).to eq([ "0" ])
+			end
 		end
 	end
 
@@ -545,6 +807,65 @@ RSpec.describe( MDBX::Database ) do
 			expect( db['test2'] ).to eq( "[1, 2, 3]" )
 		end
 
+		it "serializes natively by default" do
+			expect( db.serializer_mode ).to eq( :marshal )
+			db[ 'test' ] = { a_hash: true }
+			expect( db['test'] ).to eq( a_hash: true )
+		end
+
+		it "can store raw strings natively" do
+			db = described_class.open( TEST_DATABASE.to_s, serializer: :raw )
+			expect( db.serializer ).to be_nil
+			db[ 'test' ] = "doot"
+			expect( db['test'] ).to eq( "doot" )
+			expect { db['test2'] = 1 }.to raise_error( TypeError )
+			db.close
+		end
+
+		it "can store stringified values natively" do
+			db = described_class.open( TEST_DATABASE.to_s, serializer: :string )
+			db[ 'test' ] = [1,2,3]
+			expect( db['test'] ).to eq( "[1, 2, 3]" )
+			db.close
+		end
+
+		it "can store values as MessagePack natively" do
+			db = described_class.open( TEST_DATABASE.to_s, serializer: :msgpack )
+			hash = { 'id' => 1, 'tags' => %w[ a b ], 'score' => 1.5, 'ok' => true, 'none' => nil }
+			db[ 'test' ] = hash
+			db[ 'test2' ] = { sym: :bol }
+			expect( db['test'] ).to eq( hash )
+			expect( db['test2'] ).to eq( 'sym' => 'bol' )
+			expect( db.values_at('test', 'nope') ).to eq([ hash, nil ])
+			db.snapshot do
+				expect( db.each_value.to_a ).to eq([ hash, {'sym' => 'bol'} ])
+				expect( db.each_slice_pairs(5).first.last ).to eq([ hash, {'sym' => 'bol'} ])
+			end
+			db.close
+		end
+
+		it "rejects unknown serializers" do
+			expect {
+				described_class.open( TEST_DATABASE.to_s, serializer: :yaml )
+			}.to raise_error( ArgumentError, /unknown serializer/i )
+		end
+
+		it "switches to custom serialization when a proc is set" do
+			db.serializer = ->( v ) { Marshal.dump( v.upcase ) }
+			expect( db.serializer_mode ).to eq( :custom )
+			db[ 'test' ] = 'doot'
+			expect( db['test'] ).to eq( 'DOOT' )
+		end
+
+		it "closes the transaction if native deserialization fails" do
+			db.serializer = nil
+			db[ 'test' ] = 'not marshalled'
+			db.send( :serializer_mode=, :marshal )
+			db.snapshot
+			expect { db['test'] }.to raise_error( TypeError )
+			expect( db.in_transaction? ).to be_falsey
+		end
+
 		it "can be arbitrarily changed" do
 			db.serializer = ->( v ) { JSON.generate(v) }
 			db.deserializer = ->( v ) { JSON.parse(v) }
@@ -554,5 +875,591 @@ RSpec.describe( MDBX::Database ) do
 			expect( db['test'] ).to eq( hash )
 		end
 	end
+
+
+	context "key ordering" do
+
+		after( :each ) do
+			TEST_DATABASE.rmtree if TEST_DATABASE.exist?
+		end
+
+		it "can store Integer keys in numeric order" do
+			db = described_class.open( TEST_DATABASE.to_s, integer_keys: true )
+			[ 9, 10, 100, 2 ** 40 ].each {|i| db[ i ] = i.to_s }
+
+			expect( db[10] ).to eq( '10' )
+			expect( db.keys ).to eq([ 9, 10, 100, 2 ** 40 ])
+			expect( db.values_at(100, 11) ).to eq([ '100', nil ])
+			db.snapshot do
+				expect( db.each_key( from: 10, to: 100 ).to_a ).to eq([ 10, 100 ])
+				expect( db.each_key( reverse: true, limit: 2 ).to_a ).to eq([ 2 ** 40, 100 ])
+				db.cursor {|c| expect( c.seek(11) ).to eq([ 100, '100' ]) }
+			end
+			db.close
+		end
+
+		it "rejects negative Integer keys" do
+			db = described_class.open( TEST_DATABASE.to_s, integer_keys: true )
+			expect { db[ -1 ] = 'nope' }.to raise_error( ArgumentError, /negative/i )
+			expect { db[ 'one' ] = 'nope' }.to raise_error( TypeError )
+			db.close
+		end
+
+		it "can order String keys from their last byte" do
+			db = described_class.open( TEST_DATABASE.to_s, reverse_keys: true )
+			db.put_many( %w[ www.example.com mail.example.org api.example.com ].map {|k| [k, true] } )
+			expect( db.keys ).to eq( %w[ mail.example.org api.example.com www.example.com ] )
+			db.snapshot do
+				expect { db.each_key( prefix: 'api' ).to_a }.to raise_error( ArgumentError, /prefix/ )
+			end
+			db.close
+		end
+	end
+
+
+	context "duplicate values" do
+
+		after( :each ) do
+			TEST_DATABASE.rmtree if TEST_DATABASE.exist?
+		end
+
+		it "can store several sorted values under a key" do
+			db = described_class.open( TEST_DATABASE.to_s, dup_sort: true, serializer: :raw )
+			expect( db.add_dup('tag', 'c') ).to be( true )
+			expect( db.add_dup('tag', 'a') ).to be( true )
+			expect( db.add_dup('tag', 'c') ).to be( false )
+			db[ 'tag' ] = 'b'
+			db.add_dup( 'other', 'z' )
+
+			expect( db.count_dups('tag') ).to eq( 3 )
+			expect( db.count_dups('nope') ).to eq( 0 )
+			expect( db.dups('tag') ).to eq( %w[ a b c ] )
+
+			expect( db.delete_dup('tag', 'b') ).to be( true )
+			expect( db.delete_dup('tag', 'b') ).to be( false )
+			expect( db.dups('tag') ).to eq( %w[ a c ] )
+
+			db[ 'tag' ] = nil
+			expect( db.dups('tag') ).to be_empty
+			expect( db.dups('other') ).to eq( %w[ z ] )
+			db.close
+		end
+
+		it "reads fixed size values in pages" do
+			db = described_class.open( TEST_DATABASE.to_s, dup_fixed: true, serializer: :raw )
+			ids = Array.new( 5000 ) {|i| "%08d" % [i] }
+			db.transaction { ids.reverse_each {|id| db.add_dup('all', id) } }
+
+			expect( db.count_dups('all') ).to eq( 5000 )
+			expect( db.dups('all') ).to eq( ids )
+			db.close
+		end
+
+		it "leaves no transaction open when a value can't be stored" do
+			db = described_class.open( TEST_DATABASE.to_s, dup_fixed: true, serializer: :raw )
+			expect { db.add_dup( 'all', 12 ) }.to raise_error( TypeError )
+			expect { db.delete_dup( 'all', 12 ) }.to raise_error( TypeError )
+			expect( db.in_transaction? ).to be( false )
+
+			writer = Thread.new { db.add_dup( 'all', '00000001' ) }
+			expect( writer.join(5) ).to be_truthy
+			expect( db.dups('all') ).to eq( %w[ 00000001 ] )
+			db.close
+		end
+
+		it "requires a dup_sort database" do
+			db = described_class.open( TEST_DATABASE.to_s )
+			expect { db.add_dup( 'tag', 'a' ) }.to raise_error( MDBX::DatabaseError, /dup_sort/ )
+			db.close
+		end
+
+		it "can't be combined with compression" do
+			expect {
+				described_class.open( TEST_DATABASE.to_s, dup_sort: true, compress: :lz4 )
+			}.to raise_error( ArgumentError )
+		end
+	end
+
+
+	context "compression" do
+
+		after( :each ) do
+			TEST_DATABASE.rmtree if TEST_DATABASE.exist?
+		end
+
+		%i[ lz4 zstd ].each do |codec|
+			it "transparently compresses large values with #{codec}" do
+				begin
+					db = described_class.open( TEST_DATABASE.to_s, compress: codec, compress_min: 64 )
+				rescue ArgumentError
+					skip "#{codec} isn't supported by this build"
+				end
+
+				big = 'abcdefgh' * 100
+				db[ 'small' ] = 'tiny'
+				db[ 'big' ] = big
+				expect( db['small'] ).to eq( 'tiny' )
+				expect( db['big'] ).to eq( big )
+				expect( db.values_at('small', 'big') ).to eq([ 'tiny', big ])
+				db.snapshot do
+					expect( db.each_value.to_a ).to eq([ big, 'tiny' ])
+					db.cursor {|c| expect( c.next ).to eq([ 'big', big ]) }
+				end
+
+				stats = db.statistics[ :compression ]
+				expect( stats ).to include( codec: codec, values: 2, compressed_values: 1 )
+				expect( stats[:ratio] ).to be > 1
+				db.close
+			end
+		end
+
+		it "can compress small values with a trained zstd dictionary" do
+			begin
+				db = described_class.open( TEST_DATABASE.to_s,
+					compress: :zstd, compress_min: 32, max_collections: 2, serializer: :raw )
+			rescue ArgumentError
+				skip "zstd isn't supported by this build"
+			end
+
+			records = Array.new( 2000 ) do |i|
+				[ "user-%05d" % [i], "name=user#{i} email=user#{i}@example.com plan=basic status=active" ]
+			end
+			db.put_many( records )
+
+			id = db.train_dictionary( samples: 2000, size: 4096 )
+			expect( id ).to be_a( Integer )
+
+			db.put_many( records )
+			expect( db['user-00042'] ).to eq( records[42].last )
+			expect( db.statistics[:compression][:dictionary_values] ).to be > 0
+			db.close
+
+			db = described_class.open( TEST_DATABASE.to_s,
+				compress: :zstd, compress_min: 32, max_collections: 2, serializer: :raw )
+			expect( db.values_at('user-00000', 'user-01999') ).to eq([ records.first.last, records.last.last ])
+			db.close
+		end
+
+		it "uses a trained dictionary for single writes outside a transaction" do
+			begin
+				db = described_class.open( TEST_DATABASE.to_s,
+					compress: :zstd, compress_min: 32, max_collections: 2, serializer: :raw )
+			rescue ArgumentError
+				skip "zstd isn't supported by this build"
+			end
+
+			records = Array.new( 2000 ) do |i|
+				[ "user-%05d" % [i], "name=user#{i} email=user#{i}@example.com plan=basic status=active" ]
+			end
+			db.put_many( records )
+			db.train_dictionary( samples: 2000, size: 4096 )
+
+			before = db.statistics[:compression][:dictionary_values]
+			db[ 'user-10000' ] = records.first.last
+			expect( db.statistics[:compression][:dictionary_values] ).to eq( before + 1 )
+			expect( db['user-10000'] ).to eq( records.first.last )
+			db.close
+		end
+
+		it "compresses collection handle writes with that collection's dictionary" do
+			begin
+				db = described_class.open( TEST_DATABASE.to_s,
+					compress: :zstd, compress_min: 32, max_collections: 3, serializer: :raw )
+			rescue ArgumentError
+				skip "zstd isn't supported by this build"
+			end
+
+			records = Array.new( 2000 ) do |i|
+				[ "user-%05d" % [i], "name=user#{i} email=user#{i}@example.com plan=basic status=active" ]
+			end
+			db.collection( :users ) do
+				db.put_many( records )
+				db.train_dictionary( samples: 2000, size: 4096 )
+			end
+
+			before = db.statistics[:compression][:dictionary_values]
+			db[ 'top' ] = records.first.last
+			expect( db.statistics[:compression][:dictionary_values] ).to eq( before )
+
+			db.collections[ :users ][ 'user-10000' ] = records.first.last
+			expect( db.statistics[:compression][:dictionary_values] ).to eq( before + 1 )
+			expect( db.collections[:users]['user-10000'] ).to eq( records.first.last )
+			db.close
+		end
+
+		it "keeps a dictionary per collection for alternating writes" do
+			begin
+				db = described_class.open( TEST_DATABASE.to_s,
+					compress: :zstd, compress_min: 32, max_collections: 3, serializer: :raw )
+			rescue ArgumentError
+				skip "zstd isn't supported by this build"
+			end
+
+			%i[ users admins ].each do |name|
+				records = Array.new( 2000 ) do |i|
+					[ "#{name}-%05d" % [i], "name=#{name}#{i} email=#{name}#{i}@example.com plan=basic status=active" ]
+				end
+				db.collection( name ) do
+					db.put_many( records )
+					db.train_dictionary( samples: 2000, size: 4096 )
+				end
+			end
+
+			before = db.statistics[:compression][:dictionary_values]
+			users, admins = db.collections[ :users ], db.collections[ :admins ]
+			db.transaction do
+				10.times do |i|
+					users[ "new-#{i}" ] = "name=users#{i} email=users#{i}@example.com plan=basic status=active"
+					admins[ "new-#{i}" ] = "name=admins#{i} email=admins#{i}@example.com plan=basic status=active"
+				end
+			end
+
+			expect( db.statistics[:compression][:dictionary_values] ).to eq( before + 20 )
+			expect( admins['new-3'] ).to eq( "name=admins3 email=admins3@example.com plan=basic status=active" )
+			db.close
+		end
+
+		it "requires zstd compression to train a dictionary" do
+			db = described_class.open( TEST_DATABASE.to_s, max_collections: 2 )
+			expect {
+				db.train_dictionary
+			}.to raise_error( MDBX::DatabaseError, /zstd compression isn't enabled/i )
+			db.close
+		end
+
+		it "rejects unknown codecs" do
+			expect {
+				described_class.open( TEST_DATABASE.to_s, compress: :snappy )
+			}.to raise_error( ArgumentError, /unknown compression/i )
+		end
+	end
+
+
+	context "group commit" do
+
+		let!( :db ) {
+			described_class.open( TEST_DATABASE.to_s, group_commit: true, group_commit_latency: 0.001, max_collections: 2 )
+		}
+
+		after( :each ) do
+			db.close
+			TEST_DATABASE.rmtree
+		end
+
+		it "commits writes from many threads together" do
+			threads = 8.times.map do |i|
+				Thread.new { 50.times {|j| db[ "#{i}:#{j}" ] = j } }
+			end
+			threads.each( &:join )
+
+			expect( db.length ).to eq( 400 )
+			expect( db['7:49'] ).to eq( 49 )
+
+			stats = db.statistics[ :group_commit ]
+			expect( stats ).to include( enabled: true, writes: 400 )
+			expect( stats[:commits] ).to be <= 400
+		end
+
+		it "returns each write's own result" do
+			db[ 'a' ] = 1
+			expect( db['a'] ).to eq( 1 )
+			expect( db.delete('a') ).to eq( 1 )
+			expect( db.delete('a') ).to be_nil
+			db.collections[ :other ][ 'b' ] = 2
+			db.collections[ :other ][ 'b' ] = 3
+			expect( db.collections[:other]['b'] ).to eq( 3 )
+		end
+
+		it "writes directly within a transaction" do
+			db.transaction { db[ 'a' ] = 1 }
+			expect( db['a'] ).to eq( 1 )
+			expect( db.statistics[:group_commit][:writes] ).to eq( 0 )
+		end
+
+		it "restarts the committer after reopening" do
+			db[ 'a' ] = 1
+			db.close
+			db.reopen
+			db[ 'b' ] = 2
+			expect( db.values_at('a', 'b') ).to eq([ 1, 2 ])
+		end
+
+		it "refuses to close while another thread holds a write transaction" do
+			holding, release = Queue.new, Queue.new
+			holder = Thread.new do
+				db.transaction { holding << true; release.pop }
+			end
+			holding.pop
+
+			writer = Thread.new { db[ 'b' ] = 2 }
+			sleep 0.1 # let the committer wait on the held transaction
+			expect {
+				db.close
+			}.to raise_error( MDBX::DatabaseError, /transaction open in another thread/ )
+			release << true
+
+			expect( holder.join(5) ).to be_truthy
+			expect( writer.join(5) ).to be_truthy
+			expect( db.close ).to be( true )
+		end
+
+		it "rejects a batch size below one" do
+			expect {
+				described_class.open( TEST_DATABASE.to_s, group_commit: true, group_commit_size: 0 )
+			}.to raise_error( ArgumentError, /group_commit_size/ )
+		end
+	end
+
+
+	context "sync modes" do
+
+		after( :each ) do
+			TEST_DATABASE.rmtree if TEST_DATABASE.exist?
+		end
+
+		it "syncs every commit by default" do
+			db = described_class.open( TEST_DATABASE.to_s )
+			db[ 'a' ] = 1
+			expect( db.statistics[:sync] ).to include( mode: :durable, unsynced_bytes: 0 )
+			db.close
+		end
+
+		it "leaves lazy commits for an explicit sync" do
+			db = described_class.open( TEST_DATABASE.to_s, sync_mode: :lazy )
+			db[ 'a' ] = 'x' * 1024
+			expect( db.statistics[:sync][:unsynced_bytes] ).to be > 0
+
+			expect( db.sync ).to be( true )
+			expect( db.statistics[:sync][:unsynced_bytes] ).to eq( 0 )
+			expect( db.sync ).to be( false )
+			db.close
+
+			db = described_class.open( TEST_DATABASE.to_s )
+			expect( db['a'] ).to eq( 'x' * 1024 )
+			db.close
+		end
+
+		it "syncs periodically in the background" do
+			db = described_class.open( TEST_DATABASE.to_s, sync_mode: :periodic, sync_period: 0.05 )
+			db[ 'a' ] = 'x' * 1024
+
+			stats = db.statistics[ :sync ]
+			expect( stats[:mode] ).to eq( :periodic )
+			expect( stats[:period] ).to be_within( 0.01 ).of( 0.05 )
+
+			deadline = Time.now + 5
+			sleep 0.05 until db.statistics[:sync][:unsynced_bytes].zero? || Time.now > deadline
+			expect( db.statistics[:sync][:unsynced_bytes] ).to eq( 0 )
+			db.close
+		end
+
+		it "rejects sync thresholds without periodic syncs" do
+			expect {
+				described_class.open( TEST_DATABASE.to_s, sync_period: 1 )
+			}.to raise_error( ArgumentError, /require sync_mode/ )
+		end
+
+		it "rejects unknown sync modes" do
+			expect {
+				described_class.open( TEST_DATABASE.to_s, sync_mode: :sometimes )
+			}.to raise_error( ArgumentError, /unknown sync mode/i )
+		end
+	end
+
+
+	context "map geometry" do
+
+		after( :each ) do
+			TEST_DATABASE.rmtree if TEST_DATABASE.exist?
+		end
+
+		it "can be set when opening" do
+			db = described_class.open( TEST_DATABASE.to_s,
+				size_lower: 2**20, size_now: 4 * 2**20, max_size: 64 * 2**20,
+				growth_step: 2**20, shrink_threshold: 2 * 2**20, page_size: 16_384 )
+
+			stats = db.statistics[ :environment ]
+			expect( stats[:pagesize] ).to eq( 16_384 )
+			expect( stats[:datafile] ).to include( size_upper: 64 * 2**20, growth_step: 2**20 )
+			expect( stats[:datafile][:size_current] ).to be >= 4 * 2**20
+			db.close
+		end
+
+		it "can be resized while open" do
+			db = described_class.open( TEST_DATABASE.to_s, max_size: 16 * 2**20, growth_step: 2**20 )
+			db[ 'a' ] = 1
+
+			db.resize( max_size: 32 * 2**20 )
+			expect( db.statistics[:environment][:datafile][:size_upper] ).to eq( 32 * 2**20 )
+			expect( db['a'] ).to eq( 1 )
+
+			db.reopen
+			expect( db.statistics[:environment][:datafile][:size_upper] ).to eq( 32 * 2**20 )
+			db.close
+		end
+
+		it "can't be resized within a transaction" do
+			db = described_class.open( TEST_DATABASE.to_s )
+			db.transaction do
+				expect { db.resize( max_size: 2**30 ) }.to raise_error( MDBX::DatabaseError, /transaction open/ )
+			end
+			db.close
+		end
+
+		it "rejects invalid page sizes" do
+			expect {
+				described_class.open( TEST_DATABASE.to_s, page_size: 1000 )
+			}.to raise_error( MDBX::DatabaseError, /set_geometry/ )
+		end
+	end
+
+
+	context "copies" do
+
+		let!( :db ) { described_class.open( TEST_DATABASE.to_s ) }
+		let( :copy ) { TEST_DATABASE.parent + 'copy.mdbx' }
+
+		before( :each ) do
+			100.times {|i| db[ i ] = 'x' * 100 }
+			50.times {|i| db[ i ] = nil }
+		end
+
+		after( :each ) do
+			db.close
+			TEST_DATABASE.rmtree
+			copy.unlink if copy.exist?
+			Pathname( "#{copy}-lck" ).unlink if Pathname( "#{copy}-lck" ).exist?
+		end
+
+		def open_copy
+			return described_class.open( copy.to_s, no_subdir: true )
+		end
+
+		it "can be written to a new file" do
+			expect( db.copy_to(copy.to_s) ).to eq( copy.to_s )
+
+			backup = open_copy
+			expect( backup.length ).to eq( 50 )
+			expect( backup['99'] ).to eq( 'x' * 100 )
+			backup.close
+		end
+
+		it "can be streamed to an IO" do
+			copy.open( 'wb' ) {|io| db.copy_to( io, compact: false ) }
+
+			backup = open_copy
+			expect( backup.length ).to eq( 50 )
+			backup.close
+		end
+
+		it "can't be made within a transaction" do
+			db.snapshot do
+				expect { db.copy_to( copy ) }.to raise_error( MDBX::DatabaseError, /transaction open/ )
+			end
+		end
+
+		it "won't overwrite an existing file" do
+			copy.write( 'nope' )
+			expect { db.copy_to( copy ) }.to raise_error( MDBX::DatabaseError, /unable to copy/i )
+		end
+	end
+
+
+	context "warmup" do
+
+		let!( :db ) { described_class.open( TEST_DATABASE.to_s, max_collections: 2 ) }
+
+		before( :each ) do
+			100.times {|i| db[ i ] = 'x' * 100 }
+			db.collection( :other ) { db[ 'a' ] = 'x' * 10_000 }
+		end
+
+		after( :each ) do
+			db.close
+			TEST_DATABASE.rmtree
+		end
+
+		it "warms the whole environment" do
+			result = db.warmup
+			expect( result[:pages] ).to be > 0
+			expect( result[:bytes] ).to be > 0
+			expect( result[:seconds] ).to be >= 0
+			expect( result[:timed_out] ).to be( false )
+		end
+
+		it "warms particular collections" do
+			result = db.warmup( collections: [ nil, :other, :missing ] )
+			expect( result[:bytes] ).to be >= 100 * 100 + 10_000
+		end
+
+		it "can warm up in the background" do
+			thr = db.warmup( collections: [ :other ], background: true )
+			expect( thr ).to be_a( Thread )
+			expect( thr.value[:bytes] ).to be >= 10_000
+		end
+
+		it "rejects unknown modes" do
+			expect { db.warmup( mode: :eager ) }.to raise_error( ArgumentError, /unknown warmup mode/i )
+		end
+	end
+
+
+	context "operation stats" do
+
+		let!( :db ) { described_class.open( TEST_DATABASE.to_s ) }
+
+		after( :each ) do
+			db.close
+			TEST_DATABASE.rmtree
+		end
+
+		it "counts operations and bytes" do
+			10.times {|i| db[ "key#{i}" ] = 'x' * 100 }
+			db[ 'key0' ]
+			db.get_many([ 'key1', 'key2', 'missing' ])
+			db.each_pair {}
+			db.delete( 'key9' )
+
+			stats = db.statistics[ :operations ]
+			expect( stats[:enabled] ).to be( true )
+			expect( stats[:put][:count] ).to eq( 10 )
+			expect( stats[:get][:count] ).to eq( 5 ) # #delete fetches first
+			expect( stats[:del][:count] ).to eq( 1 )
+			expect( stats[:commit][:count] ).to be >= 11
+			expect( stats[:cursor_step][:count] ).to eq( 10 )
+			expect( stats[:serialize][:count] ).to eq( 10 )
+			expect( stats[:bytes_written] ).to be > 1000
+			expect( stats[:bytes_read] ).to be > 1000
+		end
+
+		it "summarizes latencies" do
+			100.times {|i| db[ i ] = i }
+
+			put = db.statistics[:operations][:put]
+			expect( put[:total] ).to be > 0
+			expect( put[:p50] ).to be <= put[:p99]
+			expect( put[:p99] ).to be <= put[:max]
+			expect( put[:histogram].values.sum ).to eq( 100 )
+		end
+
+		it "can be reset" do
+			db[ 'a' ] = 1
+			expect( db.reset_operation_stats ).to be( true )
+
+			stats = db.statistics[ :operations ]
+			expect( stats[:put][:count] ).to eq( 0 )
+			expect( stats[:put][:histogram] ).to be_empty
+			expect( stats[:bytes_written] ).to eq( 0 )
+		end
+
+		it "can be disabled" do
+			db.close
+			other = described_class.open( TEST_DATABASE.to_s, operation_stats: false )
+			other[ 'a' ] = 1
+			expect( other.statistics[:operations] ).to eq( enabled: false )
+		ensure
+			other&.close
+		end
+	end
 end
 
@@ -0,0 +1,60 @@
+#!/usr/bin/env rspec -cfd
+# vim: set nosta noet ts=4 sw=4 ft=ruby:
+
+require_relative '../lib/helper'
+
+
+RSpec.describe( MDBX::MessagePack ) do
+
+	it "round trips supported values" do
+		[
+			nil, true, false, 0, 127, 128, -1, -32, -33, -129, 65_536,
+			2 ** 40, -(2 ** 40), 2 ** 64 - 1, -(2 ** 63), 1.5, -0.25,
+			'', 'hi', 'x' * 40, 'y' * 300, 'z' * 70_000, "caf\u00e9",
+			[], [ 1, [ 2, [ 3 ] ] ], Array.new( 20 ) {|i| i },
+			{}, { 'a' => 1, 'b' => { 'c' => [ nil ] } },
+			Hash[ ( 1..20 ).map {|i| [ i.to_s, i ] } ]
+		].each do |val|
+			expect( described_class.load(described_class.dump(val)) ).to eq( val )
+		end
+	end
+
+	it "uses standard MessagePack encodings" do
+		expect( described_class.dump(nil) ).to eq( "\xC0".b )
+		expect( described_class.dump(1) ).to eq( "\x01".b )
+		expect( described_class.dump(-1) ).to eq( "\xFF".b )
+		expect( described_class.dump(256) ).to eq( "\xCD\x01\x00".b )
+		expect( described_class.dump('a') ).to eq( "\xA1a".b )
+		expect( described_class.dump([1]) ).to eq( "\x91\x01".b )
+		expect( described_class.dump('a' => 1) ).to eq( "\x81\xA1a\x01".b )
+	end
+
+	it "keeps binary and text Strings distinct" do
+		text = described_class.load( described_class.dump('text') )
+		bin  = described_class.load( described_class.dump('bin'.b) )
+		expect( text.encoding ).to eq( Encoding::UTF_8 )
+		expect( bin.encoding ).to eq( Encoding::BINARY )
+	end
+
+	it "stores Symbols as Strings" do
+		expect( described_class.load(described_class.dump(:sym)) ).to eq( 'sym' )
+	end
+
+	it "refuses unsupported objects" do
+		expect { described_class.dump(Object.new) }.to raise_error( TypeError, /msgpack/ )
+		expect { described_class.dump(2 ** 64) }.to raise_error( RangeError )
+	end
+
+	it "refuses cyclical structures" do
+		ary = []
+		ary << ary
+		expect { described_class.dump(ary) }.to raise_error( ArgumentError, /nested too deeply/ )
+	end
+
+	it "refuses invalid data" do
+		expect { described_class.load("\x92\x01".b) }.to raise_error( MDBX::DatabaseError, /truncated/ )
+		expect { described_class.load("\x01\x01".b) }.to raise_error( MDBX::DatabaseError, /trailing/ )
+		expect { described_class.load("\xC1".b) }.to raise_error( MDBX::DatabaseError, /unsupported/ )
+	end
+end
+
@@ -37,5 +37,22 @@ RSpec.describe( MDBX::Database ) do
 	it "returns datafile attributes" do
 		expect( stats.dig(:environment, :datafile, :type) ).to eq( "dynamic" )
 	end
+
+	it "returns read transaction cache counters" do
+		expect( stats[:txn_cache] ).to include( enabled: false, hits: 0 )
+	end
+
+
+	context "with the read transaction cache enabled" do
+
+		let!( :db ) { described_class.open( TEST_DATABASE.to_s, txn_cache: true ) }
+
+		it "counts cache hits" do
+			db[ 'key' ] = 1
+			3.times { db['key'] }
+			expect( stats[:txn_cache][:enabled] ).to be_truthy
+			expect( stats[:txn_cache][:hits] ).to be >= 2
+		end
+	end
 end
 